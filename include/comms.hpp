@@ -2,14 +2,32 @@
 #ifndef __COMMS_H__
 #define __COMMS_H__
 
+#ifdef ARDUINO
 #include "impl/can_comms_driver.hpp"
+#endif
+#include "impl/can_bus_sim.hpp"
+#include "impl/can_timing.hpp"
+#include "impl/clock.hpp"
 #include "impl/command.hpp"
 #include "impl/comms_driver.hpp"
 #include "impl/debug.hpp"
+#include "impl/exec_status.hpp"
+#include "impl/fd_batch.hpp"
 #include "impl/id.hpp"
+#include "impl/loopback_driver.hpp"
+#include "impl/motion.hpp"
+#include "impl/multi_bus_driver.hpp"
 #include "impl/option.hpp"
+#include "impl/outbox.hpp"
+#include "impl/profile.hpp"
 #include "impl/sensor.hpp"
+#include "impl/snapshot.hpp"
+#include "impl/socketcan_driver.hpp"
+#include "impl/subscription.hpp"
 #include "impl/heartbeat.hpp"
+#include "impl/history.hpp"
+#include "impl/traffic_log.hpp"
+#include "impl/transport.hpp"
 #include "impl/error.hpp"
 
 namespace comms {
@@ -20,16 +38,29 @@ struct CommsTickResult {
     MessageInfo info;
 };
 
+/// @brief What a time-budgeted tick did, and what it left for the next one
+struct CommsTickReport {
+    uint32_t budgetUs;
+    uint32_t elapsedUs;       // how long the tick took, it can overrun by about one unit of work
+    uint16_t framesHandled;   // received frames dispatched
+    bool rxLimited;           // receiving stopped before the driver ran dry
+    uint16_t sensorsUpdated;  // due datastreams that were run
+    uint16_t sensorsDeferred;  // due datastreams left for the next tick
+    bool backgroundDeferred;   // heartbeats and the transport were left for the next tick
+    Option<CommsTickResult> lastMessage;  // the last frame that was dispatched, like tick()
 
-/// @brief The central controller for managing communication between MCUs
-class CommsController {
-   public:
-    /// @brief Constructs a CommsController with the given driver and ID
-    /// @param driver The communication driver to use for sending and receiving messages
-    /// @param id The ID of this MCU
-    /// @note The ID should be unique across all MCUs in the system
-    CommsController(CommsDriver& driver, MCUID id);
+    /// @brief True if the tick ran past its budget
+    bool overBudget() const { return elapsedUs > budgetUs; }
+
+    /// @brief True if any work was left for the next tick
+    bool hasDeferredWork() const { return rxLimited || sensorsDeferred != 0 || backgroundDeferred; }
+};
 
+
+/// @brief Everything a CommsController does that doesn't depend on the type of its driver
+/// @note Use CommsController, or BasicCommsController with a concrete driver type, not this class
+class CommsControllerBase {
+   public:
     /// @brief Initializes the communication controller
     /// @note This should be called once before using the controller
     /// @note It sets up the heartbeat manager, error manager, and command manager
@@ -41,7 +72,53 @@ class CommsController {
     /// @brief Sends a command message with the given payload
     /// @param payload The command message payload to send
     /// @note This will send the command to the appropriate MCU based on the payload's mcuID
-    void sendCommand(CommandMessagePayload payload);
+    /// @return A ticket for the outcome, see CommandManager::sendCommand
+    CommandTicket sendCommand(CommandMessagePayload payload);
+
+    /// @brief Sends setpoints for several motors of one MCU, which applies them together
+    /// @param motion The setpoints, and optionally the bus time to apply them at
+    /// @note Motion is streamed: it isn't acknowledged, and a lost command is replaced by the next
+    void sendMotion(const MotionCommand& motion);
+
+    /// @brief Sets how commands of a type are delivered
+    /// @see CommandManager::setQoS
+    void setCommandQoS(CommandType type, QoSPolicy policy);
+
+    /// @brief Sets how one stream of commands, e.g. the setpoints of one motor, is delivered
+    /// @see CommandManager::setQoS
+    void setCommandQoS(CommandType type, MCUID target, uint8_t motor, QoSPolicy policy);
+
+    /// @brief Starts the command buffers of a group of nodes at the same moment
+    /// @param group The nodes to start, only their commands have to be acknowledged first
+    /// @param leadTimeUs How far after the group is ready the start is scheduled
+    /// @param bank The command bank each node runs, a node still running another bank switches to
+    /// it as soon as that one is empty
+    /// @note Nodes start on the first tick at or after the start time, so needs heartbeats running
+    /// for the time sync, see sendMotion
+    void beginExecution(const std::vector<MCUID>& group,
+                        uint32_t leadTimeUs = CommandManager::kDefaultStartLeadUs,
+                        uint8_t bank = 0);
+
+    /// @brief Checks if a node has acknowledged every command sent to it
+    bool isNodeReady(MCUID node) const;
+
+    /// @brief Adds a function called whenever a node finishes a slice of its command buffer
+    /// @param callback Called from tick() with the report, executionDone is set on the last slice
+    /// of an execution, after which the node waits for a new start
+    /// @note Reports aren't acknowledged, a lost one shows as a gap in lastCommandID
+    void onExecutionStatus(std::function<void(const ExecutionReport&)> callback);
+
+    /// @brief Gets what the execution statuses of a node added up to
+    /// @return The metrics, or none if the node hasn't reported yet
+    Option<ExecutionMetrics> getExecutionMetrics(MCUID node) const;
+
+    /// @brief Gets the current bus time, the high level's Clock::micros()
+    /// @note On the low level it is estimated from the stamps on heartbeat requests, so it is only
+    /// meaningful once isBusTimeSynced() is true
+    uint32_t busTimeUs() const;
+
+    /// @brief True on the high level, and on the low level once a heartbeat request has arrived
+    bool isBusTimeSynced() const;
 
     /// @brief Gets the value of a sensor from a specific sender
     /// @param sender The ID of the MCU that sent the sensor data
@@ -50,6 +127,78 @@ class CommsController {
     /// @note This will return the most recent value received from the specified sensor
     Option<float> getSensorValue(MCUID sender, uint8_t sensorID);
 
+    /// @brief Checks if a sensor stream from a specific sender is still alive
+    /// @param sender The ID of the MCU that sends the sensor data
+    /// @param sensorID The ID of the sensor to check
+    /// @param timeoutMs How long the stream may be silent before it is considered dead
+    /// @return True if any frame for the sensor, including a keep-alive, arrived within the timeout
+    /// @note Streams using a deadband only send when the value moves, so pick a timeout larger
+    /// than the sender's keep-alive interval
+    bool isSensorAlive(MCUID sender, uint8_t sensorID, uint32_t timeoutMs);
+
+    /// @brief Gets the range a sensor covered in its last update period
+    /// @param sender The ID of the MCU that sent the sensor data
+    /// @param sensorID The ID of the sensor to get the envelope for
+    /// @return An Option containing the envelope if available, or none if not
+    /// @note The envelope collapses to the value unless the sender samples with SFT_MIN_MAX
+    Option<SensorEnvelope> getSensorEnvelope(MCUID sender, uint8_t sensorID);
+
+    /// @brief Copies the latest value of every sensor of a node into a caller-provided buffer
+    /// @param sender The ID of the MCU that sends the sensor data
+    /// @param out The buffer, count and version are filled in
+    /// @return True if the snapshot is consistent, false if it couldn't be taken because the
+    /// values were being updated, try again later
+    /// @note Snapshots hold the values as of the end of the last tick, so all values of one frame
+    /// or one tick are seen together. Safe to call from other threads and interrupts
+    bool snapshotNode(MCUID sender, SensorSnapshot* out) const;
+
+    /// @brief Copies the latest values of a group of sensors, in the order given
+    /// @param sensors The sensors, they may belong to different nodes
+    /// @param count The number of sensors
+    /// @see snapshotNode
+    bool snapshotGroup(const SensorKey* sensors, size_t count, SensorSnapshot* out) const;
+
+    /// @brief Keeps a history of the samples received from a sensor
+    /// @param sender The ID of the MCU that sends the sensor data
+    /// @param sensorID The ID of the sensor
+    /// @param capacity The most samples kept, rounded up to a power of two
+    /// @param windowMs The span of the window getSensorHistory()->windowMean() and friends cover
+    /// @note Calling it again for the same sensor starts a new, empty history
+    void enableSensorHistory(MCUID sender, uint8_t sensorID, size_t capacity, uint32_t windowMs);
+
+    /// @brief Gets the history of a sensor
+    /// @return The history, or nullptr if enableSensorHistory() wasn't called for the sensor
+    /// @note The history is updated in place by tick(), read it between ticks
+    const SensorHistory* getSensorHistory(MCUID sender, uint8_t sensorID) const;
+
+    /// @brief Calls a function whenever a new sample of a sensor arrives
+    /// @param sender The ID of the MCU that sends the sensor data
+    /// @param sensorID The ID of the sensor
+    /// @param callback Called from tick() with the updated sensor status
+    /// @param minIntervalMs Samples arriving sooner than this after the last call are skipped, 0
+    /// calls on every sample
+    /// @return The ID of the subscription, to pass to unsubscribe()
+    /// @note Keep-alives don't carry a new sample, so they don't call it
+    SubscriptionID subscribeSensor(MCUID sender, uint8_t sensorID,
+                                   std::function<void(const SensorStatus&)> callback,
+                                   uint32_t minIntervalMs = 0);
+
+    /// @brief Posts every new sample of a sensor to a mailbox, to be taken from another context
+    /// @param mailbox The mailbox, owned by the caller, it must outlive the subscription
+    /// @see subscribeSensor
+    SubscriptionID subscribeSensor(MCUID sender, uint8_t sensorID, SensorMailbox* mailbox,
+                                   uint32_t minIntervalMs = 0);
+
+    /// @brief Calls a function whenever a new sample of any sensor of a node arrives
+    /// @note The rate limit applies to the node as a whole, not to each sensor
+    /// @see subscribeSensor
+    SubscriptionID subscribeNode(MCUID sender, std::function<void(const SensorStatus&)> callback,
+                                 uint32_t minIntervalMs = 0);
+
+    /// @brief Removes a subscription
+    /// @return True if the subscription existed
+    bool unsubscribe(SubscriptionID id);
+
     /// @brief Enables heartbeat request dispatching
     /// @param intervalMs The interval in milliseconds to send heartbeat requests
     /// @param toMonitor A vector of MCUIDs to monitor for heartbeats
@@ -62,9 +211,31 @@ class CommsController {
     /// @param updateRateMs The rate in milliseconds at which to update the sensor
     /// @param sensorID The ID of the sensor to add
     /// @param sensor The sensor object to add
+    /// @param policy Decides which readings are sent, defaults to sending every reading
     /// @note This will create a new SensorDatastream and start sending sensor data
     /// @note The sensorID should be unique for each sensor added on this MCU -- does not need to be unique across all MCUs
-    void addSensor(uint32_t updateRateMs, uint8_t sensorID, std::shared_ptr<Sensor> sensor);
+    void addSensor(uint32_t updateRateMs, uint8_t sensorID, std::shared_ptr<Sensor> sensor,
+                   SensorTransmissionPolicy policy = SensorTransmissionPolicy::periodic());
+
+    /// @brief Adds a datastream for a split-phase sensor to the controller
+    /// @note Conversions are pipelined across ticks, so a slow sensor never blocks tick()
+    void addSensor(uint32_t updateRateMs, uint8_t sensorID, std::shared_ptr<AsyncSensor> sensor,
+                   SensorTransmissionPolicy policy = SensorTransmissionPolicy::periodic());
+
+    /// @brief Sets up the sampling stage of a sensor datastream
+    /// @param sensorID The ID of a sensor added with addSensor
+    /// @param sampling How often to sample, and how to reduce the samples before sending
+    /// @return True if the sensor exists, false otherwise
+    bool setSensorSampling(uint8_t sensorID, SensorSamplingConfig sampling);
+
+    /// @brief Sets the handler that executes buffered commands of a type once a start arrives
+    /// @note Each slice the handlers finish is reported to the high level, see onExecutionStatus
+    void setCommandHandler(CommandType type, std::shared_ptr<CommandHandler> handler);
+
+    /// @brief Sets the function motion commands for this MCU are handed to
+    /// @param handler Called from tick() with all setpoints of a command at once, at the time the
+    /// command asked for, if it asked for one
+    void setMotionHandler(std::function<void(const MotionSetpoints&)> handler);
 
     // general controls
 
@@ -83,9 +254,12 @@ class CommsController {
     void clearError(ErrorCode error);
     
 
-    /// @brief Ticks the communication controller, processing any incoming messages and updating state
-    /// @return An Option containing the result of the tick operation, or none if no messages were processed
-    Option<CommsTickResult> tick();
+    /// @brief The most received frames one tick() handles, the rest wait for the next tick
+    static constexpr size_t kMaxMessagesPerTick = 32;
+
+    /// @brief The longest a budgeted tick puts off heartbeats and the transport, after which they
+    /// run even if the budget is spent
+    static constexpr uint32_t kMaxBackgroundDelayUs = 10000;
 
     /// @brief Returns the ID of this MCU
     /// @return The ID of this MCU
@@ -96,16 +270,81 @@ class CommsController {
     /// @note This handler will be called for any messages that do not match a registered sensor or command
     void setUnregisteredMessageHandler(std::function<void(RawCommsMessage)> handler);
 
+    /// @brief Routes segmented transport frames to a transport, and ticks it
+    /// @param transport The transport to attach, owned by the caller, or nullptr to detach
+    void attachTransport(SegmentedTransport* transport);
+
+   protected:
+    /// @brief Constructs the controller state
+    /// @param driver The driver the outbox flushes to when it fills up between ticks
+    /// @param id The ID of this MCU
+    CommsControllerBase(CommsDriver& driver, MCUID id);
+
+    /// @brief Runs the senders: datastreams, heartbeats, commands, errors and the transport
+    /// @param fd True if the driver supports CAN FD, so sensor readings can share frames
+    void tickManagers(bool fd);
+
+    /// @brief Runs the work a budgeted tick does after receiving: errors, then due datastreams by
+    /// deadline, then heartbeats and the transport as background work
+    /// @param fd True if the driver supports CAN FD
+    /// @param startUs When the tick started
+    /// @param report Filled in with what ran and what was deferred
+    void tickManagersWithinBudget(bool fd, uint32_t startUs, CommsTickReport* report);
+
+    /// @brief Checks if a budgeted tick has time left
+    static bool withinBudget(uint32_t startUs, const CommsTickReport& report) {
+        return Clock::micros() - startUs < report.budgetUs;
+    }
+
+    /// @brief Runs the work other nodes are waiting on: timed motion, retransmissions
+    void tickUrgent();
+
+    /// @brief Publishes the sensor values to snapshots, if any changed during this tick
+    void publishSnapshot();
+
+    /// @brief Hands a frame, or each record packed in it, to its handler
+    /// @param message The frame, cut down to its first 8 bytes
+    /// @param bytes The whole payload of the frame
+    /// @param length The length of the whole payload, more than 8 on CAN FD
+    Option<CommsTickResult> handleFrame(const RawCommsMessage& message, const uint8_t* bytes,
+                                        uint8_t length);
+
+    /// @brief Hands a message to the handler for its content type
+    void dispatch(MessageInfo info, const RawCommsMessage& message);
+
+    /// @brief Collects everything the managers send during a tick, so it reaches the driver in one
+    /// batch
+    MessageOutbox _outbox;
+
+    /// @brief The command manager for handling commands
+    CommandManager _commandManager;
+
    private:
-   
     /// @brief Updates the sensor datastreams, sending any new data
-    void updateDatastreams();
+    /// @param fd True if the driver supports CAN FD
+    void updateDatastreams(bool fd);
+
+    /// @brief Runs due datastreams, most overdue first, until the budget is spent
+    /// @note The most overdue one always runs, so sending keeps going however tight the budget
+    void updateDatastreamsWithinBudget(bool fd, uint32_t startUs, CommsTickReport* report);
 
     /// @brief Updates the heartbeat manager, sending heartbeats and checking for timeouts
     void updateHeartbeats();
 
-    /// @brief The HAL driver used for sending and receiving messages
-    CommsDriver& _driver;
+    /// @brief Decodes a sensor message and updates the matching sensor status
+    /// @param info The information about the received message
+    /// @param message The raw sensor message
+    void handleSensorMessage(MessageInfo info, RawCommsMessage message);
+
+    /// @brief Adds a subscription, and assigns its ID
+    SubscriptionID addSubscription(SensorSubscription subscription);
+
+    /// @brief Timestamps a new sample, records it in the sensor's history, and hands it to its
+    /// subscribers
+    void publishSample(SensorStatus& status);
+
+    /// @brief Hands a new sample to every subscription that matches it
+    void notifySubscribers(const SensorStatus& status);
 
     /// @brief A handler for unregistered messages
     /// @note This will be called for any messages that do not match a registered sensor or command
@@ -115,24 +354,198 @@ class CommsController {
     /// @note This allows for quick access to sensor data by ID
     std::unordered_map<uint8_t, SensorDatastream> _sensorDatastreams;
 
+    /// @brief Scratch space for a budgeted tick, the datastreams that are due
+    std::vector<SensorDatastream*> _dueDatastreams;
+
+    /// @brief When a budgeted tick last ran heartbeats and the transport
+    uint32_t _lastBackgroundUs;
+
     /// @brief A vector of sensor statuses, containing the most recent values from each sensor
     /// @note This is used to provide quick access to the latest sensor values
     std::vector<SensorStatus> _sensorStatuses;
 
+    /// @brief The sensor values readers in other contexts take snapshots of
+    SensorSnapshotTable _snapshotTable;
+
+    /// @brief Set when a sample arrives, so the table is only published on ticks that changed it
+    bool _snapshotDirty;
+
+    /// @brief The sensor histories, keyed by sender and sensor ID
+    std::unordered_map<uint16_t, SensorHistory> _sensorHistories;
+
+    /// @brief The consumers of sensor samples, in the order they subscribed
+    std::vector<SensorSubscription> _subscriptions;
+
+    /// @brief The ID the next subscription gets
+    SubscriptionID _nextSubscriptionID;
+
+    /// @brief How many notifySubscribers() calls are running, unsubscribe() only marks
+    /// subscriptions removed while any is, so none of them skips a subscriber
+    uint8_t _notifyDepth;
+
     /// @brief The heartbeat manager for handling heartbeats
     HeartbeatManager _heartbeatManager;
 
     /// @brief The error manager for handling errors
     ErrorManager _errorManager;
 
-    /// @brief The command manager for handling commands
-    CommandManager _commandManager;
+    /// @brief Collects motion commands sent to this MCU and applies them
+    MotionReceiver _motionReceiver;
+
+    /// @brief Collects the execution statuses of the low level nodes
+    ExecutionMonitor _executionMonitor;
+
+    /// @brief The segmented transport, if one is attached
+    SegmentedTransport* _transport;
 
     /// @brief The ID of this MCU
     /// @note This should be unique across all MCUs in the system
     MCUID _me;
 };
 
+/// @brief The central controller for managing communication between MCUs
+/// @tparam Driver The type of the HAL driver. With a concrete driver type, e.g.
+/// TeensyCANDriver<2, CBR_500KBPS>, every call into the driver is resolved at compile time and can
+/// be inlined. CommsController is the polymorphic version, for drivers picked at runtime
+/// @note Concrete drivers are final, so the compiler knows no override can sit in between
+template <typename Driver>
+class BasicCommsController : public CommsControllerBase {
+   public:
+    /// @brief Constructs a controller with the given driver and ID
+    /// @param driver The communication driver to use for sending and receiving messages
+    /// @param id The ID of this MCU
+    /// @note The ID should be unique across all MCUs in the system
+    BasicCommsController(Driver& driver, MCUID id)
+        : CommsControllerBase(driver, id), _driver(driver) {}
+
+    /// @brief Ticks the communication controller, processing any incoming messages and updating state
+    /// @return An Option containing the result of the tick operation, or none if no messages were processed
+    /// @note Up to kMaxMessagesPerTick frames are handled per tick, the result is the last of them
+    /// that was dispatched
+    /// @note Everything sent during the tick is handed to the driver in one batch at the end
+    Option<CommsTickResult> tick() {
+        COMMS_PROFILE_ZONE(PZ_TICK);
+        bool fd = _driver.supportsFD();
+        tickManagers(fd);
+
+        Option<CommsTickResult> result = fd ? receiveFDAndDispatch() : receiveAndDispatch();
+        publishSnapshot();
+        // acknowledgements for what we just received go out in the same batch as queued commands
+        _commandManager.flush();
+        _outbox.flushTo(_driver);
+        return result;
+    }
+
+    /// @brief Ticks within a time budget, running the most urgent work first
+    /// @param budgetUs How long the tick may take, in microseconds
+    /// @return What ran, and what was left for the next tick
+    /// @note Work is done in this order: received frames and the acknowledgements they need, timed
+    /// motion and retransmissions, errors, due sensor datastreams with the most overdue first, then
+    /// heartbeats and the transport. Work is only started while there is budget left, except that
+    /// at least one frame and one datastream are handled so nothing starves, and heartbeats run at
+    /// least every kMaxBackgroundDelayUs. Leftover frames stay queued in the driver and leftover
+    /// datastreams stay due, so both are first in line next tick
+    CommsTickReport tick(uint32_t budgetUs) {
+        COMMS_PROFILE_ZONE(PZ_TICK);
+        uint32_t startUs = Clock::micros();
+        CommsTickReport report{budgetUs, 0, 0, false, 0, 0, false,
+                               Option<CommsTickResult>::none()};
+
+        bool fd = _driver.supportsFD();
+        tickUrgent();
+        report.lastMessage = receiveWithinBudget(fd, startUs, &report);
+        tickManagersWithinBudget(fd, startUs, &report);
+
+        publishSnapshot();
+        _commandManager.flush();
+        _outbox.flushTo(_driver);
+
+        report.elapsedUs = Clock::micros() - startUs;
+        return report;
+    }
+
+   private:
+    /// @brief Receives and dispatches frames one at a time while there is budget left
+    /// @return The last frame that was dispatched, or none if there were none
+    Option<CommsTickResult> receiveWithinBudget(bool fd, uint32_t startUs,
+                                                CommsTickReport* report) {
+        COMMS_PROFILE_ZONE(PZ_DRIVER_RX);
+        Option<CommsTickResult> result = Option<CommsTickResult>::none();
+
+        for (size_t i = 0; i < kMaxMessagesPerTick; i++) {
+            if (i != 0 && !withinBudget(startUs, *report)) {
+                report->rxLimited = true;
+                return result;
+            }
+
+            Option<CommsTickResult> handled = Option<CommsTickResult>::none();
+            if (fd) {
+                RawCommsFDMessage frame;
+                if (!_driver.receiveFDMessage(&frame)) return result;
+
+                RawCommsMessage message{};
+                message.id = frame.id;
+                message.length = frame.length > 8 ? 8 : frame.length;
+                memcpy(message.payloadBytes, frame.payloadBytes, message.length);
+                handled = handleFrame(message, frame.payloadBytes, frame.length);
+            } else {
+                RawCommsMessage message;
+                if (!_driver.receiveMessage(&message)) return result;
+                handled = handleFrame(message, message.payloadBytes, message.length);
+            }
+
+            report->framesHandled++;
+            if (handled.isSome()) result = handled;
+        }
+
+        // stopped on the frame limit, there may be more
+        report->rxLimited = true;
+        return result;
+    }
+
+    /// @brief Drains up to kMaxMessagesPerTick classic frames in one batch and dispatches them
+    /// @return The last frame that was dispatched, or none if there were none
+    Option<CommsTickResult> receiveAndDispatch() {
+        COMMS_PROFILE_ZONE(PZ_DRIVER_RX);
+        Option<CommsTickResult> result = Option<CommsTickResult>::none();
+
+        RawCommsMessage messages[kMaxMessagesPerTick];
+        size_t count = _driver.receiveMessages(messages, kMaxMessagesPerTick);
+        for (size_t i = 0; i < count; i++) {
+            Option<CommsTickResult> handled =
+                handleFrame(messages[i], messages[i].payloadBytes, messages[i].length);
+            if (handled.isSome()) result = handled;
+        }
+        return result;
+    }
+
+    /// @brief Drains up to kMaxMessagesPerTick CAN FD frames and dispatches them
+    /// @return The last frame that was dispatched, or none if there were none
+    Option<CommsTickResult> receiveFDAndDispatch() {
+        COMMS_PROFILE_ZONE(PZ_DRIVER_RX);
+        Option<CommsTickResult> result = Option<CommsTickResult>::none();
+
+        RawCommsFDMessage frame;
+        for (size_t i = 0; i < kMaxMessagesPerTick && _driver.receiveFDMessage(&frame); i++) {
+            RawCommsMessage message{};
+            message.id = frame.id;
+            message.length = frame.length > 8 ? 8 : frame.length;
+            memcpy(message.payloadBytes, frame.payloadBytes, message.length);
+
+            Option<CommsTickResult> handled =
+                handleFrame(message, frame.payloadBytes, frame.length);
+            if (handled.isSome()) result = handled;
+        }
+        return result;
+    }
+
+    /// @brief The HAL driver used for sending and receiving messages
+    Driver& _driver;
+};
+
+/// @brief The polymorphic controller, it works with any CommsDriver through virtual calls
+using CommsController = BasicCommsController<CommsDriver>;
+
 }  // namespace comms
 
 #endif  // __COMMS_H__
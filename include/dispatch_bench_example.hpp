@@ -0,0 +1,59 @@
+#ifndef __DISPATCH_BENCH_EXAMPLE_H__
+#define __DISPATCH_BENCH_EXAMPLE_H__
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+#include "comms.hpp"
+
+using namespace comms;
+
+namespace dispatch_bench {
+
+/// @brief Streams sensors from a low-level controller to a high-level one over a loopback bus
+/// @tparam Driver The driver type the controllers are built on
+/// @return The number of sensor frames sent and dispatched per second
+template <typename Driver>
+double framesPerSecond(LoopbackBus& bus, uint32_t ticks, uint8_t sensors) {
+    BasicCommsController<Driver> low(bus.addDriver(), MCUID::MCU_LOW_LEVEL_0);
+    BasicCommsController<Driver> high(bus.addDriver(), MCUID::MCU_HIGH_LEVEL);
+    low.initialize();
+    high.initialize();
+
+    for (uint8_t i = 0; i < sensors; i++) {
+        // an update rate of 0 sends a reading on every tick
+        low.addSensor(0, i, std::make_shared<LambdaSensor>([] { return true; },
+                                                           [i] { return i * 0.5f; }, [] {}));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < ticks; t++) {
+        low.tick();
+        high.tick();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return static_cast<double>(ticks) * sensors / seconds;
+}
+
+/// @brief Runs the same sensor stream through the polymorphic CommsController, and through a
+/// BasicCommsController built on the concrete LoopbackDriver, and prints the throughput of both
+/// @param ticks How many ticks to run each controller pair for
+/// @param sensors How many sensors the low-level controller streams, each sends every tick
+inline void run(uint32_t ticks = 200000, uint8_t sensors = 16) {
+    LoopbackBus virtualBus(false);
+    LoopbackBus staticBus(false);
+
+    double virtualRate = framesPerSecond<CommsDriver>(virtualBus, ticks, sensors);
+    double staticRate = framesPerSecond<LoopbackDriver>(staticBus, ticks, sensors);
+
+    printf("CommsController                      %.2f M frames/s\n", virtualRate / 1e6);
+    printf("BasicCommsController<LoopbackDriver> %.2f M frames/s (x%.2f)\n", staticRate / 1e6,
+           staticRate / virtualRate);
+}
+
+}  // namespace dispatch_bench
+
+#endif  // __DISPATCH_BENCH_EXAMPLE_H__
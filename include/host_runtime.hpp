@@ -0,0 +1,138 @@
+// host_runtime.hpp
+#ifndef __HOST_RUNTIME_H__
+#define __HOST_RUNTIME_H__
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "comms.hpp"
+#include "impl/mpsc_queue.hpp"
+
+namespace comms {
+
+/// @brief The kind of work a thread hands to a HostRuntime
+enum HostRequestType : uint8_t {
+    HRT_COMMAND,
+    HRT_MOTION,
+};
+
+/// @brief Work handed from any thread to the runtime's I/O thread
+struct HostRequest {
+    HostRequestType type;
+    CommandMessagePayload command;  // for HRT_COMMAND
+    MotionCommand motion;           // for HRT_MOTION
+    std::function<void(CommandStatus)> onComplete;  // for HRT_COMMAND, may be empty
+
+    HostRequest() : type(HRT_COMMAND), motion(MCUID::MCU_ANY) {}
+};
+
+/// @brief Counters of a HostRuntime, for monitoring
+struct HostRuntimeStats {
+    uint64_t ticks;             // controller ticks run by the I/O thread
+    uint64_t requestsHandled;   // commands and motion handed to the controller
+    uint64_t requestsRejected;  // commands and motion refused because the queue was full
+};
+
+/// @brief Runs a CommsController on a dedicated I/O thread, for Linux and other hosts where
+/// several threads, e.g. control, logging and a UI, use the bus at once
+/// @note Only the I/O thread touches the controller. Other threads read sensor values from the
+/// controller's snapshot table, a seqlock, and hand commands over through a lock-free queue, so
+/// neither path takes a lock
+class HostRuntime {
+   public:
+    /// @brief How many commands can wait for the I/O thread
+    static constexpr size_t kQueueCapacity = 256;
+
+    /// @brief Constructs a runtime, the I/O thread isn't started until start()
+    /// @param driver The driver to run, only the I/O thread uses it once started
+    /// @param id The ID of this MCU
+    /// @param idleSleepUs How long the I/O thread sleeps after a tick that had nothing to do
+    HostRuntime(CommsDriver& driver, MCUID id, uint32_t idleSleepUs = 100);
+
+    /// @brief Stops the I/O thread
+    ~HostRuntime();
+
+    HostRuntime(const HostRuntime&) = delete;
+    HostRuntime& operator=(const HostRuntime&) = delete;
+
+    /// @brief The controller, to set up sensors, handlers and heartbeats
+    /// @note Only use it before start() or after stop(), the I/O thread owns it in between
+    CommsController& controller() { return _controller; }
+
+    /// @brief Initializes the controller and starts the I/O thread
+    void start();
+
+    /// @brief Stops the I/O thread, after it hands the queued commands to the controller and
+    /// flushes them
+    void stop();
+
+    /// @brief True between start() and stop()
+    bool isRunning() const { return _running.load(std::memory_order_relaxed); }
+
+    /// @brief Queues a command for the I/O thread to send, safe to call from any thread
+    /// @return False if the queue is full, the command is dropped
+    bool sendCommand(CommandMessagePayload payload);
+
+    /// @brief Queues a command for the I/O thread to send and reports its outcome, safe to call
+    /// from any thread
+    /// @param onComplete Called with the outcome, as CommandTicket::onComplete
+    /// @note The CommandTicket itself stays on the I/O thread, its pool isn't synchronized, so
+    /// onComplete runs there, from the tick that learns the outcome. Keep it short and hand the
+    /// status over, e.g. through a std::promise or an atomic
+    /// @return False if the queue is full, the command is dropped and onComplete is never called
+    bool sendCommand(CommandMessagePayload payload,
+                     std::function<void(CommandStatus)> onComplete);
+
+    /// @brief Queues a motion command for the I/O thread to send, safe to call from any thread
+    /// @return False if the queue is full, the command is dropped
+    bool sendMotion(const MotionCommand& motion);
+
+    /// @brief Gets the latest value of a sensor, safe to call from any thread
+    /// @return The value as of the end of the I/O thread's last tick, or none if the sensor hasn't
+    /// been heard from
+    Option<float> getSensorValue(MCUID sender, uint8_t sensorID) const;
+
+    /// @brief Copies the latest value of every sensor of a node, safe to call from any thread
+    /// @see CommsControllerBase::snapshotNode
+    bool snapshotNode(MCUID sender, SensorSnapshot* out) const;
+
+    /// @brief Copies the latest values of a group of sensors, safe to call from any thread
+    /// @see CommsControllerBase::snapshotGroup
+    bool snapshotGroup(const SensorKey* sensors, size_t count, SensorSnapshot* out) const;
+
+    /// @brief Gets the counters, safe to call from any thread
+    HostRuntimeStats stats() const;
+
+   private:
+    /// @brief The body of the I/O thread
+    void run();
+
+    /// @brief Hands the queued requests to the controller
+    /// @return The number handled
+    size_t drainRequests();
+
+    /// @brief Queues a request, counting it if it doesn't fit
+    bool push(const HostRequest& request);
+
+    CommsController _controller;
+    MPSCQueue<HostRequest, kQueueCapacity> _requests;
+    uint32_t _idleSleepUs;
+
+    std::thread _thread;
+    std::atomic<bool> _running;
+
+    std::atomic<uint64_t> _ticks;
+    std::atomic<uint64_t> _requestsHandled;
+    std::atomic<uint64_t> _requestsRejected;
+};
+
+}  // namespace comms
+
+#endif  // ARDUINO
+
+#endif  // __HOST_RUNTIME_H__
@@ -0,0 +1,106 @@
+#ifndef __HOST_RUNTIME_BENCH_EXAMPLE_H__
+#define __HOST_RUNTIME_BENCH_EXAMPLE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "host_runtime.hpp"
+
+using namespace comms;
+
+namespace host_runtime_bench {
+
+/// @brief Stresses a HostRuntime from many threads at once and prints the throughput
+/// @note A low-level node streams sensors from its own runtime over a loopback bus. On the
+/// high-level runtime, reader threads poll sensor values and snapshots, while writer threads send
+/// best-effort motor commands
+/// @param readers The number of threads reading sensor values
+/// @param writers The number of threads sending commands
+/// @param seconds How long to run
+/// @param sensors How many sensors the low-level node streams, each sends every tick
+inline void run(uint8_t readers = 4, uint8_t writers = 2, double seconds = 2.0,
+                uint8_t sensors = 8) {
+    LoopbackBus bus(false);
+    HostRuntime low(bus.addDriver(4096), MCUID::MCU_LOW_LEVEL_0, 0);
+    HostRuntime high(bus.addDriver(4096), MCUID::MCU_HIGH_LEVEL, 0);
+
+    for (uint8_t i = 0; i < sensors; i++) {
+        // an update rate of 0 sends a reading on every tick
+        low.controller().addSensor(0, i, std::make_shared<LambdaSensor>(
+                                             [] { return true; }, [i] { return i * 0.5f; }, [] {}));
+    }
+    high.controller().setCommandQoS(CommandType::CMD_MOTOR_CONTROL, QOS_BEST_EFFORT);
+
+    low.start();
+    high.start();
+
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> reads(0), snapshots(0), retries(0), sent(0), rejected(0);
+
+    std::vector<std::thread> threads;
+    for (uint8_t r = 0; r < readers; r++) {
+        threads.emplace_back([&] {
+            SensorSnapshotBuffer<32> buffer;
+            uint64_t localReads = 0, localSnapshots = 0, localRetries = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                high.getSensorValue(MCUID::MCU_LOW_LEVEL_0, 0);
+                localReads++;
+
+                SensorSnapshot snapshot = buffer.view();
+                if (high.snapshotNode(MCUID::MCU_LOW_LEVEL_0, &snapshot)) {
+                    localSnapshots++;
+                } else {
+                    localRetries++;
+                }
+            }
+            reads += localReads;
+            snapshots += localSnapshots;
+            retries += localRetries;
+        });
+    }
+    for (uint8_t w = 0; w < writers; w++) {
+        threads.emplace_back([&, w] {
+            uint64_t localSent = 0, localRejected = 0;
+            uint8_t value = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                MotorControlCommandOpt opt(MCUID::MCU_LOW_LEVEL_0, w, MC_CMD_POS, value++);
+                if (high.sendCommand(CommandBuilder::motorControl(MCUID::MCU_HIGH_LEVEL, opt))) {
+                    localSent++;
+                } else {
+                    localRejected++;
+                    std::this_thread::yield();
+                }
+            }
+            sent += localSent;
+            rejected += localRejected;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    done = true;
+    for (std::thread& thread : threads) thread.join();
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - start).count();
+
+    high.stop();
+    low.stop();
+
+    HostRuntimeStats highStats = high.stats();
+    printf("I/O thread ticks      %.2f M/s\n", highStats.ticks / elapsed / 1e6);
+    printf("sensor value reads    %.2f M/s over %d threads\n", reads / elapsed / 1e6, readers);
+    printf("node snapshots        %.2f M/s, %llu given up on during a publish\n",
+           snapshots / elapsed / 1e6, static_cast<unsigned long long>(retries.load()));
+    printf("commands queued       %.2f M/s over %d threads, %llu rejected on a full queue\n",
+           sent / elapsed / 1e6, writers, static_cast<unsigned long long>(rejected.load()));
+    printf("commands sent by I/O  %llu\n",
+           static_cast<unsigned long long>(highStats.requestsHandled));
+}
+
+}  // namespace host_runtime_bench
+
+#endif  // __HOST_RUNTIME_BENCH_EXAMPLE_H__
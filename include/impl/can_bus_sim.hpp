@@ -0,0 +1,216 @@
+#ifndef __CAN_BUS_SIM_H__
+#define __CAN_BUS_SIM_H__
+
+/**========================================================================
+ *                             can_bus_sim.hpp
+ *
+ *  A deterministic, host-side model of a classic CAN bus, for capacity
+ *  planning and as a regression benchmark. Every node is a CommsDriver, so
+ *  real CommsControllers can be run on top of it.
+ *
+ *  The model covers arbitration by ID, exact frame length including stuff
+ *  bits at the configured bit rate, and finite TX/RX mailboxes. Time only
+ *  moves when the simulation advances its VirtualClock.
+ *
+ *========================================================================**/
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "can_timing.hpp"
+#include "clock.hpp"
+#include "comms_driver.hpp"
+
+namespace comms {
+
+/// @brief A clock that only moves when told to
+/// @note Install it with Clock::setSource() so the whole library runs on simulated time
+class VirtualClock : public ClockSource {
+   public:
+    VirtualClock() : _nowUs(0) {}
+
+    /// @brief Gets the current time in milliseconds
+    uint32_t millis() override { return static_cast<uint32_t>(_nowUs / 1000); }
+
+    /// @brief Gets the current time in microseconds
+    uint32_t micros() override { return static_cast<uint32_t>(_nowUs); }
+
+    /// @brief Gets the current time in microseconds, without wrapping
+    uint64_t nowUs() const { return _nowUs; }
+
+    /// @brief Moves time forward
+    /// @param us The number of microseconds to move forward by
+    void advance(uint64_t us) { _nowUs += us; }
+
+    /// @brief Sets the current time, it should never go backwards
+    /// @param us The time in microseconds
+    void setTime(uint64_t us) { _nowUs = us; }
+
+   private:
+    uint64_t _nowUs;
+};
+
+/// @brief Statistics for every frame sent with one CAN ID
+struct SimMessageStats {
+    uint32_t id;
+    uint32_t sent;            // frames that made it onto the bus
+    uint32_t txDrops;         // frames dropped because the sender's TX mailboxes were full
+    uint32_t rxDrops;         // deliveries dropped because a receiver's RX mailboxes were full
+    uint32_t latencyP50Us;    // from sendMessage() to the end of the frame on the wire
+    uint32_t latencyP90Us;
+    uint32_t latencyP99Us;
+    uint32_t latencyMaxUs;
+    uint32_t meanQueueingUs;  // from sendMessage() to winning arbitration
+};
+
+/// @brief Statistics for the whole bus
+struct SimBusStats {
+    uint64_t elapsedUs;  // simulated time covered by the statistics
+    uint64_t busyUs;     // time a frame was on the wire
+    float load;          // busyUs / elapsedUs
+    uint32_t frames;
+    uint32_t txDrops;
+    uint32_t rxDrops;
+};
+
+class SimulatedCANBus;
+
+/// @brief One node on a SimulatedCANBus, seen by the library as its CommsDriver
+class SimulatedCANNode final : public CommsDriver {
+   public:
+    /// @brief Does nothing, the node is attached to the bus when it's created
+    void install() override {}
+
+    /// @brief Does nothing, nodes live as long as their bus
+    void uninstall() override {}
+
+    /// @brief Puts a frame in a TX mailbox, to contend for the bus on the next arbitration
+    /// @param message The frame to send
+    /// @note The frame is dropped if every TX mailbox is full, like a full FlexCAN TX queue
+    void sendMessage(const RawCommsMessage& message) override;
+
+    /// @brief Takes the oldest frame out of the RX mailboxes
+    /// @param res The received frame
+    /// @return True if a frame was waiting, false otherwise
+    bool receiveMessage(RawCommsMessage* res) override;
+
+    /// @brief Takes up to a batch of frames out of the RX mailboxes
+    size_t receiveMessages(RawCommsMessage* messages, size_t capacity) override;
+
+    /// @brief The index of this node on its bus
+    size_t index() const { return _index; }
+
+   private:
+    friend class SimulatedCANBus;
+
+    /// @brief A frame waiting in a TX mailbox
+    struct PendingFrame {
+        RawCommsMessage message;
+        uint64_t enqueuedUs;
+        uint64_t sequence;  // orders frames with the same ID, so they leave in FIFO order
+    };
+
+    SimulatedCANNode(SimulatedCANBus* bus, size_t index) : _bus(bus), _index(index) {}
+
+    SimulatedCANBus* _bus;
+    size_t _index;
+    std::vector<PendingFrame> _tx;
+    std::deque<RawCommsMessage> _rx;
+};
+
+/// @brief A classic CAN bus shared by any number of SimulatedCANNodes
+class SimulatedCANBus {
+   public:
+    /// @brief Constructs a simulated bus
+    /// @param baudRate The bit rate of the bus
+    /// @param clock The clock the simulation runs on
+    /// @param txMailboxes The number of frames each node can have waiting to be sent
+    /// @param rxMailboxes The number of received frames each node can hold before dropping
+    SimulatedCANBus(CANBaudRate baudRate, VirtualClock* clock, size_t txMailboxes = 16,
+                    size_t rxMailboxes = 64);
+
+    /// @brief Adds a node to the bus
+    /// @return The new node, which stays valid as long as the bus does
+    SimulatedCANNode& addNode();
+
+    /// @brief Simulates the bus up to a point in time, without moving the clock
+    /// @param timeUs The time to simulate up to, in microseconds
+    /// @note Frames finishing at or before timeUs are delivered, and any arbitration starting
+    /// before timeUs is resolved
+    void advanceTo(uint64_t timeUs);
+
+    /// @brief Runs the simulation in fixed steps
+    /// @param durationUs How long to run for, in microseconds
+    /// @param stepUs How much time passes between calls to step
+    /// @param step Called at the start of every step, typically ticks every CommsController
+    void run(uint64_t durationUs, uint32_t stepUs, std::function<void()> step);
+
+    /// @brief Gets statistics for the whole bus since the last reset
+    SimBusStats busStats() const;
+
+    /// @brief Gets statistics per CAN ID since the last reset, ordered by ID
+    std::vector<SimMessageStats> messageStats() const;
+
+    /// @brief Clears all statistics, e.g. after a warm-up period
+    void resetStats();
+
+    /// @brief Prints the bus and per-ID statistics as a table
+    /// @param out Where to print the report
+    void printReport(FILE* out = stdout) const;
+
+   private:
+    friend class SimulatedCANNode;
+
+    /// @brief Per-ID bookkeeping, turned into SimMessageStats on demand
+    struct IDRecord {
+        std::vector<uint32_t> latenciesUs;
+        uint64_t queueingUs = 0;
+        uint32_t txDrops = 0;
+        uint32_t rxDrops = 0;
+    };
+
+    /// @brief A frame currently on the wire
+    struct InFlight {
+        size_t node;
+        SimulatedCANNode::PendingFrame frame;
+        uint64_t startUs;
+        uint64_t endUs;
+    };
+
+    /// @brief Called by nodes when their TX mailboxes overflow
+    void recordTxDrop(uint32_t id);
+
+    /// @brief Picks the winner of an arbitration starting at startUs, if any frame is waiting
+    bool arbitrate(uint64_t startUs, InFlight* winner);
+
+    /// @brief Delivers the frame on the wire to every other node
+    void complete(const InFlight& frame);
+
+    CANBaudRate _baudRate;
+    uint32_t _bitTimeNs;
+    VirtualClock* _clock;
+    size_t _txMailboxes;
+    size_t _rxMailboxes;
+
+    std::vector<std::unique_ptr<SimulatedCANNode>> _nodes;
+    uint64_t _sequence;
+
+    bool _busy;
+    InFlight _inFlight;
+    uint64_t _idleSinceUs;
+
+    uint64_t _statsStartUs;
+    uint64_t _busyUs;
+    uint32_t _frames;
+    std::map<uint32_t, IDRecord> _records;
+};
+
+}  // namespace comms
+
+#endif  // __CAN_BUS_SIM_H__
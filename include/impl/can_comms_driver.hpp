@@ -5,15 +5,11 @@
 
 #include <cstring>
 #include "debug.hpp"
+#include "can_timing.hpp"
 #include "comms_driver.hpp"
 
 namespace comms {
 
-static FlexCAN_T4<CAN1, RX_SIZE_1024, TX_SIZE_16> _can1;
-static FlexCAN_T4<CAN2, RX_SIZE_1024, TX_SIZE_16> _can2;
-
-enum CANBaudRate { CBR_100KBPS, CBR_125KBPS, CBR_250KBPS, CBR_500KBPS, CBR_1MBPS };
-
 static void __sniff(const CAN_message_t& msg) {
     Serial.print("MB ");
     Serial.print(msg.mb);
@@ -35,98 +31,239 @@ static void __sniff(const CAN_message_t& msg) {
     Serial.println();
 }
 
+/// @brief Reads the fault confinement state of a FlexCAN module straight from its ESR1 register
+/// @param module The base address of the module, e.g. CAN1
+/// @note FlexCAN_T4's error() only pops snapshots queued by error interrupts, so it says nothing
+/// when no error happened since the last call, and bus-off may be reported late. The register
+/// always holds the current state
+inline BusState flexCANBusState(uint32_t module) {
+    constexpr uint32_t kESR1Offset = 0x20;
+    uint32_t esr1 = *reinterpret_cast<volatile uint32_t*>(module + kESR1Offset);
+
+    // ESR1[FLTCONF]: 00 error active, 01 error passive, 1x bus off
+    uint32_t faultConfinement = (esr1 >> 4) & 0x3;
+    if (faultConfinement == 0) return BS_ERROR_ACTIVE;
+    if (faultConfinement == 1) return BS_ERROR_PASSIVE;
+    return BS_BUS_OFF;
+}
+
+/// @brief Maps a Teensy CAN bus number to its FlexCAN_T4 controller, resolved at compile time
+/// @note The controllers are function-local statics, so every translation unit shares one instance
+template <uint8_t busNum>
+struct TeensyCANBus;
+
+template <>
+struct TeensyCANBus<1> {
+    using Controller = FlexCAN_T4<CAN1, RX_SIZE_1024, TX_SIZE_16>;
+    static constexpr uint32_t kModule = CAN1;
+    static Controller& controller() {
+        static Controller can;
+        return can;
+    }
+};
+
+template <>
+struct TeensyCANBus<2> {
+    using Controller = FlexCAN_T4<CAN2, RX_SIZE_1024, TX_SIZE_16>;
+    static constexpr uint32_t kModule = CAN2;
+    static Controller& controller() {
+        static Controller can;
+        return can;
+    }
+};
+
+template <>
+struct TeensyCANBus<3> {
+    using Controller = FlexCAN_T4<CAN3, RX_SIZE_1024, TX_SIZE_16>;
+    static constexpr uint32_t kModule = CAN3;
+    static Controller& controller() {
+        static Controller can;
+        return can;
+    }
+};
+
+/// @brief The FlexCAN_T4FD controller for CAN3, the only FD capable bus on the Teensy 4.1
+struct TeensyCANFDBus {
+    using Controller = FlexCAN_T4FD<CAN3, RX_SIZE_256, TX_SIZE_16>;
+    static constexpr uint32_t kModule = CAN3;
+    static Controller& controller() {
+        static Controller can;
+        return can;
+    }
+};
+
 template <uint8_t busNum, CANBaudRate baudRate>
-class TeensyCANDriver : public CommsDriver {
+class TeensyCANDriver final : public CommsDriver {
    public:
+    static_assert(busNum >= 1 && busNum <= 3, "The Teensy 4.1 only has CAN1, CAN2 and CAN3");
+
     void install() {
         Serial.println("Installing TeensyCANDriver!");
-        _busNum = busNum;
-        uint32_t baudRateNum = 0;
-        switch (baudRate) {
-            case CBR_100KBPS:
-                baudRateNum = 100000;
-                break;
-            case CBR_125KBPS:
-                baudRateNum = 125000;
-                break;
-            case CBR_250KBPS:
-                baudRateNum = 250000;
-                break;
-            case CBR_500KBPS:
-                baudRateNum = 500000;
-                break;
-            case CBR_1MBPS:
-                baudRateNum = 1000000;
-                break;
-        }
+        uint32_t baudRateNum = canBaudRateBps(baudRate);
 
-        switch (_busNum) {
-            case 1:
-                _can1.begin();
-                _can1.setBaudRate(baudRateNum);
-                _can1.enableFIFO();
-                _can1.setFIFOFilter(0, 0x000, 0x000, STD);
-                _can1.onReceive(__sniff);
-                break;
-            case 2:
-                _can2.begin();
-                _can2.setBaudRate(baudRateNum);
-                _can2.enableFIFO();
-                _can2.setFIFOFilter(0, 0x000, 0x000, STD);
-                _can2.onReceive(__sniff);
-                break;
-        }
+        auto& can = TeensyCANBus<busNum>::controller();
+        can.begin();
+        can.setBaudRate(baudRateNum);
+        can.enableFIFO();
+        can.setFIFOFilter(0, 0x000, 0x000, STD);
+        can.onReceive(__sniff);
 
         Serial.println("Installing TeensyCANDriver!");
     }
 
     void uninstall() {}
 
-    void sendMessage(const RawCommsMessage& message) {
+    void sendMessage(const RawCommsMessage& message) { write(message); }
+
+    bool receiveMessage(RawCommsMessage* message) { return read(message); }
+
+    /// @return The number of frames the transmit ring took, the batch stops at the first frame
+    /// it has no room for so the rest don't go out of order
+    size_t sendMessages(const RawCommsMessage* messages, size_t count) {
+        size_t sent = 0;
+        while (sent < count && write(messages[sent])) {
+            sent++;
+        }
+        return sent;
+    }
+
+    size_t receiveMessages(RawCommsMessage* messages, size_t capacity) {
+        size_t count = 0;
+        while (count < capacity && read(&messages[count])) {
+            count++;
+        }
+        return count;
+    }
+
+    BusState busState() { return flexCANBusState(TeensyCANBus<busNum>::kModule); }
+
+   private:
+    /// @brief Writes one frame, inlined into the batch loops instead of a virtual call per frame
+    /// @return True if the frame was sent or queued, false if the transmit ring was full
+    static bool write(const RawCommsMessage& message) {
         CAN_message_t msg;
-        msg.id = message.id;
+        msg.id = message.id & kExtendedIDMask;
+        msg.flags.extended = isExtendedID(message.id);
         msg.len = message.length;
 
         COMMS_DEBUG_PRINT("Sending message with id 0x%04x\n", message.id);
-        memcpy(msg.buf, &message.payload, 8);
-
-        switch (_busNum) {
-            case 1:
-                _can1.write(msg);
-                break;
-            case 2:
-                _can2.write(msg);
-                break;
-        }
-    }
+        memcpy(msg.buf, message.payloadBytes, message.length > 8 ? 8 : message.length);
 
-    bool receiveMessage(RawCommsMessage* message) {
-        // COMMS_DEBUG_PRINTLN("Listening...");
+        return TeensyCANBus<busNum>::controller().write(msg) > 0;
+    }
 
+    /// @brief Reads one frame, inlined into the batch loops instead of a virtual call per frame
+    static bool read(RawCommsMessage* message) {
         CAN_message_t res;
-        int found = 0;
-        switch (_busNum) {
-            case 1:
-                found = _can1.read(res);
-                break;
-            case 2:
-                found = _can2.read(res);
-                break;
-        }
+        int found = TeensyCANBus<busNum>::controller().read(res);
 
         if (found == 0) return false;
 
-        message->id = res.id;
-        memcpy(&message->payload, res.buf, 8);
+        message->id = res.flags.extended ? res.id | kExtendedIDFlag : res.id;
+        message->length = res.len > 8 ? 8 : res.len;
+        message->payload = 0;
+        memcpy(message->payloadBytes, res.buf, message->length);
 
         COMMS_DEBUG_PRINT("Recieved message with id 0x%04x\n", message->id);
 
         return true;
     }
+};
+
+/// @brief A CAN FD driver for CAN3 on the Teensy 4.1, with bit-rate switching
+/// @note Every node on the bus must speak CAN FD, classic messages go out as short FD frames
+template <CANBaudRate nominalRate, CANFDDataRate dataRate>
+class TeensyCANFDDriver final : public CommsDriver {
+   public:
+    void install() {
+        Serial.println("Installing TeensyCANFDDriver!");
+
+        CANFD_timings_t config;
+        config.clock = CLK_24MHz;
+        config.baudrate = canBaudRateBps(nominalRate);
+        config.baudrateFD = canFDDataRateBps(dataRate);
+        config.propdelay = 190;
+        config.bus_length = 1;
+        config.sample = 75;
+
+        auto& can = TeensyCANFDBus::controller();
+        can.begin();
+        can.setBaudRate(config);
+        can.setRegions(64);
+        can.setMBFilter(ACCEPT_ALL);
+    }
+
+    void uninstall() {}
+
+    void sendMessage(const RawCommsMessage& message) { write(message); }
+
+    /// @return The number of frames the transmit ring took, the batch stops at the first frame
+    /// it has no room for so the rest don't go out of order
+    size_t sendMessages(const RawCommsMessage* messages, size_t count) {
+        size_t sent = 0;
+        while (sent < count && write(messages[sent])) {
+            sent++;
+        }
+        return sent;
+    }
+
+    bool receiveMessage(RawCommsMessage* message) {
+        RawCommsFDMessage fd;
+        if (!receiveFDMessage(&fd)) return false;
+
+        message->id = fd.id;
+        message->length = fd.length > 8 ? 8 : fd.length;
+        message->payload = 0;
+        memcpy(message->payloadBytes, fd.payloadBytes, message->length);
+        return true;
+    }
+
+    bool supportsFD() const { return true; }
+
+    uint8_t maxPayloadLength() const { return RawCommsFDMessage::kMaxLength; }
+
+    bool sendFDMessage(const RawCommsFDMessage& message) {
+        if (message.length > RawCommsFDMessage::kMaxLength) return false;
+
+        CANFD_message_t msg;
+        msg.id = message.id & kExtendedIDMask;
+        msg.extended = isExtendedID(message.id);
+        msg.brs = message.bitRateSwitch;
+        msg.len = canFDPaddedLength(message.length);
+        memset(msg.buf, 0, sizeof(msg.buf));
+        memcpy(msg.buf, message.payloadBytes, message.length);
+
+        COMMS_DEBUG_PRINT("Sending FD message with id 0x%04x\n", message.id);
+        return TeensyCANFDBus::controller().write(msg) > 0;
+    }
+
+    bool receiveFDMessage(RawCommsFDMessage* message) {
+        CANFD_message_t res;
+        if (TeensyCANFDBus::controller().read(res) == 0) return false;
+
+        message->id = res.extended ? res.id | kExtendedIDFlag : res.id;
+        message->length = res.len > RawCommsFDMessage::kMaxLength ? RawCommsFDMessage::kMaxLength
+                                                                  : res.len;
+        message->bitRateSwitch = res.brs;
+        memcpy(message->payloadBytes, res.buf, message->length);
+
+        COMMS_DEBUG_PRINT("Recieved FD message with id 0x%04x\n", message->id);
+        return true;
+    }
+
+    BusState busState() { return flexCANBusState(TeensyCANFDBus::kModule); }
 
    private:
-    uint8_t _busNum;
-    CANBaudRate _baudRate;
+    /// @brief Writes one classic frame as a short FD frame
+    /// @return True if the frame was sent or queued, false if the transmit ring was full
+    bool write(const RawCommsMessage& message) {
+        RawCommsFDMessage fd;
+        fd.id = message.id;
+        fd.length = message.length > 8 ? 8 : message.length;
+        fd.bitRateSwitch = true;
+        memcpy(fd.payloadBytes, message.payloadBytes, fd.length);
+        return sendFDMessage(fd);
+    }
 };
 
 }  // namespace comms
@@ -0,0 +1,71 @@
+#ifndef __CAN_TIMING_H__
+#define __CAN_TIMING_H__
+
+#include <stdint.h>
+
+namespace comms {
+
+enum CANBaudRate { CBR_100KBPS, CBR_125KBPS, CBR_250KBPS, CBR_500KBPS, CBR_1MBPS };
+
+/// @brief Gets the bit rate of a CANBaudRate in bits per second
+/// @param baudRate The baud rate to convert
+/// @return The bit rate in bits per second
+inline uint32_t canBaudRateBps(CANBaudRate baudRate) {
+    switch (baudRate) {
+        case CBR_100KBPS:
+            return 100000;
+        case CBR_125KBPS:
+            return 125000;
+        case CBR_250KBPS:
+            return 250000;
+        case CBR_500KBPS:
+            return 500000;
+        case CBR_1MBPS:
+            return 1000000;
+    }
+    return 0;
+}
+
+/// @brief The data phase bit rates supported for CAN FD bit-rate switching
+enum CANFDDataRate { CFDR_2MBPS, CFDR_4MBPS, CFDR_5MBPS, CFDR_8MBPS };
+
+/// @brief Gets the bit rate of a CANFDDataRate in bits per second
+/// @param dataRate The data rate to convert
+/// @return The bit rate in bits per second
+inline uint32_t canFDDataRateBps(CANFDDataRate dataRate) {
+    switch (dataRate) {
+        case CFDR_2MBPS:
+            return 2000000;
+        case CFDR_4MBPS:
+            return 4000000;
+        case CFDR_5MBPS:
+            return 5000000;
+        case CFDR_8MBPS:
+            return 8000000;
+    }
+    return 0;
+}
+
+/// @brief Rounds a payload length up to the next length a CAN FD frame can carry
+/// @param length The number of data bytes, 0 to 64
+/// @return 0 to 8, 12, 16, 20, 24, 32, 48 or 64
+inline uint8_t canFDPaddedLength(uint8_t length) {
+    if (length <= 8) return length;
+    if (length <= 24) return (length + 3) & ~3;
+    if (length <= 32) return 32;
+    if (length <= 48) return 48;
+    return 64;
+}
+
+/// @brief Computes the number of bits a classic CAN data frame occupies on the wire
+/// @param id The identifier of the frame
+/// @param extended True for a 29-bit identifier, false for an 11-bit one
+/// @param length The number of data bytes, 0 to 8
+/// @param data The data bytes
+/// @return The frame length in bits, from SOF up to and including the 3-bit interframe space
+/// @note Stuff bits are counted exactly, by building the frame and its CRC
+uint32_t canFrameBits(uint32_t id, bool extended, uint8_t length, const uint8_t* data);
+
+}  // namespace comms
+
+#endif  // __CAN_TIMING_H__
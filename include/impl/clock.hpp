@@ -0,0 +1,46 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+
+namespace comms {
+
+/// @brief A source of time for the library
+/// @note Implemented by anything that wants to drive the library off a clock other than the
+/// platform's, like a simulated bus
+class ClockSource {
+   public:
+    /// @brief Gets the current time in milliseconds
+    virtual uint32_t millis() = 0;
+
+    /// @brief Gets the current time in microseconds
+    virtual uint32_t micros() = 0;
+
+    virtual ~ClockSource() = default;
+};
+
+/// @brief The clock every part of the library reads time from
+/// @note Defaults to millis()/micros() on Arduino, and std::chrono::steady_clock elsewhere
+class Clock {
+   public:
+    /// @brief Gets the current time in milliseconds
+    static uint32_t millis();
+
+    /// @brief Gets the current time in microseconds
+    static uint32_t micros();
+
+    /// @brief Busy-waits for the given number of microseconds
+    /// @note Does nothing while a custom source is installed, its owner decides how time moves
+    static void delayMicros(uint32_t us);
+
+    /// @brief Replaces the platform clock with a custom source
+    /// @param source The source to read time from, or nullptr to go back to the platform clock
+    static void setSource(ClockSource* source);
+
+   private:
+    static ClockSource* _source;
+};
+
+}  // namespace comms
+
+#endif  // __CLOCK_H__
@@ -13,27 +13,53 @@
 
 #include <stdint.h>
 
+#include <array>
+#include <atomic>
 #include <cstring>
 #include <functional>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "command.hpp"
-#include "comms_driver.hpp"
+#include "command_ticket.hpp"
+#include "exec_status.hpp"
+#include "fd_batch.hpp"
+#include "heartbeat.hpp"
 #include "id.hpp"
+#include "outbox.hpp"
 #include "result.hpp"
 
 namespace comms {
 
+class MotionCommand;
+
 /// @brief The type of command being sent
+/// @note The values go on the wire, new types are appended with the next free value, which must
+/// fit in kTypeMask
 enum CommandType : uint8_t {
     // General Commands, for any MCU
-    CMD_BEGIN,  // begin the operation of the device
-    CMD_STOP,   // end the operation of the device
-    CMD_MOTOR_CONTROL,     // Motor-Driver Specific Commands
-    CMD_INVALID,
+    CMD_BEGIN = 0,  // begin the operation of the device
+    CMD_STOP = 1,   // end the operation of the device
+    CMD_MOTOR_CONTROL = 2,  // Motor-Driver Specific Commands
+    CMD_INVALID = 3,
+    CMD_MOTION = 4,      // setpoints for several motors at once, see motion.hpp
+    CMD_CLEAR_BANK = 5,  // drop the commands loaded into a bank that isn't running
     CMD_COUNT
 };
 
+/// @brief The number of command banks a low level node buffers commands in
+/// @note One bank runs while the next motion is loaded into another
+constexpr uint8_t kNumCommandBanks = 4;
+
+/// @brief How hard the command manager tries to deliver a command
+enum QoSPolicy : uint8_t {
+    QOS_RELIABLE,      // acknowledged, and retransmitted until it is
+    QOS_BEST_EFFORT,   // sent once, the receiver doesn't acknowledge it
+    QOS_LATEST_VALUE,  // acknowledged, but a newer command of the same stream replaces it, so only
+                       // the newest value is retransmitted
+};
+
 /// @brief Exact same memory footprint as the RawCommsMessage Payload (uint64_t)
 /// Used to get a bit of type safety and nice accessors, rather than deal with a bunch of
 struct CommandMessagePayload {
@@ -49,6 +75,31 @@ struct CommandMessagePayload {
         };
     };
 
+    /// @brief Set in the type byte of a command the receiver must not acknowledge
+    static constexpr uint8_t kNoAckFlag = 0x80;
+
+    /// @brief Set in the type byte of an acknowledgement to refuse the command instead
+    static constexpr uint8_t kNackFlag = 0x40;
+
+    /// @brief The bits of the type byte that pick the bank a command is loaded into, or started
+    static constexpr uint8_t kBankMask = 0x30;
+    static constexpr uint8_t kBankShift = 4;
+
+    /// @brief The bits of the type byte that hold the CommandType itself
+    static constexpr uint8_t kTypeMask = 0x0F;
+
+    /// @brief Gets the type, without the flags and bank
+    CommandType commandType() const { return static_cast<CommandType>(type & kTypeMask); }
+
+    /// @brief Gets the bank the command is for, 0 unless CommandBuilder::inBank() picked one
+    uint8_t bank() const { return (type & kBankMask) >> kBankShift; }
+
+    /// @brief Identifies the stream a command belongs to: its type, target and first option byte
+    /// (the motor, for motor control). The bank isn't part of it
+    uint32_t streamKey() const {
+        return static_cast<uint32_t>(commandType()) << 16 | (payload & 0xFFFF);
+    }
+
     CommandMessagePayload()
         : type(CommandType::CMD_INVALID), mcuID(MCUID::MCU_PALM), commandID(0), payload(0) {}
     CommandMessagePayload(CommandType cType, MCUID mid, uint16_t cid, uint32_t data)
@@ -76,6 +127,9 @@ struct CommandMessagePayload {
     CommandMessagePayload(uint64_t raw) : raw(raw) {}
 };
 
+static_assert(CMD_COUNT <= CommandMessagePayload::kTypeMask + 1,
+              "Every CommandType must fit in the type bits of the type byte");
+
 enum MotorControlCommandType : uint8_t { MC_CMD_POS, MC_CMD_VEL };
 
 /// @brief Exact same memory footprint as the CommandMessagePayload::Payload, used for the "specific
@@ -98,6 +152,9 @@ struct MotorControlCommandOpt {
         : targetID(targetID), motorNumber(motorNumber), controlType(type), value(value) {}
 };
 
+/// @brief The payload of CMD_BEGIN
+/// @note A synchronized start carries the low 23 bits of the bus time to start at, which the
+/// receiver widens around its own bus time, so the start must be less than about 4s away
 struct BeginExecutionCommandOpt {
     union {
         uint32_t payload;
@@ -106,8 +163,32 @@ struct BeginExecutionCommandOpt {
         };
     };
 
+    static constexpr uint8_t kStartTimeShift = 8;
+    static constexpr uint32_t kStartTimeMask = 0x7FFFFF;
+    static constexpr uint32_t kSynchronized = 0x80000000;
+
     BeginExecutionCommandOpt() : payload(0) {}
-    BeginExecutionCommandOpt(MCUID targetID) : targetID(targetID) {}
+    BeginExecutionCommandOpt(MCUID targetID) : payload(targetID) {}
+    BeginExecutionCommandOpt(MCUID targetID, uint32_t startAtBusUs)
+        : payload(targetID | (startAtBusUs & kStartTimeMask) << kStartTimeShift | kSynchronized) {}
+
+    static BeginExecutionCommandOpt fromPayload(uint32_t payload) {
+        BeginExecutionCommandOpt opt;
+        opt.payload = payload;
+        return opt;
+    }
+
+    /// @brief True if the start carries a time, otherwise the target starts when it arrives
+    bool isSynchronized() const { return (payload & kSynchronized) != 0; }
+
+    /// @brief Gets the bus time to start at
+    /// @param nowBusUs The current bus time, the start time is taken to be the closest to it
+    uint32_t startAtBusUs(uint32_t nowBusUs) const {
+        uint32_t low = (payload >> kStartTimeShift) & kStartTimeMask;
+        // sign extend the 23-bit distance from now
+        int32_t deltaUs = static_cast<int32_t>((low - nowBusUs) << 9) >> 9;
+        return nowBusUs + deltaUs;
+    }
 };
 
 struct EndExecutionCommandOpt {
@@ -124,27 +205,72 @@ struct EndExecutionCommandOpt {
 
 class CommandBuilder {
    public:
-    static uint16_t __cmdCounter;
+    static std::atomic<uint16_t> __cmdCounter;  // commands may be built on any thread
 
     static CommandMessagePayload motorControl(MCUID sender, MotorControlCommandOpt motorCmd) {
         return CommandMessagePayload(CommandType::CMD_MOTOR_CONTROL, sender, __cmdCounter++,
                                      motorCmd.payload);
     }
 
+    static CommandMessagePayload beginExecution(MCUID sender, BeginExecutionCommandOpt beginCmd) {
+        return CommandMessagePayload(CommandType::CMD_BEGIN, sender, __cmdCounter++,
+                                     beginCmd.payload);
+    }
+
     static CommandMessagePayload endExecution(MCUID sender, BeginExecutionCommandOpt beginCmd) {
         return CommandMessagePayload(CommandType::CMD_BEGIN, sender, __cmdCounter++,
                                      beginCmd.payload);
     }
+
+    /// @brief Drops the commands loaded into a bank of a node, the bank mustn't be running
+    static CommandMessagePayload clearBank(MCUID sender, MCUID target, uint8_t bank) {
+        return inBank(CommandMessagePayload(CommandType::CMD_CLEAR_BANK, sender, __cmdCounter++,
+                                            target),
+                      bank);
+    }
+
+    /// @brief Loads a command into a bank, or for CMD_BEGIN starts that bank
+    /// @param bank The bank, below kNumCommandBanks, commands go to bank 0 unless given one
+    static CommandMessagePayload inBank(CommandMessagePayload command, uint8_t bank) {
+        uint8_t bankBits = static_cast<uint8_t>(bank << CommandMessagePayload::kBankShift);
+        command.type = static_cast<CommandType>((command.type & ~CommandMessagePayload::kBankMask) |
+                                                (bankBits & CommandMessagePayload::kBankMask));
+        return command;
+    }
+};
+
+/// @brief How far a handler has got with a command
+struct CommandProgress {
+    bool done;
+    uint8_t failure;  // EF_NONE on success, or a code of the handler's own from 1 to 0xFE
+
+    static CommandProgress running() { return CommandProgress{false, EF_NONE}; }
+    static CommandProgress succeeded() { return CommandProgress{true, EF_NONE}; }
+    static CommandProgress failed(uint8_t code) { return CommandProgress{true, code}; }
 };
 
 /// @brief Handles specific commands, determines if events are parallizable, etc.
 /// Used to specify "when I recieve this type of command, what should happen?"
+/// @note start() is called for every command of a slice when the slice starts, then update() and
+/// progress() once per tick until progress() says the command is done, then end()
 class CommandHandler {
    public:
+    virtual ~CommandHandler() {}
     virtual void start(const CommandMessagePayload& payload) {}
     virtual void update(const CommandMessagePayload& payload) {}
     virtual void end(const CommandMessagePayload& payload) {}
-    virtual bool isParallelizable(const std::vector<CommandMessagePayload> slice);
+
+    /// @brief Reports if a command is done, by default it is after its first update()
+    virtual CommandProgress progress(const CommandMessagePayload& /*payload*/) {
+        return CommandProgress::succeeded();
+    }
+
+    /// @brief Checks if the commands of a slice can run at the same time
+    /// @param slice The commands so far, the last one is the command that would join them
+    /// @note By default each command runs on its own
+    virtual bool isParallelizable(const std::vector<CommandMessagePayload> slice) {
+        return slice.size() <= 1;
+    }
 };
 
 /// @brief A buffer that manages user commands.
@@ -152,9 +278,15 @@ class CommandHandler {
 class CommandBuffer {
    public:
     struct ExecutionStats {
-        uint32_t time;     ///< Execution time.
-        uint8_t executed;  ///< Number of executed commands.
-        bool success;      ///< Whether the execution
+        uint32_t time;           ///< Execution time in ms.
+        uint8_t executed;        ///< Number of executed commands, saturated.
+        bool success;            ///< Whether the execution
+        uint8_t failure;         ///< The first failure, an ExecutionFailure or a handler code.
+        uint16_t lastCommandID;  ///< The ID of the last command executed.
+        size_t remaining;        ///< Commands still buffered, always 0 once execution is complete.
+        bool finished;           ///< Whether execution is complete, for a slice's stats.
+        uint8_t bank;            ///< The bank the commands ran from.
+        bool bankDone;           ///< Whether the slice emptied its bank.
     };
 
     /// @brief Constructor.
@@ -162,24 +294,47 @@ class CommandBuffer {
 
     /// @brief Adds a command to the buffer.
     /// @param command Shared pointer to a UserCommand.
-    void addCommand(CommandMessagePayload command);
+    /// @param bank The bank to load it into, it may be the running bank.
+    void addCommand(CommandMessagePayload command, uint8_t bank = 0);
 
     /// @brief Clears the command buffer.
     void clear();
 
+    /// @brief Drops the commands loaded into a bank, and a start queued for it.
+    /// @return False if the bank is running, it can't be cleared under its handlers.
+    bool clearBank(uint8_t bank);
+
     /// @brief Resets all commands in the buffer.
     void reset();
 
     /// @brief Continues executing the current slice of commands.
+    /// @note A finished slice is removed from its bank, and the next starts in the same tick. When
+    /// the running bank is empty the next started bank takes over, again in the same tick.
+    /// Execution completes when no started bank has commands left, or at the first slice that
+    /// fails, which clears the rest of its bank since it was planned assuming the slice would
+    /// succeed, and drops the banks started after it
     void tick();
 
     /// @brief Executes the current slice of commands.
-    void startExecution();
+    /// @param bank The bank to run. If another bank is running, this one runs once it is empty
+    void startExecution(uint8_t bank = 0);
+
+    /// @brief Starts executing once the clock reaches a time
+    /// @param localTimeUs The Clock::micros() to start at, a time that has passed starts now
+    /// @param bank The bank to run, see startExecution
+    /// @note Each bank has its own scheduled start, so one bank can be scheduled while another
+    /// waits for its time. Scheduling a bank again moves its start
+    void startExecutionAt(uint32_t localTimeUs, uint8_t bank = 0);
 
     /// @brief Registers a callback to be called when execution is complete.
     /// @param callback The callback to register.
     void onExecutionComplete(std::function<void(ExecutionStats)> callback);
 
+    /// @brief Registers a callback to be called when each slice is complete.
+    /// @note A start with nothing buffered reports an empty slice, so a start always reports one.
+    /// @param callback The callback to register.
+    void onSliceComplete(std::function<void(ExecutionStats)> callback);
+
     void setHandler(CommandType type, std::shared_ptr<CommandHandler> handler);
 
    private:
@@ -217,64 +372,202 @@ class CommandBuffer {
         std::size_t _end;    ///< Ending index.
     };
 
-    std::vector<CommandMessagePayload> _commands;  ///< All commands.
+    std::array<std::vector<CommandMessagePayload>, kNumCommandBanks>
+        _banks;                                    ///< The commands loaded into each bank.
+    uint8_t _activeBank;                           ///< The bank being executed.
+    std::vector<uint8_t> _queuedBanks;             ///< Banks started while another was running.
     CommandSlice _currentSlice;                    ///< The current command slice.
     size_t _numCompletedCommands;                  ///< Number of completed commands.
     bool _isExecuting;                             ///< Whether the buffer is executing commands.
     uint32_t _startTime;                           ///< Time when execution
     bool _isCalibrating;                           ///< Whether the buffer is calibrating.
+    std::array<bool, kNumCommandBanks> _isStartScheduled;  ///< Banks startExecutionAt() waits on.
+    std::array<uint32_t, kNumCommandBanks> _scheduledStartUs;  ///< When each bank's start is due.
+    uint32_t _sliceStartUs;                        ///< When the current slice started.
+    uint8_t _sliceFailure;                         ///< The first failure in the current slice.
+    std::vector<bool> _finished;                   ///< Which commands of the slice are done.
+    size_t _numExecutedCommands;                   ///< Commands executed since the start.
+    uint16_t _lastCommandID;                       ///< The last command executed.
 
     std::vector<std::function<void(ExecutionStats)>>
         _onExecutionCompleteCallbacks;  ///< Callbacks to call when execution is complete.
+    std::vector<std::function<void(ExecutionStats)>>
+        _onSliceCompleteCallbacks;  ///< Callbacks to call when a slice is complete.
     std::array<std::shared_ptr<CommandHandler>, CommandType::CMD_COUNT> _handlers;
 
     /// @brief Finds the next slice of commands to execute.
     /// @param currentSlice The current command slice.
     /// @return The next CommandSlice.
     CommandSlice findNextSlice(const CommandSlice& currentSlice);
+
+    /// @brief Finds and starts the next slice, moving on to the next started bank if the running
+    /// one is empty.
+    /// @return False if no started bank has commands left.
+    bool advanceSlice();
+
+    /// @brief Starts every command of the current slice.
+    void startSlice();
+
+    /// @brief Removes the finished slice and reports it.
+    void completeSlice();
+
+    /// @brief Stops executing and reports it.
+    void completeExecution(bool success, uint8_t failure);
+
+    /// @brief Calls the slice callbacks.
+    void reportSlice(const ExecutionStats& stats);
 };
 
 
 /// @brief Information about a command that has been sent but not yet acknowledged.
 struct CommandAcknowledgementInfo {
     RawCommsMessage message;
+    MCUID target;
+    uint32_t streamKey;
     uint32_t lastSent;
     uint8_t numRetries;
+    CommandCompletionRef completion;  // the ticket resolved when the command is answered
 };
 
 /// @brief Manages sending and receiving commands between MCUs.
 class CommandManager {
    public:
     /// @brief Constructs a CommandManager with the given driver and ID
-    /// @param driver The communication driver to use for sending messages
+    /// @param driver The outbox to send messages through, the controller flushes it to the bus
     /// @param me The ID of this MCU
-    CommandManager(CommsDriver* driver, MCUID me);
+    CommandManager(MessageOutbox* driver, MCUID me);
+
+    /// @brief How long an unacknowledged command waits before it is sent again
+    static constexpr uint32_t kRetransmitIntervalMs = 1000;
+
+    /// @brief How many times an unacknowledged command is sent again before it is given up on
+    static constexpr uint8_t kMaxRetransmissions = 4;
+
+    /// @brief How long after it is sent an unacknowledged command is given up on
+    static constexpr uint32_t kAckTimeoutMs =
+        (kMaxRetransmissions + 1) * kRetransmitIntervalMs;
 
     /// @brief Sends a command to the specified MCU
     /// @param payload The command payload to send
-    void sendCommand(CommandMessagePayload payload);
+    /// @return A ticket that resolves when the target acknowledges or refuses the command, or it
+    /// is given up on, kAckTimeoutMs after it was sent. Best-effort commands and starts, which are
+    /// sent later by beginExecution(), get CS_UNTRACKED tickets
+    /// @note A CMD_BEGIN for MCU_LOW_LEVEL_ANY starts the low level nodes that have answered a
+    /// command, or still have commands waiting for an answer, so an absent node doesn't hold it up
+    CommandTicket sendCommand(CommandMessagePayload payload);
+
+    /// @brief Sends a motion command, its frames are batched together on CAN FD
+    /// @note Motion isn't acknowledged or retransmitted, a newer command replaces a lost one. With
+    /// QOS_LATEST_VALUE, a command not yet flushed is replaced by a newer one for the same MCU
+    /// @param motion The setpoints to send
+    void sendMotion(const MotionCommand& motion);
+
+    /// @brief Sets how commands of a type are delivered
+    /// @note Everything defaults to QOS_RELIABLE, except CMD_MOTION which is QOS_BEST_EFFORT and
+    /// can't be reliable. Starts sent by beginExecution() are always reliable
+    void setQoS(CommandType type, QoSPolicy policy);
+
+    /// @brief Sets how one stream of commands is delivered, overriding the policy of its type
+    /// @param type The type of the commands
+    /// @param target The MCU they are sent to
+    /// @param motor The motor they are for, ignored for CMD_MOTION
+    void setQoS(CommandType type, MCUID target, uint8_t motor, QoSPolicy policy);
+
+    /// @brief How far ahead a synchronized start is scheduled by default
+    /// @note It must cover the time the start takes to reach every node, a few ticks of theirs
+    static constexpr uint32_t kDefaultStartLeadUs = 10000;
+
+    /// @brief How late a synchronized start may arrive and still run
+    /// @note A later one, e.g. a retransmission, would leave the node out of step with its group,
+    /// so the node refuses it and the high level has to start the group again
+    static constexpr uint32_t kStartGraceUs = 2000;
+
+    /// @brief Starts execution on a group of nodes at the same moment
+    /// @note Waits until every command sent to a node of the group is acknowledged, then sends
+    /// each of them a start for the same bus time, leadTimeUs from then. Nodes outside the group
+    /// don't hold it up. If a command to the group is given up on, the start is cancelled
+    /// @param group The nodes to start
+    /// @param leadTimeUs How far ahead to schedule the start, 0 starts each node on arrival
+    /// @param bank The bank each node runs, if another is running it takes over once that is empty
+    void beginExecution(const std::vector<MCUID>& group,
+                        uint32_t leadTimeUs = kDefaultStartLeadUs, uint8_t bank = 0);
+
+    /// @brief Checks if a node has acknowledged every command sent to it
+    bool isNodeReady(MCUID node) const;
+
+    /// @brief Sets the handler that executes the buffered commands of a type, on the low level
+    void setCommandHandler(CommandType type, std::shared_ptr<CommandHandler> handler);
 
     /// @brief Handles a command message received from the communication driver
     /// @note This will parse the command message and call the appropriate command handler
     /// @param info The information about the received message
     /// @param message The raw command message
-    void handleCommandMessage(MessageInfo info, RawCommsMessage message);
+    /// @param timeSync Converts the bus time of synchronized starts to this MCU's clock
+    void handleCommandMessage(MessageInfo info, RawCommsMessage message,
+                              const BusTimeSync& timeSync);
 
     /// @brief Ticks the command manager, checking for timeouts and retransmissions
-    /// @note This should be called periodically to ensure commands are sent and acknowledged
+    /// @note This should be called periodically to ensure commands are sent and acknowledged. The
+    /// completions of the tickets resolved since the last tick run at its end
     void tick();
 
+    /// @brief Sends the commands and acknowledgements batched since the last flush
+    /// @note Only CAN FD drivers batch, on classic drivers every frame is sent right away
+    void flush();
+
    private:
+    /// @brief A start waiting for its group to be ready
+    struct PendingStart {
+        uint8_t groupMask;  // bit n is the node with MCUID n
+        uint32_t leadTimeUs;
+        uint8_t bank;
+    };
+
+    /// @brief A command that waits for the next flush, and is replaced by newer ones of its stream
+    struct LatestValueFrame {
+        uint32_t streamKey;
+        RawCommsMessage message;
+    };
+
+    /// @brief Gets the policy of a stream
+    QoSPolicy qosOf(uint32_t streamKey) const;
+
+    /// @brief Queues a frame for the next flush, replacing the queued frames of its stream
+    void queueLatest(uint32_t streamKey, const RawCommsMessage& message, bool replace);
+
+    /// @brief Sends a command, and unless it is best-effort tracks it until it is acknowledged
+    CommandTicket sendWithPolicy(CommandMessagePayload payload, QoSPolicy policy);
+
+    /// @brief Sends the starts whose groups are all ready
+    void dispatchStarts();
+
+    /// @brief Sends a command or acknowledgement, batching it when the driver supports CAN FD
+    void sendFrame(const RawCommsMessage& message);
+
+    /// @brief Tells the high level a slice of the command buffer is complete
+    void sendExecutionStatus(const CommandBuffer::ExecutionStats& stats);
+
     std::unordered_map<uint16_t, CommandAcknowledgementInfo> _unackedCommands;
     std::vector<uint16_t> _toRemoveUnackedCommands;
 
-    bool _startCommandEnqueued = false;
-    RawCommsMessage _startCommandMessage;
+    std::vector<PendingStart> _pendingStarts;
+
+    std::array<QoSPolicy, CommandType::CMD_COUNT> _typeQoS;
+    std::unordered_map<uint32_t, QoSPolicy> _streamQoS;
+    std::vector<LatestValueFrame> _latestValueFrames;
 
-    CommsDriver* _driver;
+    CommandCompletionPool _completions;
+
+    MessageOutbox* _driver;
     MCUID _me;
 
+    uint8_t _motionSequence = 0;
+
+    /// @brief Bit n is set once the node with MCUID n has acknowledged or refused a command
+    uint8_t _answeredNodes = 0;
+
     CommandBuffer _cmdBuf;
+    FDRecordBatch _batch;
 };
 
 }  // namespace comms
@@ -0,0 +1,181 @@
+#ifndef __COMMAND_TICKET_H__
+#define __COMMAND_TICKET_H__
+
+/**========================================================================
+ *                             command_ticket.hpp
+ *
+ *  Tracks what became of a command after CommandManager::sendCommand().
+ *  Every reliable command gets a ticket from a fixed pool, which resolves
+ *  when the target acknowledges or refuses it, or it is given up on.
+ *  Completions run from CommandManager::tick(), never from inside a
+ *  receive, so a callback or coroutine may send further commands.
+ *
+ *========================================================================**/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <functional>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define COMMS_HAS_COROUTINES 1
+#endif
+#endif
+
+namespace comms {
+
+/// @brief What became of a command
+enum CommandStatus : uint8_t {
+    CS_PENDING,     // sent, the target hasn't answered yet
+    CS_ACKED,       // the target acknowledged it
+    CS_NACKED,      // the target received it but refused it, e.g. it can't handle the type
+    CS_TIMED_OUT,   // unanswered for CommandManager::kAckTimeoutMs, through every retransmission
+    CS_SUPERSEDED,  // a newer command of its QOS_LATEST_VALUE stream replaced it before an answer
+    CS_UNTRACKED,   // sent, but nothing will say if it arrived: best-effort, or no ticket was free
+    CS_NOT_SENT,    // never sent, e.g. this MCU isn't the high level
+};
+
+class CommandCompletionPool;
+
+/// @brief Refers to the ticket of a command from the command manager's side
+/// @note Holds no reference, so a ticket nobody holds anymore is freed while its command is still
+/// unacknowledged, and resolving the stale reference does nothing
+struct CommandCompletionRef {
+    static constexpr uint8_t kNone = 0xFF;
+
+    uint8_t slot;
+    uint16_t generation;
+
+    CommandCompletionRef() : slot(kNone), generation(0) {}
+    CommandCompletionRef(uint8_t slot, uint16_t generation)
+        : slot(slot), generation(generation) {}
+};
+
+/// @brief A handle to the outcome of a command, returned by CommandManager::sendCommand()
+/// @note Copies share a ticket of the pool, which is freed once no copy and no callback is left.
+/// Only use tickets on the thread that ticks the controller
+class CommandTicket {
+   public:
+    /// @brief A ticket that is already resolved, not backed by the pool
+    explicit CommandTicket(CommandStatus status = CS_UNTRACKED);
+    CommandTicket(const CommandTicket& other);
+    CommandTicket& operator=(const CommandTicket& other);
+    ~CommandTicket();
+
+    /// @brief Gets the outcome, CS_PENDING until the command is answered or given up on
+    CommandStatus status() const;
+
+    /// @brief True once the outcome is known
+    bool isDone() const { return status() != CS_PENDING; }
+
+    /// @brief Calls a function with the outcome, from the tick the command manager learns it on
+    /// @note A ticket has one callback, a second replaces the first. A ticket that is already done
+    /// calls it right away. The ticket stays in the pool until it is called, so the handle may be
+    /// dropped, e.g. sendCommand(cmd).onComplete(...)
+    void onComplete(std::function<void(CommandStatus)> callback);
+
+#ifdef COMMS_HAS_COROUTINES
+    /// @brief Suspends a coroutine until the outcome is known, co_await gives the CommandStatus
+    /// @note The coroutine is resumed from CommandManager::tick(). Send every command of a step
+    /// before awaiting the first, so they are acknowledged in parallel
+    auto operator co_await() const {
+        struct Awaiter {
+            CommandTicket ticket;
+
+            bool await_ready() const { return ticket.isDone(); }
+            void await_suspend(std::coroutine_handle<> waiter) {
+                ticket.onComplete([waiter](CommandStatus) { waiter.resume(); });
+            }
+            CommandStatus await_resume() const { return ticket.status(); }
+        };
+        return Awaiter{*this};
+    }
+#endif
+
+   private:
+    friend class CommandCompletionPool;
+
+    CommandTicket(CommandCompletionPool* pool, uint8_t slot);
+
+    CommandCompletionPool* _pool;  // null if the ticket isn't backed by the pool
+    uint8_t _slot;
+    CommandStatus _status;  // the outcome of a ticket not backed by the pool
+};
+
+/// @brief The fixed pool of tickets of a CommandManager, nothing is allocated per command
+class CommandCompletionPool {
+   public:
+    /// @brief How many commands can be tracked at once, later ones get CS_UNTRACKED tickets
+    static constexpr size_t kCapacity = 32;
+
+    CommandCompletionPool();
+
+    CommandCompletionPool(const CommandCompletionPool&) = delete;
+    CommandCompletionPool& operator=(const CommandCompletionPool&) = delete;
+
+    /// @brief Takes a free ticket for a command that was just sent
+    /// @param ref Set to the reference the command manager resolves the ticket through
+    /// @return The ticket, or a CS_UNTRACKED one if the pool is used up
+    CommandTicket acquire(CommandCompletionRef* ref);
+
+    /// @brief Sets the outcome of a ticket, its completion runs on the next runCompletions()
+    /// @note Does nothing if the ticket was freed, or already resolved
+    void resolve(CommandCompletionRef ref, CommandStatus status);
+
+    /// @brief Calls the callbacks, and so resumes the coroutines, of the resolved tickets
+    void runCompletions();
+
+    /// @brief The number of tickets in use
+    size_t inUse() const;
+
+   private:
+    friend class CommandTicket;
+
+    struct Slot {
+        bool used;
+        bool completionDue;  // resolved, and its callback hasn't run yet
+        uint8_t refs;        // the CommandTickets sharing it
+        uint16_t generation;
+        CommandStatus status;
+        std::function<void(CommandStatus)> callback;
+    };
+
+    void addRef(uint8_t slot);
+    void release(uint8_t slot);
+
+    /// @brief Frees a slot that nobody can observe anymore
+    void freeIfUnused(uint8_t slot);
+
+    std::array<Slot, kCapacity> _slots;
+};
+
+#ifdef COMMS_HAS_COROUTINES
+/// @brief The return type of a coroutine that sequences commands, e.g.
+/// @code
+/// CommandSequence calibrate(CommsController& controller) {
+///     CommandTicket a = controller.sendCommand(...);
+///     CommandTicket b = controller.sendCommand(...);
+///     if (co_await a != CS_ACKED || co_await b != CS_ACKED) co_return;
+///     ...
+/// }
+/// @endcode
+/// @note It runs as soon as it is called, up to its first co_await on a pending ticket, and then
+/// on the ticks that resolve its tickets. Nobody awaits it, its frame is freed when it returns
+struct CommandSequence {
+    struct promise_type {
+        CommandSequence get_return_object() { return CommandSequence(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+#endif
+
+}  // namespace comms
+
+#endif  // __COMMAND_TICKET_H__
@@ -1,15 +1,27 @@
 #ifndef __COMMS_DRIVER_H__
 #define __COMMS_DRIVER_H__
 
+#include <cstring>
 #include <functional>
 
 #include "stdint.h"
 
 namespace comms {
 
+/// @brief Set in a message ID to send it as a 29-bit extended frame, the same bit SocketCAN uses
+/// @note Drivers set it on every extended frame they receive
+constexpr uint32_t kExtendedIDFlag = 0x80000000;
+
+/// @brief The identifier bits of an extended frame
+constexpr uint32_t kExtendedIDMask = 0x1FFFFFFF;
+
+/// @brief Checks if a message ID goes on the bus as an extended frame
+/// @note IDs that don't fit in 11 bits are always sent as extended frames
+inline bool isExtendedID(uint32_t id) { return (id & kExtendedIDFlag) != 0 || id > 0x7FF; }
+
 /// @brief The structure of a raw communication message, mostly with CAN in mind
 struct RawCommsMessage {
-    uint32_t id;
+    uint32_t id;  // kExtendedIDFlag is set for extended frames
     uint8_t length;
     union {
         uint64_t payload;
@@ -17,6 +29,24 @@ struct RawCommsMessage {
     };
 };
 
+/// @brief A message with a CAN FD sized payload
+struct RawCommsFDMessage {
+    /// @brief The largest CAN FD payload
+    static constexpr uint8_t kMaxLength = 64;
+
+    uint32_t id;         // kExtendedIDFlag is set for extended frames
+    uint8_t length;      // 0 to 64, drivers pad it up to a valid CAN FD length
+    bool bitRateSwitch;  // send the data phase at the fast bit rate
+    uint8_t payloadBytes[kMaxLength];
+};
+
+/// @brief The fault confinement state of a bus, as seen by a driver
+enum BusState : uint8_t {
+    BS_ERROR_ACTIVE,   // healthy
+    BS_ERROR_PASSIVE,  // error counters are high, but frames still go out
+    BS_BUS_OFF,        // the controller has disconnected itself from the bus
+};
+
 /// @brief HAL for Sending/Recieving these Comms messages
 class CommsDriver {
    public:
@@ -38,6 +68,71 @@ class CommsDriver {
     /// @return True if a message was received, false if no message was available
     virtual bool receiveMessage(RawCommsMessage* res) = 0;
 
+    /// @brief Sends a batch of messages
+    /// @param messages The messages to send, in order
+    /// @param count The number of messages
+    /// @return The number of messages handed to the bus
+    /// @note Drivers that can move several frames at once override this, the default sends them one
+    /// at a time
+    virtual size_t sendMessages(const RawCommsMessage* messages, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            sendMessage(messages[i]);
+        }
+        return count;
+    }
+
+    /// @brief Receives up to a batch of messages
+    /// @param messages Where to put the received messages
+    /// @param capacity The most messages to receive
+    /// @return The number of messages received
+    virtual size_t receiveMessages(RawCommsMessage* messages, size_t capacity) {
+        size_t count = 0;
+        while (count < capacity && receiveMessage(&messages[count])) {
+            count++;
+        }
+        return count;
+    }
+
+    /// @brief Checks if the driver can send and receive payloads longer than 8 bytes
+    virtual bool supportsFD() const { return false; }
+
+    /// @brief Gets the longest payload the driver can carry in one frame
+    virtual uint8_t maxPayloadLength() const { return 8; }
+
+    /// @brief Sends a message with a CAN FD sized payload
+    /// @param message The message to send
+    /// @return False if the payload is longer than maxPayloadLength()
+    /// @note Classic drivers send payloads of up to 8 bytes as a normal message
+    virtual bool sendFDMessage(const RawCommsFDMessage& message) {
+        if (message.length > 8) return false;
+
+        RawCommsMessage classic{};
+        classic.id = message.id;
+        classic.length = message.length;
+        memcpy(classic.payloadBytes, message.payloadBytes, message.length);
+        sendMessage(classic);
+        return true;
+    }
+
+    /// @brief Receives a message with a CAN FD sized payload
+    /// @param message The received message
+    /// @return True if a message was received, false if no message was available
+    /// @note Classic drivers receive a normal message
+    virtual bool receiveFDMessage(RawCommsFDMessage* message) {
+        RawCommsMessage classic;
+        if (!receiveMessage(&classic)) return false;
+
+        message->id = classic.id;
+        message->length = classic.length > 8 ? 8 : classic.length;
+        message->bitRateSwitch = false;
+        memcpy(message->payloadBytes, classic.payloadBytes, message->length);
+        return true;
+    }
+
+    /// @brief Gets the fault confinement state of the bus
+    /// @return The bus state, drivers that can't tell always report BS_ERROR_ACTIVE
+    virtual BusState busState() { return BS_ERROR_ACTIVE; }
+
     /// @brief Attaches a callback for receiving messages with a specific ID
     /// @param id The ID of the messages to listen for
     void attachRXCallback(uint32_t id, std::function<void(const RawCommsMessage&)> callback) {
@@ -67,7 +67,24 @@
 #define COMMS_SYSTEM_STR "COMMS"
 #define COMMS_COLOR_STR COLOR_BLUE
 
-#ifdef COMMS_DEBUG
+#if defined(COMMS_DEBUG) && defined(DEBUG) && defined(COMMS_DEFERRED_LOG)
+
+// messages go to the deferred log ring, only fatal errors are still printed right away
+#include "deferred_log.hpp"
+
+#define COMMS_DEBUG_PRINT(fmt, ...) COMMS_DEFERRED_LOG_WRITE(0, fmt, ##__VA_ARGS__)
+#define COMMS_DEBUG_PRINTLN(fmt, ...) \
+    COMMS_DEFERRED_LOG_WRITE(::comms::DLF_NEWLINE, fmt, ##__VA_ARGS__)
+#define COMMS_DEBUG_PRINT_ERROR(fmt, ...) \
+    COMMS_DEFERRED_LOG_WRITE(::comms::DLF_ERROR, fmt, ##__VA_ARGS__)
+#define COMMS_DEBUG_PRINT_ERRORLN(fmt, ...) \
+    COMMS_DEFERRED_LOG_WRITE(::comms::DLF_ERROR | ::comms::DLF_NEWLINE, fmt, ##__VA_ARGS__)
+#define COMMS_DEBUG_PRINT_FATAL_ERROR(fmt, ...) \
+    DEBUG_PRINT_FATAL_ERROR(COMMS_SYSTEM_STR, COMMS_COLOR_STR, fmt, ##__VA_ARGS__)
+#define COMMS_DEBUG_PRINT_FATAL_ERRORLN(fmt, ...) \
+    DEBUG_PRINT_FATAL_ERRORLN(COMMS_SYSTEM_STR, COMMS_COLOR_STR, fmt, ##__VA_ARGS__)
+
+#elif defined(COMMS_DEBUG)
 
 #define COMMS_DEBUG_PRINT(fmt, ...) \
     DEBUG_PRINT(COMMS_SYSTEM_STR, COMMS_COLOR_STR, fmt, ##__VA_ARGS__)
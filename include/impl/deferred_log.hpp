@@ -0,0 +1,191 @@
+#ifndef __DEFERRED_LOG_H__
+#define __DEFERRED_LOG_H__
+
+/**========================================================================
+ *                             deferred_log.hpp
+ *
+ *  Takes debug output off the hot path, built with -DCOMMS_DEFERRED_LOG.
+ *  A log site stores its format's ID and its raw arguments into a
+ *  lock-free RAM ring, which costs about as much as copying a CAN frame.
+ *  The ring is drained later, from idle time: as text on the MCU, or as
+ *  binary records that scripts/decode_log.py turns back into text on a
+ *  host, so the MCU never formats at all.
+ *
+ *  A binary record on the wire is, little endian:
+ *    uint8_t  kSync
+ *    uint8_t  length of the rest of the record
+ *    uint32_t timestamp, Clock::micros()
+ *    uint32_t format ID, the FNV-1a hash of the format string
+ *    uint16_t line
+ *    uint8_t  flags, DeferredLogFlags
+ *    uint8_t  argument count
+ *    the arguments, each a DeferredLogArgType tag followed by its value
+ *
+ *========================================================================**/
+
+#ifdef COMMS_DEFERRED_LOG
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+#include "mpsc_queue.hpp"
+
+namespace comms {
+
+/// @brief How an argument is stored in a record
+enum DeferredLogArgType : uint8_t {
+    DLA_I32,  // 4 bytes
+    DLA_U32,  // 4 bytes
+    DLA_I64,  // 8 bytes
+    DLA_U64,  // 8 bytes
+    DLA_F64,  // 8 bytes
+    DLA_STR,  // a length byte, then that many characters, cut short to fit
+};
+
+/// @brief The flags of a log site
+enum DeferredLogFlags : uint8_t {
+    DLF_ERROR = 0x01,    // logged through an _ERROR macro
+    DLF_NEWLINE = 0x02,  // logged through an LN macro, a newline follows the text
+};
+
+/// @brief The FNV-1a hash of a format string, its ID in binary logs
+constexpr uint32_t deferredLogFormatID(const char* format) {
+    uint32_t hash = 2166136261u;
+    for (; *format != '\0'; format++) {
+        hash = (hash ^ static_cast<uint8_t>(*format)) * 16777619u;
+    }
+    return hash;
+}
+
+/// @brief Everything about a log site that is known at compile time
+struct DeferredLogSite {
+    uint32_t formatID;
+    const char* format;
+    const char* file;
+    uint16_t line;
+    uint8_t flags;  // DeferredLogFlags
+};
+
+/// @brief One logged message, as it waits in the ring
+struct DeferredLogRecord {
+    static constexpr size_t kMaxArgBytes = 32;
+
+    /// @brief The longest string argument kept, so a long one doesn't crowd out the rest
+    static constexpr size_t kMaxStringLength = 16;
+
+    const DeferredLogSite* site;
+    uint32_t timestampUs;
+    uint8_t argCount;
+    uint8_t length;  // the bytes of args in use
+    uint8_t args[kMaxArgBytes];
+
+    /// @brief Appends an argument, it is left out if the record is full
+    template <typename T>
+    void add(const T& value) {
+        using U = typename std::decay<T>::type;
+        if constexpr (std::is_same<U, std::string>::value) {
+            addString(value.c_str());
+        } else if constexpr (std::is_same<U, char*>::value || std::is_same<U, const char*>::value) {
+            addString(value);
+        } else if constexpr (std::is_enum<U>::value) {
+            add(static_cast<typename std::underlying_type<U>::type>(value));
+        } else if constexpr (std::is_floating_point<U>::value) {
+            addRaw(DLA_F64, static_cast<double>(value));
+        } else if constexpr (std::is_pointer<U>::value) {
+            addRaw(DLA_U64, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+        } else if constexpr (sizeof(U) <= 4 && std::is_signed<U>::value) {
+            addRaw(DLA_I32, static_cast<int32_t>(value));
+        } else if constexpr (sizeof(U) <= 4) {
+            addRaw(DLA_U32, static_cast<uint32_t>(value));
+        } else if constexpr (std::is_signed<U>::value) {
+            addRaw(DLA_I64, static_cast<int64_t>(value));
+        } else {
+            addRaw(DLA_U64, static_cast<uint64_t>(value));
+        }
+    }
+
+   private:
+    template <typename V>
+    void addRaw(DeferredLogArgType type, V value) {
+        if (length + 1 + sizeof(V) > kMaxArgBytes) return;
+        args[length] = type;
+        memcpy(&args[length + 1], &value, sizeof(V));
+        length += 1 + sizeof(V);
+        argCount++;
+    }
+
+    void addString(const char* value);
+};
+
+/// @brief The ring every COMMS_DEBUG_* message goes to when COMMS_DEFERRED_LOG is defined
+/// @note Logging is safe from any thread and never blocks, a message that finds the ring full is
+/// dropped and counted. Drain from one thread only
+class DeferredLog {
+   public:
+    /// @brief How many messages the ring holds
+    static constexpr size_t kCapacity = 256;
+
+    /// @brief The sync byte every binary record starts with
+    static constexpr uint8_t kSync = 0xA5;
+
+    /// @brief The format ID of the record telling how many messages were dropped, its argument
+    static constexpr uint32_t kDroppedFormatID = 0;
+
+    /// @brief Logs a message, use the COMMS_DEBUG_* macros rather than this
+    template <typename... Args>
+    static void write(const DeferredLogSite* site, const Args&... args) {
+        DeferredLogRecord record;
+        record.site = site;
+        record.argCount = 0;
+        record.length = 0;
+        (record.add(args), ...);
+        push(record);
+    }
+
+    /// @brief Formats waiting messages as text, the way the immediate macros would print them
+    /// @param sink Called with each message, e.g. to hand to Serial.print
+    /// @param maxRecords The most messages to format, to bound the time it takes
+    /// @return The number of messages formatted
+    static size_t drainText(const std::function<void(const char*)>& sink,
+                            size_t maxRecords = kCapacity);
+
+    /// @brief Encodes waiting messages as binary records, for scripts/decode_log.py
+    /// @param sink Called with each encoded record, e.g. to hand to Serial.write
+    /// @param maxRecords The most messages to encode
+    /// @return The number of messages encoded
+    static size_t drainBinary(const std::function<void(const uint8_t*, size_t)>& sink,
+                              size_t maxRecords = kCapacity);
+
+    /// @brief The number of messages dropped on a full ring, since the start
+    static uint32_t dropped() { return _dropped.load(std::memory_order_relaxed); }
+
+   private:
+    static void push(DeferredLogRecord& record);
+
+    /// @brief The drops the drains haven't told about yet
+    static uint32_t takeUnreportedDrops();
+
+    static MPSCQueue<DeferredLogRecord, kCapacity> _ring;
+    static std::atomic<uint32_t> _dropped;
+    static uint32_t _reportedDrops;
+};
+
+}  // namespace comms
+
+/// @brief Logs into the ring, flags are DeferredLogFlags
+#define COMMS_DEFERRED_LOG_WRITE(flags, fmt, ...)                                 \
+    do {                                                                          \
+        static constexpr ::comms::DeferredLogSite __comms_log_site{               \
+            ::comms::deferredLogFormatID(fmt), fmt, __FILE__, __LINE__, (flags)}; \
+        ::comms::DeferredLog::write(&__comms_log_site, ##__VA_ARGS__);           \
+    } while (0)
+
+#endif  // COMMS_DEFERRED_LOG
+
+#endif  // __DEFERRED_LOG_H__
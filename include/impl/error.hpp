@@ -1,9 +1,9 @@
 #ifndef __ERROR_H__
 #define __ERROR_H__
 
-#include "comms_driver.hpp"
 #include "id.hpp"
 #include "option.hpp"
+#include "outbox.hpp"
 #include "result.hpp"
 
 namespace comms {
@@ -64,11 +64,11 @@ class ErrorManager {
    public:
 
     /// @brief Constructs an ErrorManager with the given driver and ID
-    /// @param driver The communication driver to use for sending messages
+    /// @param driver The outbox to send messages through, the controller flushes it to the bus
     /// @param me The ID of this MCU
-    /// @note The ErrorManager will use this driver to send error messages
+    /// @note The ErrorManager will use this outbox to send error messages
     /// @note The ID should be unique across all MCUs in the system
-    ErrorManager(CommsDriver* driver, MCUID me);
+    ErrorManager(MessageOutbox* driver, MCUID me);
 
     /// @brief Initializes the error manager
     /// @param errorRetransitionTimeMs The time in milliseconds to wait before retransmitting an error
@@ -113,7 +113,7 @@ class ErrorManager {
     /// @brief The
     std::unordered_map<uint32_t, ManagedErrorStatus> _errorStatus;
 
-    CommsDriver* _driver;
+    MessageOutbox* _driver;
     MCUID _me;
     uint32_t _errorRetransmissionTimeMs;
 
@@ -0,0 +1,105 @@
+#ifndef __EXEC_STATUS_H__
+#define __EXEC_STATUS_H__
+
+#include <stdint.h>
+
+#include <array>
+#include <functional>
+#include <vector>
+
+#include "comms_driver.hpp"
+#include "id.hpp"
+#include "option.hpp"
+
+namespace comms {
+
+/// @brief Why a slice of commands failed, handlers may report their own codes from 1 to 0xFE
+enum ExecutionFailure : uint8_t {
+    EF_NONE = 0,
+    EF_NO_HANDLER = 0xFF,  // a command of a type no handler is set for
+};
+
+/// @brief The 8 byte execution status a low level node sends when it finishes a slice
+struct ExecutionStatusPayload {
+    union {
+        uint64_t raw;
+        struct {
+            uint8_t flags;
+            uint8_t failure;         // ExecutionFailure, or a handler's own code
+            uint16_t lastCommandID;  // the last command of the slice, 0 for an empty start
+            uint8_t executed;        // the commands in the slice, saturated
+            uint8_t remaining;       // the commands still buffered after it, saturated
+            uint16_t elapsedMs;      // how long the slice ran, saturated
+        };
+    };
+
+    /// @brief Set on the last slice of an execution, the node stopped and waits for a new start
+    static constexpr uint8_t kFlagExecutionDone = 0x01;
+
+    /// @brief Set on the slice that emptied its bank, the bank can be loaded with the next motion
+    static constexpr uint8_t kFlagBankDone = 0x02;
+
+    /// @brief The bits of the flags that hold the bank the slice ran from
+    static constexpr uint8_t kBankMask = 0x30;
+    static constexpr uint8_t kBankShift = 4;
+
+    ExecutionStatusPayload() : raw(0) {}
+};
+
+/// @brief An execution status as seen by the high level
+struct ExecutionReport {
+    MCUID node;
+    bool executionDone;  // the node ran out of commands, or stopped at a failure
+    uint8_t bank;        // the command bank the slice ran from
+    bool bankDone;       // the slice emptied its bank, another started bank may be taking over
+    uint8_t failure;     // EF_NONE if every command of the slice succeeded
+    uint16_t lastCommandID;
+    uint8_t executed;
+    uint8_t remaining;
+    uint16_t elapsedMs;
+
+    bool succeeded() const { return failure == EF_NONE; }
+};
+
+/// @brief What a node's execution statuses added up to
+struct ExecutionMetrics {
+    uint32_t slices;      // slices reported
+    uint32_t commands;    // commands executed in them
+    uint32_t failures;    // slices that failed
+    uint32_t executions;  // executions that ended, with success or not
+    uint32_t totalSliceMs;
+    uint16_t maxSliceMs;
+    uint16_t lastCommandID;  // the last command the node finished
+    bool executing;          // false once the last report ended the execution
+    uint32_t lastReportMs;   // Clock::millis() when the last report arrived
+
+    /// @brief The mean time a slice took
+    float meanSliceMs() const { return slices == 0 ? 0.0f : totalSliceMs / float(slices); }
+};
+
+/// @brief Collects the execution statuses the low level nodes send to the high level
+class ExecutionMonitor {
+   public:
+    ExecutionMonitor();
+
+    /// @brief Adds a function called from tick() with every execution status received
+    void onExecutionStatus(std::function<void(const ExecutionReport&)> callback);
+
+    /// @brief Decodes an execution status, adds it to the metrics of its node, and calls back
+    void handleMessage(MessageInfo info, const RawCommsMessage& message);
+
+    /// @brief Gets the metrics of a node
+    /// @return The metrics, or none if the node hasn't reported yet
+    Option<ExecutionMetrics> metrics(MCUID node) const;
+
+   private:
+    static constexpr uint8_t kMaxNodes = 8;
+
+    std::array<ExecutionMetrics, kMaxNodes> _metrics;
+    std::array<bool, kMaxNodes> _reported;
+    std::vector<std::function<void(const ExecutionReport&)>> _callbacks;
+};
+
+}  // namespace comms
+
+#endif  // __EXEC_STATUS_H__
@@ -0,0 +1,43 @@
+#ifndef __FD_BATCH_H__
+#define __FD_BATCH_H__
+
+#include <stdint.h>
+
+#include "comms_driver.hpp"
+
+namespace comms {
+
+/// @brief Packs 8-byte records that share an ID into CAN FD frames
+/// @note Sensor and command payloads are 8 bytes, so an FD frame can carry up to 8 of them. A frame
+/// is padded to a valid FD length with records of all 0xFF bytes, which receivers skip.
+class FDRecordBatch {
+   public:
+    /// @brief The size of one record
+    static constexpr uint8_t kRecordSize = 8;
+
+    /// @brief The most records in one frame
+    static constexpr uint8_t kMaxRecords = RawCommsFDMessage::kMaxLength / kRecordSize;
+
+    /// @brief Constructs a batch that sends on the given driver
+    explicit FDRecordBatch(CommsDriver* driver);
+
+    /// @brief Adds a record, sending the frame first if it is full or has a different ID
+    /// @param id The ID of the frame the record belongs in
+    /// @param record The record, kRecordSize bytes
+    void add(uint32_t id, const uint8_t* record);
+
+    /// @brief Sends the records added so far, if there are any
+    void flush();
+
+    /// @brief Checks if a record is padding
+    static bool isPadding(const uint8_t* record);
+
+   private:
+    CommsDriver* _driver;
+    RawCommsFDMessage _frame;
+    uint8_t _count;
+};
+
+}  // namespace comms
+
+#endif  // __FD_BATCH_H__
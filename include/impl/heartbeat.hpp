@@ -1,9 +1,9 @@
 #ifndef __HEARTBEAT_H__
 #define __HEARTBEAT_H__
 
-#include "comms_driver.hpp"
 #include "id.hpp"
 #include "option.hpp"
+#include "outbox.hpp"
 #include "result.hpp"
 
 namespace comms {
@@ -15,6 +15,9 @@ struct HearbeatMessageRequestPayload {
         uint64_t raw;
         struct {
             MCUID id;
+            bool hasBusTime;  // false from senders that don't stamp their requests
+            uint8_t reserved[2];
+            uint32_t busTimeUs;  // the high level's Clock::micros() when the request was queued
         };
     };
 };
@@ -47,14 +50,48 @@ struct HeartbeatResponseStatus {
     uint64_t heartbeatCount;
 };
 
+/// @brief Tracks the offset between this MCU's clock and the bus time, which is the high level's
+/// Clock::micros()
+/// @note Heartbeat requests carry the bus time. A stamp is always late by the time the request
+/// spent in queues and on the wire, so the stamp that arrived the soonest is the best one: the
+/// offset jumps to any stamp that implies less delay, and otherwise creeps towards the newest
+/// stamps so it follows the clocks drifting apart
+class BusTimeSync {
+   public:
+    /// @brief Constructs a sync
+    /// @param reference True on the MCU whose clock is the bus time, it is synced from the start
+    explicit BusTimeSync(bool reference) : _synced(reference), _offsetUs(0) {}
+
+    /// @brief Takes in a bus time stamp
+    /// @param busTimeUs The bus time the stamp carries
+    /// @param localTimeUs This MCU's Clock::micros() when the stamp arrived
+    void update(uint32_t busTimeUs, uint32_t localTimeUs);
+
+    /// @brief True once a stamp has arrived, or on the reference MCU
+    bool isSynced() const { return _synced; }
+
+    /// @brief Converts a bus time to this MCU's Clock::micros()
+    uint32_t toLocal(uint32_t busTimeUs) const { return busTimeUs - _offsetUs; }
+
+    /// @brief Converts this MCU's Clock::micros() to the bus time
+    uint32_t toBus(uint32_t localTimeUs) const { return localTimeUs + _offsetUs; }
+
+   private:
+    /// @brief How much of the gap to a later stamp the offset closes per stamp, as a shift
+    static constexpr uint8_t kDriftShift = 4;
+
+    bool _synced;
+    int32_t _offsetUs;  // bus time minus local time
+};
+
 /// @brief A structure representing the payload of a heartbeat request message
 class HeartbeatManager {
    public:
 
     /// @brief Constructs a HeartbeatManager with the given driver and ID
-    /// @param driver The communication driver to use for sending messages
+    /// @param driver The outbox to send messages through, the controller flushes it to the bus
     /// @param me The ID of this MCU
-    HeartbeatManager(CommsDriver* driver, MCUID me);
+    HeartbeatManager(MessageOutbox* driver, MCUID me);
 
     /// @brief Initializes the heartbeat manager
     /// @param intervalTimeMs The interval time in milliseconds for sending heartbeat messages
@@ -78,10 +115,18 @@ class HeartbeatManager {
     /// @note This will send a heartbeat response message to the requesting MCU
     void sendHeartbeatResponse();
 
+    /// @brief Handles a heartbeat request seen on the bus, whoever it was meant for
+    /// @note Takes in its bus time stamp, and answers it if it was meant for this MCU
+    /// @param request The request
+    void handleHeartbeatRequest(const HearbeatMessageRequestPayload& request);
+
+    /// @brief The offset between this MCU's clock and the bus time
+    const BusTimeSync& timeSync() const { return _timeSync; }
+
    private:
     std::unordered_map<MCUID, HeartbeatRequestStatus> _requestStatuses;
     HeartbeatResponseStatus _myStatus;
-    CommsDriver* _driver;
+    MessageOutbox* _driver;
     MCUID _me;
 
     uint32_t _intervalTimeMs;
@@ -89,6 +134,8 @@ class HeartbeatManager {
 
     std::vector<MCUID> _nodesToCheck;
     std::vector<MCUID> _badNodes;
+
+    BusTimeSync _timeSync;
 };
 
 }  // namespace comms
@@ -0,0 +1,123 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "option.hpp"
+
+namespace comms {
+
+/// @brief A sensor value and when it was received
+struct SensorSample {
+    uint32_t timeUs;  // Clock::micros() when the sample was dispatched
+    float value;
+};
+
+/// @brief A fixed-size ring of the most recent samples of one sensor stream, with a sliding
+/// window whose min, max and mean are kept up to date as samples arrive
+/// @note Timestamps come from Clock::micros(), comparisons are wrap-safe as long as the history
+/// spans less than half the 32-bit range (about 35 minutes)
+class SensorHistory {
+   public:
+    /// @brief Constructs a history
+    /// @param capacity The most samples kept, rounded up to a power of two. The storage is
+    /// allocated once, here
+    /// @param windowUs The span of the min/max/mean window, it never holds more than capacity
+    /// samples
+    SensorHistory(size_t capacity, uint32_t windowUs);
+
+    /// @brief Adds a sample, dropping the oldest one if the ring is full
+    /// @param timeUs When the sample arrived, not earlier than the previous sample
+    /// @param value The value
+    void push(uint32_t timeUs, float value);
+
+    /// @brief The number of samples held
+    size_t size() const { return _count; }
+
+    /// @brief The most samples held
+    size_t capacity() const { return _samples.size(); }
+
+    /// @brief Gets a sample without copying the ring
+    /// @param age 0 for the newest sample, size() - 1 for the oldest
+    const SensorSample& newest(size_t age = 0) const;
+
+    /// @brief Counts the samples that arrived at or after a time
+    /// @return The number of samples, which are newest(0) to newest(count - 1)
+    /// @note Binary search, O(log n)
+    size_t countSince(uint32_t timeUs) const;
+
+    /// @brief Copies the last samples, oldest first
+    /// @param n The number of samples wanted
+    /// @param out Where to copy them, room for n samples
+    /// @return The number copied, fewer than n if the history is shorter
+    size_t copyLast(size_t n, SensorSample* out) const;
+
+    /// @brief Copies the samples that arrived at or after a time, oldest first
+    /// @param capacity The room in out, only the newest samples are copied if there are more
+    /// @return The number copied
+    size_t copySince(uint32_t timeUs, SensorSample* out, size_t capacity) const;
+
+    /// @brief Gets the value at a time, interpolated linearly between the samples around it
+    /// @return The value, or none if the time is outside the history
+    Option<float> valueAt(uint32_t timeUs) const;
+
+    /// @brief Gets the rate of change between the two newest samples, per second
+    /// @return The rate, or none if there are fewer than two samples
+    Option<float> derivative() const;
+
+    /// @brief The lowest value in the window, or none if the history is empty
+    Option<float> windowMin() const;
+
+    /// @brief The highest value in the window, or none if the history is empty
+    Option<float> windowMax() const;
+
+    /// @brief The mean of the window, or none if the history is empty
+    Option<float> windowMean() const;
+
+    /// @brief The number of samples in the window
+    size_t windowSize() const { return _sequence - _windowStart; }
+
+   private:
+    /// @brief A ring of sample sequence numbers, used as a monotonic deque
+    struct MonotonicQueue {
+        std::vector<uint32_t> sequences;
+        size_t head;
+        size_t count;
+
+        uint32_t front() const { return sequences[head]; }
+        uint32_t back() const { return sequences[(head + count - 1) % sequences.size()]; }
+        void popFront() {
+            head = (head + 1) % sequences.size();
+            count--;
+        }
+        void popBack() { count--; }
+        void pushBack(uint32_t sequence) {
+            sequences[(head + count) % sequences.size()] = sequence;
+            count++;
+        }
+    };
+
+    /// @brief Gets a sample by its sequence number, it must still be in the ring
+    /// @note The capacity is a power of two, so this stays right when the sequence number wraps
+    const SensorSample& bySequence(uint32_t sequence) const { return _samples[sequence & _mask]; }
+
+    /// @brief Drops the oldest sample of the window from the running aggregates
+    void evictFromWindow();
+
+    std::vector<SensorSample> _samples;
+    uint32_t _mask;
+    size_t _count;
+    uint32_t _sequence;     // the sequence number the next sample gets
+    uint32_t _windowUs;
+    uint32_t _windowStart;  // the sequence number of the oldest sample in the window
+    double _windowSum;
+    MonotonicQueue _minQueue;  // values increase from front to back, the front is the minimum
+    MonotonicQueue _maxQueue;  // values decrease from front to back, the front is the maximum
+};
+
+}  // namespace comms
+
+#endif  // __HISTORY_H__
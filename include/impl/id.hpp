@@ -6,6 +6,7 @@
 
 #include <map>
 
+#include "comms_driver.hpp"
 #include "option.hpp"
 
 namespace comms {
@@ -31,7 +32,7 @@ enum MessageID : uint32_t {
     MID_ERROR_LL0 = 0x010,
     MID_ERROR_LL1 = 0x020,
     MID_ERROR_LL2 = 0x030,
-    MID_ERROR_LL3 = 0x030,
+    MID_ERROR_LL3 = 0x050,
     MID_ERROR_PALM = 0x040,
     MID_HEARTBEAT_REQ = 0x10A,
     MID_HEARTBEAT_RESP_LL0 = 0x100,
@@ -49,11 +50,32 @@ enum MessageID : uint32_t {
     MID_SENSOR_DATA_LL2 = 0x420,
     MID_SENSOR_DATA_LL3 = 0x430,
     MID_SENSOR_DATA_PALM = 0x440,
+    MID_EXEC_STATUS_LL0 = 0x500,
+    MID_EXEC_STATUS_LL1 = 0x510,
+    MID_EXEC_STATUS_LL2 = 0x520,
+    MID_EXEC_STATUS_LL3 = 0x530,
+    MID_EXEC_STATUS_PALM = 0x540,
+    MID_TRANSPORT_HL = 0x600,
+    MID_TRANSPORT_LL0 = 0x610,
+    MID_TRANSPORT_LL1 = 0x620,
+    MID_TRANSPORT_LL2 = 0x630,
+    MID_TRANSPORT_LL3 = 0x640,
+    MID_TRANSPORT_PALM = 0x650,
 };
 
 /// @brief The type of content in a message
 /// @note This is used to determine how the message should be processed
-enum MessageContentType : uint8_t { MT_ERROR, MT_HEARTBEAT, MT_COMMAND, MT_SENSOR_DATA };
+enum MessageContentType : uint8_t {
+    MT_ERROR,
+    MT_HEARTBEAT,
+    MT_COMMAND,
+    MT_SENSOR_DATA,
+    MT_TRANSPORT,
+    MT_EXEC_STATUS,
+};
+
+/// @brief The number of message content types, for tables indexed by MessageContentType
+constexpr uint8_t kNumMessageContentTypes = MT_EXEC_STATUS + 1;
 
 /// @brief A structure representing the information about a message
 /// @note This includes the sender, target, and type of the message
@@ -70,6 +92,16 @@ struct MessageInfo {
     /// @param sender The ID of the sender MCU
     static const Option<uint32_t> getMessageID(MCUID sender, MessageContentType type);
 
+    /// @brief Builds a 29-bit extended ID from its fields
+    /// @param info The sender, target and content type
+    /// @param priority 0 to 7, lower wins arbitration
+    /// @return The ID, with kExtendedIDFlag set
+    static constexpr uint32_t encodeExtendedID(MessageInfo info, uint8_t priority);
+
+    /// @brief Splits a 29-bit extended ID into its fields
+    /// @return The fields, or none if the ID isn't an extended ID or has an unknown content type
+    static const Option<MessageInfo> decodeExtendedID(uint32_t id);
+
     /// @brief Checks if this message info should be listened to by the given MCU ID
     /// @param me The ID of the MCU that is checking if it should listen
     bool shouldListen(MCUID me) const {
@@ -88,6 +120,86 @@ struct MessageInfo {
     }
 };
 
+/// Extended IDs have the fields laid out from the most significant bit, so priority decides
+/// arbitration first and the target can be matched with one acceptance filter:
+///
+///   28..26  priority
+///   25..21  content type
+///   20..16  reserved, 0
+///   15..8   sender
+///    7..0   target
+constexpr uint8_t kExtPriorityShift = 26;
+constexpr uint8_t kExtTypeShift = 21;
+constexpr uint8_t kExtSenderShift = 8;
+constexpr uint32_t kExtPriorityMask = 0x7;
+constexpr uint32_t kExtTypeMask = 0x1F;
+constexpr uint32_t kExtTargetMask = 0xFF;
+
+/// @brief The default priority of each content type, in the same order as the 11-bit IDs
+constexpr uint8_t messagePriority(MessageContentType type) {
+    switch (type) {
+        case MT_ERROR:
+            return 0;
+        case MT_HEARTBEAT:
+            return 1;
+        case MT_COMMAND:
+            return 2;
+        case MT_SENSOR_DATA:
+            return 4;
+        case MT_EXEC_STATUS:
+            return 5;
+        default:
+            return 6;
+    }
+}
+
+/// @brief The target of a message a sender doesn't address to anyone in particular, matching the
+/// 11-bit table
+constexpr MCUID defaultTarget(MCUID sender, MessageContentType type) {
+    switch (type) {
+        case MT_HEARTBEAT:
+        case MT_COMMAND:
+            return sender == MCU_HIGH_LEVEL ? MCU_LOW_LEVEL_ANY : MCU_HIGH_LEVEL;
+        case MT_SENSOR_DATA:
+        case MT_EXEC_STATUS:
+            return MCU_HIGH_LEVEL;
+        default:
+            return MCU_ANY;
+    }
+}
+
+constexpr uint32_t MessageInfo::encodeExtendedID(MessageInfo info, uint8_t priority) {
+    return kExtendedIDFlag | ((priority & kExtPriorityMask) << kExtPriorityShift) |
+           ((info.type & kExtTypeMask) << kExtTypeShift) |
+           (static_cast<uint32_t>(info.sender) << kExtSenderShift) | info.target;
+}
+
+inline const Option<MessageInfo> MessageInfo::decodeExtendedID(uint32_t id) {
+    if ((id & kExtendedIDFlag) == 0) return Option<MessageInfo>::none();
+
+    uint8_t type = (id >> kExtTypeShift) & kExtTypeMask;
+    if (type >= kNumMessageContentTypes) return Option<MessageInfo>::none();
+
+    MessageInfo info{static_cast<MCUID>((id >> kExtSenderShift) & 0xFF),
+                     static_cast<MCUID>(id & kExtTargetMask), static_cast<MessageContentType>(type)};
+    return Option<MessageInfo>::some(info);
+}
+
+#ifdef COMMS_EXTENDED_IDS
+
+// every ID is built from its fields, so there is no table to keep in sync as nodes are added
+
+inline const Option<MessageInfo> MessageInfo::getInfo(uint32_t id) {
+    return decodeExtendedID(id);
+}
+
+inline const Option<uint32_t> MessageInfo::getMessageID(MCUID sender, MessageContentType type) {
+    MessageInfo info{sender, defaultTarget(sender, type), type};
+    return Option<uint32_t>::some(encodeExtendedID(info, messagePriority(type)));
+}
+
+#else
+
 /// @brief A lookup table for message IDs and their corresponding information
 inline const std::map<uint32_t, MessageInfo> __infoLUT = {
     // Errors — any target
@@ -119,6 +231,21 @@ inline const std::map<uint32_t, MessageInfo> __infoLUT = {
     {MID_SENSOR_DATA_LL2, {MCU_LOW_LEVEL_2, MCU_HIGH_LEVEL, MT_SENSOR_DATA}},
     {MID_SENSOR_DATA_LL3, {MCU_LOW_LEVEL_3, MCU_HIGH_LEVEL, MT_SENSOR_DATA}},
     {MID_SENSOR_DATA_PALM, {MCU_PALM, MCU_HIGH_LEVEL, MT_SENSOR_DATA}},
+
+    // Execution status
+    {MID_EXEC_STATUS_LL0, {MCU_LOW_LEVEL_0, MCU_HIGH_LEVEL, MT_EXEC_STATUS}},
+    {MID_EXEC_STATUS_LL1, {MCU_LOW_LEVEL_1, MCU_HIGH_LEVEL, MT_EXEC_STATUS}},
+    {MID_EXEC_STATUS_LL2, {MCU_LOW_LEVEL_2, MCU_HIGH_LEVEL, MT_EXEC_STATUS}},
+    {MID_EXEC_STATUS_LL3, {MCU_LOW_LEVEL_3, MCU_HIGH_LEVEL, MT_EXEC_STATUS}},
+    {MID_EXEC_STATUS_PALM, {MCU_PALM, MCU_HIGH_LEVEL, MT_EXEC_STATUS}},
+
+    // Segmented transport — the real target is the first payload byte
+    {MID_TRANSPORT_HL, {MCU_HIGH_LEVEL, MCU_ANY, MT_TRANSPORT}},
+    {MID_TRANSPORT_LL0, {MCU_LOW_LEVEL_0, MCU_ANY, MT_TRANSPORT}},
+    {MID_TRANSPORT_LL1, {MCU_LOW_LEVEL_1, MCU_ANY, MT_TRANSPORT}},
+    {MID_TRANSPORT_LL2, {MCU_LOW_LEVEL_2, MCU_ANY, MT_TRANSPORT}},
+    {MID_TRANSPORT_LL3, {MCU_LOW_LEVEL_3, MCU_ANY, MT_TRANSPORT}},
+    {MID_TRANSPORT_PALM, {MCU_PALM, MCU_ANY, MT_TRANSPORT}},
 };
 
 inline const Option<MessageInfo> MessageInfo::getInfo(uint32_t id) {
@@ -136,6 +263,8 @@ inline const Option<uint32_t> MessageInfo::getMessageID(MCUID sender, MessageCon
     return Option<uint32_t>::none();
 }
 
+#endif  // COMMS_EXTENDED_IDS
+
 }  // namespace comms
 
 #endif  // __ID_H__
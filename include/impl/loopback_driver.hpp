@@ -0,0 +1,119 @@
+#ifndef __LOOPBACK_DRIVER_H__
+#define __LOOPBACK_DRIVER_H__
+
+/**========================================================================
+ *                           loopback_driver.hpp
+ *
+ *  An in-memory bus for host builds. Every frame a driver sends is
+ *  delivered straight to every other driver on the bus, with no timing
+ *  model. It can carry CAN FD payloads, so FD code paths can be tested
+ *  without hardware. Use SimulatedCANBus when timing matters. On hosts
+ *  the bus is locked, so its drivers may be used from different threads.
+ *
+ *========================================================================**/
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#ifndef ARDUINO
+#include <mutex>
+#endif
+
+#include "comms_driver.hpp"
+
+namespace comms {
+
+class LoopbackBus;
+
+/// @brief One end of a LoopbackBus
+class LoopbackDriver final : public CommsDriver {
+   public:
+    void install() override {}
+    void uninstall() override {}
+
+    /// @brief Delivers a frame to every other driver on the bus
+    void sendMessage(const RawCommsMessage& message) override;
+
+    /// @brief Takes the oldest frame, payloads longer than 8 bytes are truncated
+    bool receiveMessage(RawCommsMessage* res) override;
+
+    /// @brief Delivers a batch of frames to every other driver on the bus
+    size_t sendMessages(const RawCommsMessage* messages, size_t count) override;
+
+    /// @brief Takes up to a batch of the oldest frames
+    size_t receiveMessages(RawCommsMessage* messages, size_t capacity) override;
+
+    bool supportsFD() const override;
+    uint8_t maxPayloadLength() const override;
+
+    /// @brief Delivers a frame to every other driver on the bus, padded to a valid FD length
+    bool sendFDMessage(const RawCommsFDMessage& message) override;
+
+    /// @brief Takes the oldest frame
+    bool receiveFDMessage(RawCommsFDMessage* message) override;
+
+    /// @brief The number of frames waiting to be received
+    size_t pending() const;
+
+    /// @brief The number of frames dropped because the receive queue was full
+    uint32_t dropped() const { return _dropped; }
+
+   private:
+    friend class LoopbackBus;
+
+    LoopbackDriver(LoopbackBus* bus, size_t rxCapacity)
+        : _bus(bus), _rxCapacity(rxCapacity), _dropped(0) {}
+
+    /// @brief Queues a frame sent by another driver
+    void deliver(const RawCommsFDMessage& message);
+
+    LoopbackBus* _bus;
+    size_t _rxCapacity;
+    uint32_t _dropped;
+    std::deque<RawCommsFDMessage> _rx;
+};
+
+/// @brief An in-memory bus connecting any number of LoopbackDrivers
+class LoopbackBus {
+   public:
+    /// @brief Constructs a loopback bus
+    /// @param fd True to carry payloads of up to 64 bytes, false for classic 8 byte payloads
+    explicit LoopbackBus(bool fd = true) : _fd(fd) {}
+
+    /// @brief Adds a driver to the bus
+    /// @param rxCapacity How many frames the driver can hold before it drops new ones
+    /// @return The driver, owned by the bus
+    LoopbackDriver& addDriver(size_t rxCapacity = 1024);
+
+    /// @brief Checks if the bus carries CAN FD payloads
+    bool isFD() const { return _fd; }
+
+   private:
+    friend class LoopbackDriver;
+
+    /// @brief Holds the bus lock for a scope, does nothing on Arduino where there is one thread
+    class Lock {
+       public:
+        explicit Lock(const LoopbackBus* bus);
+        ~Lock();
+
+       private:
+        const LoopbackBus* _bus;
+    };
+
+    /// @brief Delivers a frame to every driver but the sender
+    void broadcast(const LoopbackDriver* from, const RawCommsFDMessage& message);
+
+    bool _fd;
+    std::vector<std::unique_ptr<LoopbackDriver>> _drivers;
+#ifndef ARDUINO
+    mutable std::mutex _mutex;  // guards the receive queues of every driver
+#endif
+};
+
+}  // namespace comms
+
+#endif  // __LOOPBACK_DRIVER_H__
@@ -0,0 +1,171 @@
+#ifndef __MOTION_H__
+#define __MOTION_H__
+
+/**========================================================================
+ *                             motion.hpp
+ *
+ *  Motion commands carry setpoints for several motors of one MCU, which are
+ *  applied together. They are streamed, not acknowledged, since by the time
+ *  a retransmission arrives a newer setpoint has usually replaced it.
+ *
+ *  A group is one or more CMD_MOTION frames with the same sequence number:
+ *  an optional timing frame (motor mask 0) holding the bus time to apply
+ *  at, then frames with up to two setpoints each. The last frame has the
+ *  commit flag, and nothing is applied until it arrives. Its motor mask is
+ *  the whole group's, so a group that lost a frame in the middle is
+ *  dropped rather than applied with stale setpoints.
+ *
+ *========================================================================**/
+
+#include <stdint.h>
+
+#include <functional>
+
+#include "command.hpp"
+#include "heartbeat.hpp"
+#include "id.hpp"
+
+namespace comms {
+
+/// @brief The most motors one MCU can be sent motion for
+static constexpr uint8_t kMaxMotionMotors = 8;
+
+/// @brief Exact same memory footprint as the RawCommsMessage Payload (uint64_t)
+struct MotionFramePayload {
+    union {
+        uint64_t raw;
+        struct {
+            CommandType type;   // always CMD_MOTION
+            MCUID targetID;     // the MCU whose motors move
+            uint8_t motorMask;  // the motors of the setpoints, in ascending order, 0 for timing.
+                                // On the commit frame, every motor of the group
+            uint8_t control;    // see the kControl constants
+            union {
+                int16_t setpoints[2];  // one per set bit of motorMask
+                uint32_t applyAtUs;    // timing frames only, the bus time to apply the group at
+            };
+        };
+    };
+
+    /// @brief Set bit i if setpoint i is a velocity, clear if it's a position
+    static constexpr uint8_t kControlVelocityMask = 0x03;
+    static constexpr uint8_t kControlSequenceShift = 2;
+    static constexpr uint8_t kControlSequenceMask = 0x0F;
+    /// @brief Set on the last frame of a group
+    static constexpr uint8_t kControlCommit = 0x40;
+    /// @brief Set on the last frame of a group that started with a timing frame
+    static constexpr uint8_t kControlTimed = 0x80;
+
+    MotionFramePayload() : raw(0) { type = CommandType::CMD_MOTION; }
+
+    /// @brief The sequence number of the group this frame belongs to
+    uint8_t sequence() const { return (control >> kControlSequenceShift) & kControlSequenceMask; }
+
+    /// @brief True on the last frame of a group
+    bool isCommit() const { return (control & kControlCommit) != 0; }
+
+    /// @brief True on the frame holding the time to apply the group at
+    bool isTiming() const { return motorMask == 0; }
+
+    /// @brief The motors whose setpoints this frame holds
+    /// @note The commit frame holds the highest one or two motors of its group's mask, as many as
+    /// are left over after pairing up the others
+    uint8_t frameMotors() const;
+};
+
+/// @brief A set of setpoints to apply at the same moment
+struct MotionSetpoints {
+    uint8_t motorMask;     // the motors that have a setpoint
+    uint8_t velocityMask;  // the motors whose setpoint is a velocity rather than a position
+    int16_t values[kMaxMotionMotors];  // indexed by motor number
+    bool timed;            // true if the sender asked for a time
+    uint32_t applyAtUs;    // if timed, the Clock::micros() of this MCU it was asked for
+
+    /// @brief True if the motor has a setpoint
+    bool has(uint8_t motor) const { return (motorMask >> motor) & 1; }
+
+    /// @brief The type of the motor's setpoint
+    MotorControlCommandType typeOf(uint8_t motor) const {
+        return ((velocityMask >> motor) & 1) ? MC_CMD_VEL : MC_CMD_POS;
+    }
+};
+
+/// @brief Builds the setpoints of one motion command, sent with CommsController::sendMotion
+class MotionCommand {
+   public:
+    /// @brief The most frames a command takes, a timing frame and two setpoints per frame
+    static constexpr uint8_t kMaxFrames = 1 + kMaxMotionMotors / 2;
+
+    /// @brief Constructs an empty command
+    /// @param target The MCU whose motors move
+    explicit MotionCommand(MCUID target);
+
+    /// @brief Sets the setpoint of a motor, replacing an earlier one for the same motor
+    /// @param motor The motor number, below kMaxMotionMotors
+    /// @param type Whether the value is a position or a velocity
+    /// @param value The setpoint, its units are up to the motor driver
+    /// @return The command, so calls can be chained
+    MotionCommand& set(uint8_t motor, MotorControlCommandType type, int16_t value);
+
+    /// @brief Asks for the setpoints to be applied at a bus time rather than on arrival
+    /// @param busTimeUs A bus time from CommsController::busTimeUs(), in the near future
+    /// @return The command, so calls can be chained
+    /// @note Commands for different MCUs at the same bus time move together, within the
+    /// accuracy of the time sync
+    MotionCommand& applyAt(uint32_t busTimeUs);
+
+    /// @brief The MCU whose motors move
+    MCUID target() const { return _target; }
+
+    /// @brief Splits the command into frames
+    /// @param sequence The sequence number of the group, only the low 4 bits are used
+    /// @param frames Where to write the frames, room for kMaxFrames
+    /// @return The number of frames written, 0 if no setpoint was set
+    uint8_t toFrames(uint8_t sequence, MotionFramePayload* frames) const;
+
+   private:
+    MCUID _target;
+    MotionSetpoints _setpoints;
+    uint32_t _applyAtBusUs;
+};
+
+/// @brief Collects the frames of motion groups sent to this MCU, and hands each complete group to
+/// a handler, at the requested time
+class MotionReceiver {
+   public:
+    /// @brief Constructs a receiver
+    /// @param me The ID of this MCU, frames for other MCUs are ignored
+    explicit MotionReceiver(MCUID me);
+
+    /// @brief Sets the function complete groups are handed to
+    void setHandler(std::function<void(const MotionSetpoints&)> handler);
+
+    /// @brief Takes in a motion frame
+    /// @param frame The frame
+    /// @param timeSync Converts the bus time of timed groups to this MCU's clock
+    void handleFrame(const MotionFramePayload& frame, const BusTimeSync& timeSync);
+
+    /// @brief Applies a timed group once its time has come
+    /// @note A timed group is applied by the first tick at or after its time, so a tick that
+    /// runs often keeps the error small
+    void tick();
+
+   private:
+    /// @brief Hands a group to the handler
+    void apply(const MotionSetpoints& setpoints);
+
+    MCUID _me;
+    std::function<void(const MotionSetpoints&)> _handler;
+
+    MotionSetpoints _pending;  // the group being collected
+    bool _collecting;
+    uint8_t _pendingSequence;
+    uint32_t _pendingApplyAtBusUs;
+
+    MotionSetpoints _scheduled;  // a complete timed group waiting for its time
+    bool _hasScheduled;
+};
+
+}  // namespace comms
+
+#endif  // __MOTION_H__
@@ -0,0 +1,87 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <utility>
+
+namespace comms {
+
+/// @brief A bounded, lock-free queue with any number of producers and one consumer
+/// @note Each slot carries a sequence number that says whose turn it is, so producers only contend
+/// on claiming a position, and a producer that stalls after claiming one never blocks the others
+/// from claiming theirs. Nothing is allocated after construction
+/// @tparam T The type of the items, copied in and moved out
+/// @tparam N The capacity, a power of two
+template <typename T, size_t N>
+class MPSCQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "The capacity must be a power of two");
+
+   public:
+    MPSCQueue() : _tail(0), _head(0) {
+        for (size_t i = 0; i < N; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    /// @brief Adds an item, safe to call from any thread
+    /// @return False if the queue is full
+    bool push(const T& item) {
+        size_t position = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[position & (N - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t turn = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+            if (turn == 0) {
+                // the slot is free, try to claim the position
+                if (_tail.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+                    slot.item = item;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (turn < 0) {
+                // the consumer hasn't taken the item a lap ago yet
+                return false;
+            } else {
+                // another producer claimed the position first
+                position = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// @brief Takes the oldest item, only call from the consumer thread
+    /// @return False if the queue is empty, or the next producer hasn't finished writing
+    bool pop(T* item) {
+        Slot& slot = _slots[_head & (N - 1)];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != _head + 1) return false;
+
+        // moved out, so the slot doesn't hold on to what the item owns until it is reused
+        *item = std::move(slot.item);
+        slot.sequence.store(_head + N, std::memory_order_release);
+        _head++;
+        return true;
+    }
+
+   private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::array<Slot, N> _slots;
+    alignas(64) std::atomic<size_t> _tail;  // the next position producers claim
+    alignas(64) size_t _head;               // the next position the consumer takes
+};
+
+}  // namespace comms
+
+#endif  // __MPSC_QUEUE_H__
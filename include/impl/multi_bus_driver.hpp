@@ -0,0 +1,102 @@
+#ifndef __MULTI_BUS_DRIVER_H__
+#define __MULTI_BUS_DRIVER_H__
+
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+
+#include "comms_driver.hpp"
+#include "id.hpp"
+
+namespace comms {
+
+/// @brief How a MultiBusDriver spreads traffic over its buses
+enum MultiBusPolicy : uint8_t {
+    MBP_SPLIT,      // each message class goes to its own bus, failing over to another when it's down
+    MBP_REDUNDANT,  // every message goes to every healthy bus, duplicates are dropped on receive
+};
+
+/// @brief A CommsDriver that drives several buses at once, e.g. CAN1, CAN2 and CAN3 on a Teensy 4.1
+/// @note The underlying drivers are owned by the caller, and installed/uninstalled through this one
+class MultiBusDriver final : public CommsDriver {
+   public:
+    /// @brief The most buses a MultiBusDriver can drive
+    static constexpr size_t kMaxBuses = 8;
+
+    /// @brief Constructs a MultiBusDriver over the given buses
+    /// @param buses The drivers for each bus, the first one is the primary bus
+    /// @param policy How traffic is spread over the buses
+    MultiBusDriver(std::vector<CommsDriver*> buses, MultiBusPolicy policy);
+
+    /// @brief Installs every underlying driver
+    void install() override;
+
+    /// @brief Uninstalls every underlying driver
+    void uninstall() override;
+
+    /// @brief Sends a message according to the policy
+    /// @param message The message to send
+    /// @note In MBP_SPLIT the message goes to the bus routed for its content type, or the next
+    /// healthy one. In MBP_REDUNDANT it goes to every healthy bus
+    void sendMessage(const RawCommsMessage& message) override;
+
+    /// @brief Receives a message from whichever bus has one, round-robin
+    /// @param res The received message
+    /// @return True if a message was received, false if no bus had one
+    /// @note In MBP_REDUNDANT, copies of a frame already received on another bus are dropped
+    bool receiveMessage(RawCommsMessage* res) override;
+
+    /// @brief Reports the best state of any bus, traffic keeps flowing while one is active
+    BusState busState() override;
+
+    /// @brief Routes a content type to a specific bus, used by MBP_SPLIT
+    /// @param type The content type to route
+    /// @param busIndex The index of the bus in the list given at construction
+    /// @note By default every content type is routed to the primary bus
+    void setRoute(MessageContentType type, uint8_t busIndex);
+
+    /// @brief Sets how long after a frame arrives its copies on other buses are dropped
+    /// @param windowMs The duplicate suppression window in milliseconds
+    void setDuplicateWindow(uint32_t windowMs);
+
+    /// @brief Checks if a bus is usable, i.e. not bus-off
+    /// @param busIndex The index of the bus to check
+    bool isBusHealthy(uint8_t busIndex);
+
+   private:
+    /// @brief A frame recently delivered, remembered for duplicate suppression
+    struct RecentFrame {
+        uint32_t id;
+        uint8_t length;
+        uint64_t payload;
+        uint32_t seenTime;
+        uint8_t busMask;  // which buses this copy of the frame has been seen on
+        bool valid;
+    };
+
+    /// @brief Picks the bus a message should go out on in MBP_SPLIT
+    uint8_t pickBus(const RawCommsMessage& message);
+
+    /// @brief Checks if a frame is a copy of one already delivered from another bus
+    bool isDuplicate(const RawCommsMessage& message, uint8_t busIndex);
+
+    std::vector<CommsDriver*> _buses;
+    MultiBusPolicy _policy;
+
+    /// @brief Maps a MessageContentType to a bus index
+    std::array<uint8_t, kNumMessageContentTypes> _routes;
+
+    /// @brief The last known health of each bus, to report failovers once
+    std::array<bool, kMaxBuses> _healthy;
+
+    uint8_t _nextRxBus;
+
+    std::array<RecentFrame, 32> _recent;
+    uint8_t _recentHead;
+    uint32_t _duplicateWindowMs;
+};
+
+}  // namespace comms
+
+#endif  // __MULTI_BUS_DRIVER_H__
@@ -21,6 +21,8 @@ class Option {
     /// @note This means the Option does not contain a value
     Option() : _hasValue(false) {}
 
+    Option(const Option<T>& other) = default;
+
     Option<T> operator=(const Option<T>& other) {
         _value = other._value;
         _hasValue = other._hasValue;
@@ -0,0 +1,94 @@
+#ifndef __OUTBOX_H__
+#define __OUTBOX_H__
+
+#include <stdint.h>
+
+#include <array>
+
+#include "comms_driver.hpp"
+#include "profile.hpp"
+
+namespace comms {
+
+/// @brief A CommsDriver that collects outgoing messages and hands them to another driver in one
+/// batch, everything else passes straight through
+/// @note The CommsController gives one to all of its managers and flushes it once per tick. It is
+/// final so the managers' sends are plain, inlinable stores into the queue
+class MessageOutbox final : public CommsDriver {
+   public:
+    /// @brief The most messages held before the outbox flushes on its own
+    static constexpr size_t kCapacity = 32;
+
+    /// @brief Constructs an outbox in front of a driver
+    /// @param inner The driver that actually talks to the bus
+    explicit MessageOutbox(CommsDriver* inner) : _inner(inner), _count(0) {}
+
+    void install() override { _inner->install(); }
+
+    void uninstall() override {
+        flush();
+        _inner->uninstall();
+    }
+
+    /// @brief Queues a message for the next flush
+    void sendMessage(const RawCommsMessage& message) override {
+        if (_count == kCapacity) flush();
+        _messages[_count++] = message;
+    }
+
+    /// @brief Queues a batch of messages for the next flush
+    size_t sendMessages(const RawCommsMessage* messages, size_t count) override {
+        for (size_t i = 0; i < count; i++) {
+            sendMessage(messages[i]);
+        }
+        return count;
+    }
+
+    bool receiveMessage(RawCommsMessage* res) override { return _inner->receiveMessage(res); }
+
+    size_t receiveMessages(RawCommsMessage* messages, size_t capacity) override {
+        return _inner->receiveMessages(messages, capacity);
+    }
+
+    bool supportsFD() const override { return _inner->supportsFD(); }
+
+    uint8_t maxPayloadLength() const override { return _inner->maxPayloadLength(); }
+
+    /// @brief Sends an FD message right away, after what is already queued so order is kept
+    bool sendFDMessage(const RawCommsFDMessage& message) override {
+        flush();
+        return _inner->sendFDMessage(message);
+    }
+
+    bool receiveFDMessage(RawCommsFDMessage* message) override {
+        return _inner->receiveFDMessage(message);
+    }
+
+    BusState busState() override { return _inner->busState(); }
+
+    /// @brief Hands every queued message to the inner driver in one call
+    void flush() { flushTo(*_inner); }
+
+    /// @brief Hands every queued message to a driver in one call
+    /// @param driver The driver to send on, when its type is final the call is resolved at compile
+    /// time
+    template <typename Driver>
+    void flushTo(Driver& driver) {
+        if (_count == 0) return;
+        COMMS_PROFILE_ZONE(PZ_DRIVER_TX);
+        driver.sendMessages(_messages.data(), _count);
+        _count = 0;
+    }
+
+    /// @brief The number of messages waiting for the next flush
+    size_t pending() const { return _count; }
+
+   private:
+    CommsDriver* _inner;
+    std::array<RawCommsMessage, kCapacity> _messages;
+    size_t _count;
+};
+
+}  // namespace comms
+
+#endif  // __OUTBOX_H__
@@ -0,0 +1,178 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+/**========================================================================
+ *                             profile.hpp
+ *
+ *  Profiling zones for the hot path, built with -DCOMMS_PROFILE.
+ *  Each zone times its scope in CPU cycles: the DWT cycle counter on
+ *  Teensy, rdtsc on x86 hosts and std::chrono::steady_clock elsewhere.
+ *  Nothing is printed while profiling, durations only go into per-zone
+ *  histograms, so the timing of the loop stays what it is without it.
+ *  Without COMMS_PROFILE, COMMS_PROFILE_ZONE compiles to nothing.
+ *
+ *========================================================================**/
+
+#ifdef COMMS_PROFILE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace comms {
+
+/// @brief The parts of the loop that are timed
+/// @note Zones nest, e.g. PZ_DISPATCH runs inside PZ_DRIVER_RX inside PZ_TICK, and each counts
+/// everything that runs inside it
+enum ProfileZone : uint8_t {
+    PZ_TICK,             // a whole tick(), budgeted or not
+    PZ_DRIVER_RX,        // receiving frames from the driver, and dispatching them
+    PZ_DRIVER_TX,        // handing the tick's frames to the driver
+    PZ_DISPATCH,         // handling one received message
+    PZ_SENSOR_READ,      // starting or collecting a sensor conversion
+    PZ_SENSOR_STREAMS,   // running the sensor datastreams
+    PZ_COMMANDS,         // the command manager's tick: retransmissions, starts, completions
+    PZ_COMMAND_HANDLER,  // a CommandHandler's start, update, progress or end
+    PZ_HEARTBEATS,       // sending and checking heartbeats
+    PZ_ERRORS,           // the error manager's tick
+    PZ_TRANSPORT,        // the segmented transport's tick
+    PZ_SNAPSHOT,         // publishing sensor values to snapshots
+    PZ_USER_0,           // free for the application
+    PZ_USER_1,           // free for the application
+    PZ_COUNT
+};
+
+/// @brief Gets the name of a zone, for reports
+const char* profileZoneName(ProfileZone zone);
+
+/// @brief What the timings of a zone added up to, in cycles
+struct ProfileZoneStats {
+    uint32_t count;
+    uint64_t totalCycles;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint32_t p99Cycles;  // an upper bound, within 25% of the true 99th percentile
+
+    /// @brief The mean time the zone took, in cycles
+    uint32_t meanCycles() const {
+        return count == 0 ? 0 : static_cast<uint32_t>(totalCycles / count);
+    }
+};
+
+/// @brief Collects the timings of every zone
+/// @note Durations go into a histogram with four buckets per power of two, so the p99 estimate
+/// costs a fixed 500 bytes per zone and no sorting. Zones must only be entered from the thread
+/// that ticks the controller
+class Profiler {
+   public:
+    /// @brief Reads the cycle counter
+    static inline uint32_t cycles();
+
+    /// @brief Starts the cycle counter where it has to be, and on hosts measures its rate
+    /// @note Called by the first zone, call it up front to keep the measuring out of the loop
+    static void initialize();
+
+    /// @brief How many cycles the counter counts per microsecond
+    static float cyclesPerUs();
+
+    /// @brief Converts cycles to microseconds
+    static float toUs(uint32_t cycles) { return cycles / cyclesPerUs(); }
+
+    /// @brief Adds a timing to a zone
+    static void record(ProfileZone zone, uint32_t cycles);
+
+    /// @brief Gets what the timings of a zone added up to since the last reset()
+    static ProfileZoneStats stats(ProfileZone zone);
+
+    /// @brief Forgets every timing
+    static void reset();
+
+    /// @brief Writes a table of every zone that ran, in microseconds
+    /// @param buffer Where to write it, e.g. to hand to Serial.print
+    /// @param size The size of the buffer, the table is cut short if it doesn't fit
+    /// @return The length of the table
+    static size_t format(char* buffer, size_t size);
+
+   private:
+    static constexpr size_t kNumBuckets = 124;
+
+    struct Zone {
+        uint32_t count;
+        uint64_t totalCycles;
+        uint32_t minCycles;
+        uint32_t maxCycles;
+        std::array<uint32_t, kNumBuckets> buckets;
+    };
+
+    /// @brief The bucket a duration falls in
+    static size_t bucketOf(uint32_t cycles);
+
+    /// @brief The largest duration that falls in a bucket
+    static uint32_t bucketUpperBound(size_t bucket);
+
+    static std::array<Zone, PZ_COUNT> _zones;
+    static bool _initialized;
+};
+
+/// @brief Times its scope into a zone, use COMMS_PROFILE_ZONE rather than this
+class ProfileScope {
+   public:
+    explicit ProfileScope(ProfileZone zone) : _zone(zone), _start(Profiler::cycles()) {}
+    ~ProfileScope() { Profiler::record(_zone, Profiler::cycles() - _start); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+   private:
+    ProfileZone _zone;
+    uint32_t _start;
+};
+
+}  // namespace comms
+
+#if defined(ARDUINO) && defined(ARM_DWT_CYCCNT)
+// Teensy, the core maps the DWT registers, initialize() starts the counter
+inline uint32_t comms::Profiler::cycles() {
+    return ARM_DWT_CYCCNT;
+}
+#elif !defined(ARDUINO) && (defined(__x86_64__) || defined(__i386__))
+inline uint32_t comms::Profiler::cycles() {
+    // only differences are taken, so the low half is enough for zones under a second
+    return static_cast<uint32_t>(__rdtsc());
+}
+#elif !defined(ARDUINO)
+inline uint32_t comms::Profiler::cycles() {
+    // a "cycle" is a nanosecond here
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+#else
+inline uint32_t comms::Profiler::cycles() {
+    // no cycle counter, a "cycle" is a microsecond here
+    return ::micros();
+}
+#endif
+
+#define __COMMS_PROFILE_CONCAT_HELPER(a, b) a##b
+#define __COMMS_PROFILE_CONCAT(a, b) __COMMS_PROFILE_CONCAT_HELPER(a, b)
+
+/// @brief Times the rest of the enclosing scope into a zone
+#define COMMS_PROFILE_ZONE(zone) \
+    ::comms::ProfileScope __COMMS_PROFILE_CONCAT(__comms_profile_scope_, __LINE__)(zone)
+
+#else  // COMMS_PROFILE
+
+#define COMMS_PROFILE_ZONE(zone) (void)0
+
+#endif  // COMMS_PROFILE
+
+#endif  // __PROFILE_H__
@@ -2,30 +2,176 @@
 #ifndef __SENSOR_H__
 #define __SENSOR_H__
 
+#include <array>
 #include <cstdint>
 #include <functional>
 #include <memory>
 
-#include "comms_driver.hpp"
 #include "id.hpp"
 #include "option.hpp"
+#include "outbox.hpp"
 #include "result.hpp"
 
 namespace comms {
 
+/// @brief Flags carried alongside a sensor reading, describing how the payload should be decoded
+enum SensorMessageFlags : uint8_t {
+    SMF_NONE = 0,
+    SMF_KEEPALIVE = 1 << 0,  // nothing new, the stream is still alive
+    SMF_DELTA = 1 << 1,      // the payload carries a quantized delta against the last value sent
+    SMF_ENVELOPE = 1 << 2,   // the value is a maximum, the delta slot holds the span to the minimum
+};
+
 /// @brief A payload for a message representing some sensor information
 /// This is sent from the MCU that manages the sensor, to the bus
+/// @note A full frame keeps the layout of firmware from before the flags, which reads its value
+/// and ID, and sent the flags and delta bytes as 0. On classic CAN, keep-alives and deltas go out
+/// as shorter compact frames instead: the ID, the flags, then the delta
 struct SensorMessagePayload {
     union {
         /// @brief The raw representation of the payload
         /// This is a 64-bit value that contains the sensor value and its ID
         uint64_t raw;
         struct {
-            /// @brief The sensor value and ID
-            float value;       // 4 bytes
+            float value;       // 4 bytes, what the receiver should hold after the frame
             uint8_t sensorID;  // 1 byte
+            uint8_t flags;     // 1 byte, SensorMessageFlags low, the delta exponent high
+            int16_t delta;     // 2 bytes, the delta, or for SMF_ENVELOPE the span as a half float
         };
     };
+
+    /// @brief The number of bytes used by a full frame, any shorter frame is compact
+    static constexpr uint8_t kFullLength = 8;
+
+    /// @brief The number of bytes used by a compact frame carrying a delta
+    static constexpr uint8_t kDeltaLength = 4;
+
+    /// @brief The number of bytes used by a compact keep-alive frame
+    static constexpr uint8_t kKeepAliveLength = 2;
+
+    /// @brief Packs the ID, flags and delta into the layout of a compact frame
+    uint64_t compactRaw() const;
+
+    /// @brief Reads a frame of either layout, a compact frame has no value
+    /// @param bits The payload of the frame
+    /// @param length The length of the frame
+    static SensorMessagePayload fromFrame(uint64_t bits, uint8_t length);
+
+    /// @brief Gets the exponent of the delta resolution, a delta step is 2^exponent
+    int8_t deltaExponent() const { return static_cast<int8_t>(flags & 0xF0) >> 4; }
+
+    /// @brief Sets the exponent of the delta resolution, clamped to [-8, 7]
+    void setDeltaExponent(int8_t exponent) {
+        if (exponent < -8) exponent = -8;
+        if (exponent > 7) exponent = 7;
+        flags = (flags & 0x0F) | static_cast<uint8_t>((exponent & 0x0F) << 4);
+    }
+
+    /// @brief Gets the span of an envelope frame, the minimum is value - span
+    float envelopeSpan() const;
+
+    /// @brief Sets the span of an envelope frame
+    /// @param span The distance from the minimum to the maximum, stored as a half float rounded up
+    /// so the decoded envelope always contains the real one
+    void setEnvelopeSpan(float span);
+};
+
+/// @brief How a datastream decides whether a new reading differs enough from the last one sent
+enum SensorDeadbandMode : uint8_t {
+    SDM_NONE,      // every reading is sent
+    SDM_ABSOLUTE,  // send when |value - last| > deadband
+    SDM_RELATIVE,  // send when |value - last| > deadband * |last|
+};
+
+/// @brief Describes when a SensorDatastream puts a reading on the bus
+/// @note The datastream still reads the sensor every update period, the policy only decides what
+/// gets sent. Keep-alives and deltas go out as compact frames on classic CAN, which receivers on
+/// firmware from before them misread, so only enable them once every receiver is updated
+struct SensorTransmissionPolicy {
+    SensorDeadbandMode deadbandMode;
+    float deadband;          // absolute units, or a fraction of the last value for SDM_RELATIVE
+    uint32_t minIntervalMs;  // never send changed values faster than this
+    uint32_t maxIntervalMs;  // the longest gap between keep-alives, or with deltas full values
+    bool deltaEncoding;      // send changes as a quantized delta when it fits
+    int8_t deltaExponent;    // a delta step is 2^deltaExponent, in [-8, 7]
+
+    /// @brief Sends every reading, the behaviour of a datastream without a policy
+    static SensorTransmissionPolicy periodic() {
+        return SensorTransmissionPolicy{SDM_NONE, 0.0f, 0, 0, false, 0};
+    }
+
+    /// @brief Sends only when the value moves by more than an absolute deadband
+    /// @param deadband The absolute change needed before a new value is sent
+    /// @param maxIntervalMs How long the stream may be quiet before a keep-alive is sent
+    static SensorTransmissionPolicy absoluteDeadband(float deadband, uint32_t maxIntervalMs) {
+        return SensorTransmissionPolicy{SDM_ABSOLUTE, deadband, 0, maxIntervalMs, false, 0};
+    }
+
+    /// @brief Sends only when the value moves by more than a fraction of the last value sent
+    /// @param fraction The relative change needed before a new value is sent (0.01 is 1%)
+    /// @param maxIntervalMs How long the stream may be quiet before a keep-alive is sent
+    static SensorTransmissionPolicy relativeDeadband(float fraction, uint32_t maxIntervalMs) {
+        return SensorTransmissionPolicy{SDM_RELATIVE, fraction, 0, maxIntervalMs, false, 0};
+    }
+};
+
+/// @brief How the samples taken in one update period are reduced to the value that is sent
+enum SensorFilterType : uint8_t {
+    SFT_LATEST,   // the most recent sample
+    SFT_MEAN,     // the mean of the samples taken in the update period
+    SFT_MIN_MAX,  // the envelope of the samples taken in the update period
+    SFT_FIR,      // a FIR low-pass over the most recent samples
+    SFT_IIR,      // a first order IIR low-pass over every sample
+};
+
+/// @brief Configures the sampling stage of a SensorDatastream, which reads the sensor faster than
+/// it transmits, so the sent value isn't aliased
+struct SensorSamplingConfig {
+    /// @brief The number of samples kept for SFT_LATEST and SFT_FIR, and the most FIR taps
+    static constexpr uint8_t kRingSize = 16;
+
+    uint32_t samplePeriodUs;  // how often to sample, 0 samples once per transmission
+    SensorFilterType filter;
+    float iirAlpha;  // SFT_IIR: y += alpha * (x - y)
+    uint8_t firTapCount;
+    std::array<float, kRingSize> firTaps;  // SFT_FIR: taps[0] weighs the newest sample, unit gain
+
+    /// @brief Reads the sensor once per transmission, the behaviour of a datastream without sampling
+    static SensorSamplingConfig none() {
+        return SensorSamplingConfig{0, SFT_LATEST, 0.0f, 0, {}};
+    }
+
+    /// @brief Sends the mean of the samples taken in each update period
+    /// @param samplePeriodUs How often to sample, in microseconds
+    static SensorSamplingConfig mean(uint32_t samplePeriodUs) {
+        return SensorSamplingConfig{samplePeriodUs, SFT_MEAN, 0.0f, 0, {}};
+    }
+
+    /// @brief Sends the minimum and maximum of the samples taken in each update period
+    /// @param samplePeriodUs How often to sample, in microseconds
+    static SensorSamplingConfig minMax(uint32_t samplePeriodUs) {
+        return SensorSamplingConfig{samplePeriodUs, SFT_MIN_MAX, 0.0f, 0, {}};
+    }
+
+    /// @brief Sends the output of a first order IIR low-pass run on every sample
+    /// @param samplePeriodUs How often to sample, in microseconds
+    /// @param alpha The smoothing factor in (0, 1], smaller is smoother
+    static SensorSamplingConfig iir(uint32_t samplePeriodUs, float alpha) {
+        return SensorSamplingConfig{samplePeriodUs, SFT_IIR, alpha, 0, {}};
+    }
+
+    /// @brief Sends the output of a FIR low-pass over the most recent samples
+    /// @param samplePeriodUs How often to sample, in microseconds
+    /// @param taps The filter taps, newest sample first, normalized to unit gain when applied
+    /// @param tapCount The number of taps, at most kRingSize
+    static SensorSamplingConfig fir(uint32_t samplePeriodUs, const float* taps, uint8_t tapCount) {
+        SensorSamplingConfig config{samplePeriodUs, SFT_FIR, 0.0f, 0, {}};
+        config.firTapCount = tapCount < kRingSize ? tapCount : kRingSize;
+        for (uint8_t i = 0; i < config.firTapCount; i++) {
+            config.firTaps[i] = taps[i];
+        }
+        return config;
+    }
 };
 
 /// @brief An abstract class for handling sensors
@@ -80,39 +226,227 @@ class LambdaSensor : public Sensor {
     std::function<void()> _cleanup;
 };
 
+/// @brief The state of a split-phase sensor conversion
+enum SensorConversionState : uint8_t {
+    SCS_IDLE,    // no conversion has been started
+    SCS_BUSY,    // a conversion is in flight
+    SCS_READY,   // a result is waiting to be collected
+    SCS_FAILED,  // the conversion failed, collect() returns to idle
+};
+
+/// @brief An abstract class for sensors that are read in two phases, so slow peripherals (I2C, SPI,
+/// ADCs) don't block the loop while they convert
+class AsyncSensor {
+   public:
+    /// @brief Initializes the sensor
+    /// @return True if initialization was successful, false otherwise
+    virtual bool initialize() = 0;
+
+    /// @brief Starts a conversion, this must return without waiting for the result
+    /// @return True if a conversion was started, false if the sensor can't start one right now
+    virtual bool startConversion() = 0;
+
+    /// @brief Checks on the conversion started last
+    virtual SensorConversionState poll() = 0;
+
+    /// @brief Collects the result of a finished conversion, and returns the sensor to idle
+    /// @return The sensor value, only meaningful when poll() returned SCS_READY
+    virtual float collect() = 0;
+
+    /// @brief Cleans up the sensor
+    virtual void cleanup() = 0;
+
+    virtual ~AsyncSensor() = default;
+};
+
+/// @brief An AsyncSensor for peripherals that report completion through a callback or interrupt
+/// @note Implement beginConversion() to kick off the transfer, and call complete() or fail() from
+/// the completion callback. Both are safe to call from an interrupt.
+class SignalledAsyncSensor : public AsyncSensor {
+   public:
+    bool startConversion() override {
+        if (_state == SCS_BUSY) return false;
+        _state = SCS_BUSY;
+        if (!beginConversion()) {
+            _state = SCS_IDLE;
+            return false;
+        }
+        return true;
+    }
+
+    SensorConversionState poll() override { return _state; }
+
+    float collect() override {
+        _state = SCS_IDLE;
+        return _value;
+    }
+
+   protected:
+    /// @brief Starts the transfer
+    /// @return True if the transfer was started, false otherwise
+    virtual bool beginConversion() = 0;
+
+    /// @brief Reports a finished conversion
+    /// @param value The sensor value
+    void complete(float value) {
+        _value = value;
+        _state = SCS_READY;
+    }
+
+    /// @brief Reports a failed conversion
+    void fail() { _state = SCS_FAILED; }
+
+   private:
+    volatile SensorConversionState _state = SCS_IDLE;
+    volatile float _value = 0.0f;
+};
+
+/// @brief Adapts a blocking Sensor to the AsyncSensor interface
+/// @note The read is deferred to poll(), so it happens when the datastream wants the value rather
+/// than when the conversion was requested
+class SyncSensorAdapter : public AsyncSensor {
+   public:
+    /// @brief Constructs an adapter around a blocking sensor
+    /// @param sensor The sensor to read
+    explicit SyncSensorAdapter(std::shared_ptr<Sensor> sensor)
+        : _sensor(std::move(sensor)), _state(SCS_IDLE), _value(0.0f) {}
+
+    bool initialize() override { return _sensor->initialize(); }
+
+    bool startConversion() override {
+        _state = SCS_BUSY;
+        return true;
+    }
+
+    SensorConversionState poll() override {
+        if (_state == SCS_BUSY) {
+            _value = _sensor->read();
+            _state = SCS_READY;
+        }
+        return _state;
+    }
+
+    float collect() override {
+        _state = SCS_IDLE;
+        return _value;
+    }
+
+    void cleanup() override { _sensor->cleanup(); }
+
+   private:
+    std::shared_ptr<Sensor> _sensor;
+    SensorConversionState _state;
+    float _value;
+};
+
 /// @brief Sends sensor readings periodically over the comms bus
 class SensorDatastream {
    public:
     SensorDatastream();
 
     /// @brief Constructs a SensorDatastream with the given parameters
-    /// @param driver The communication driver to use for sending messages
+    /// @param driver The outbox to send messages through, the controller flushes it to the bus
     /// @param sender The ID of the MCU sending the sensor data
-    /// @param updateRateMs The rate at which to send sensor updates
+    /// @param updateRateMs The rate at which to read the sensor and evaluate the policy
     /// @param id The ID of the sensor
     /// @param sensor The sensor object to read data from
-    SensorDatastream(CommsDriver* driver, MCUID sender, uint32_t updateRateMs, uint8_t id,
-                     std::shared_ptr<Sensor> sensor);
+    /// @param policy Decides which readings are sent, defaults to sending every reading
+    SensorDatastream(MessageOutbox* driver, MCUID sender, uint32_t updateRateMs, uint8_t id,
+                     std::shared_ptr<Sensor> sensor,
+                     SensorTransmissionPolicy policy = SensorTransmissionPolicy::periodic());
+
+    /// @brief Constructs a SensorDatastream around a split-phase sensor
+    /// @note Conversions are pipelined, each transmission uses the latest completed sample
+    SensorDatastream(MessageOutbox* driver, MCUID sender, uint32_t updateRateMs, uint8_t id,
+                     std::shared_ptr<AsyncSensor> sensor,
+                     SensorTransmissionPolicy policy = SensorTransmissionPolicy::periodic());
 
     /// @brief Initializes the sensor datastream
     void initialize();
 
     /// @brief Ticks the sensor datastream, sending data if it's time to do so
-    /// @note This will read the sensor value and send it over the communication bus
+    /// @note This will read the sensor value and send it over the communication bus if the
+    /// transmission policy allows it
     void tick();
 
+    /// @brief Does the work of tick(), but hands the message back instead of sending it
+    /// @param message Set to the message to send
+    /// @return True if there is a message to send, false otherwise
+    /// @note Used to pack several datastreams into one CAN FD frame
+    bool poll(RawCommsMessage* message);
+
     /// @brief Sets the status of the sensor datastream
     /// @param enabled True to enable the datastream, false to disable it
     void setStatus(bool enabled);
 
+    /// @brief Sets the transmission policy of the datastream
+    /// @param policy The new policy, the next reading is always sent in full
+    void setPolicy(SensorTransmissionPolicy policy);
+
+    /// @brief Sets up the sampling stage of the datastream
+    /// @param sampling How often to sample, and how to reduce the samples before sending
+    void setSampling(SensorSamplingConfig sampling);
+
+    /// @brief How long ago the next reading was due, negative if it isn't due yet
+    /// @return The lateness in milliseconds
+    int32_t overdueMs() const;
+
+    /// @brief True if enabled and a reading is due, so the next tick() or poll() reads the sensor
+    bool isDue() const { return _enabled && overdueMs() >= 0; }
+
    private:
-    CommsDriver* _driver;
+    /// @brief The result of reducing the samples taken in one update period
+    struct Reading {
+        float value;
+        float min;
+        float max;
+        bool isEnvelope;
+    };
+
+    /// @brief Takes a sample if the sampling stage is enabled and one is due
+    void sample();
+
+    /// @brief Starts a conversion unless one is already in flight
+    void startConversion();
+
+    /// @brief Feeds the result of the conversion in flight into the samples, if it has finished
+    void collectConversion();
+
+    /// @brief Feeds one sample into the ring and the filter state
+    void pushSample(float value);
+
+    /// @brief Reduces the samples taken in the update period and starts a new one
+    /// @note If no conversion finished in the period, the latest completed sample is held
+    Reading reduce();
+
+    /// @brief Checks if a reading differs enough from the last value sent to be worth sending
+    bool exceedsDeadband(float value) const;
+
+    MessageOutbox* _driver;
     MCUID _sender;
-    std::shared_ptr<Sensor> _sensorPtr;
+    std::shared_ptr<AsyncSensor> _sensorPtr;
     bool _enabled;
+    bool _converting;  // is a conversion in flight?
     uint32_t _updateRateMs;
     uint8_t _id;
+    uint32_t _lastReadTime;
     uint32_t _lastSendTime;
+    uint32_t _lastFullSendTime;  // when a frame carrying the value last went out
+
+    SensorSamplingConfig _sampling;
+    uint32_t _lastSampleTime;
+    std::array<float, SensorSamplingConfig::kRingSize> _ring;
+    uint8_t _ringHead;   // where the next sample goes
+    uint8_t _ringCount;  // how many samples the ring holds
+    uint32_t _blockCount;  // samples taken in the current update period
+    float _blockSum;
+    float _blockMin;
+    float _blockMax;
+    float _iirState;
+
+    SensorTransmissionPolicy _policy;
+    bool _hasSent;         // has a full value been sent since the policy was set?
+    float _lastSentValue;  // the value the receiver reconstructed from what we sent
 };
 
 /// @brief Status decoded from a sensor message
@@ -120,6 +454,16 @@ struct SensorStatus {
     MCUID sender;
     uint8_t sensorID;
     float value;
+    float min;  // the envelope of the last reading, equal to value unless the sender sends envelopes
+    float max;
+    uint32_t lastUpdateTime;  // when any frame, including a keep-alive, was last received
+    uint32_t sampleTimeUs;    // Clock::micros() when the value last changed
+};
+
+/// @brief The range a sensor covered between two transmissions
+struct SensorEnvelope {
+    float min;
+    float max;
 };
 
 }  // namespace comms
@@ -0,0 +1,88 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+
+#include "id.hpp"
+#include "sensor.hpp"
+
+namespace comms {
+
+/// @brief Names one sensor of one node
+struct SensorKey {
+    MCUID sender;
+    uint8_t sensorID;
+};
+
+/// @brief A caller-provided, structure-of-arrays buffer that a snapshot is copied into
+/// @note Entry i of every array belongs to the same sensor, so control code can run plain loops
+/// over values and sampleTimesUs that the compiler can vectorize
+struct SensorSnapshot {
+    uint8_t* sensorIDs;       // may be nullptr if the caller doesn't need them
+    float* values;            // NaN for a sensor of a group that hasn't been heard from
+    uint32_t* sampleTimesUs;  // Clock::micros() when each value arrived, 0 if it hasn't
+    size_t capacity;          // the room in each array
+    size_t count;             // set by the snapshot, the number of entries filled in
+    uint32_t version;         // set by the snapshot, equal versions mean no sample arrived between
+};
+
+/// @brief Storage for a SensorSnapshot of up to N sensors
+template <size_t N>
+struct SensorSnapshotBuffer {
+    alignas(16) float values[N];
+    alignas(16) uint32_t sampleTimesUs[N];
+    uint8_t sensorIDs[N];
+
+    /// @brief Gets a snapshot that fills this buffer
+    SensorSnapshot view() { return SensorSnapshot{sensorIDs, values, sampleTimesUs, N, 0, 0}; }
+};
+
+/// @brief The latest value of every received sensor, published once per tick behind a seqlock
+/// @note One writer, the controller's tick(), and any number of readers in other threads or
+/// interrupts. Readers never block the writer. They retry a few times if a publish is in progress,
+/// and give up rather than spin, since an interrupt can't wait for the code it interrupted
+class SensorSnapshotTable {
+   public:
+    /// @brief The most sensors the table holds, across all nodes
+    static constexpr size_t kCapacity = 64;
+
+    /// @brief How many times a reader retries before giving up
+    static constexpr uint8_t kMaxRetries = 4;
+
+    SensorSnapshotTable();
+
+    /// @brief Replaces the published values
+    /// @param statuses The current sensor statuses, only the first kCapacity are published
+    /// @param count The number of statuses
+    void publish(const SensorStatus* statuses, size_t count);
+
+    /// @brief Copies every sensor of a node, in the order they were first received
+    /// @return True if the copy is consistent, false if the writer kept publishing during it
+    /// @note Sensors past the capacity of the snapshot are left out
+    bool readNode(MCUID sender, SensorSnapshot* out) const;
+
+    /// @brief Copies a group of sensors, in the order given
+    /// @return True if the copy is consistent, false if the writer kept publishing during it
+    bool readGroup(const SensorKey* sensors, size_t count, SensorSnapshot* out) const;
+
+   private:
+    /// @brief Finds a sensor in the table, kCapacity if it isn't there
+    size_t find(SensorKey key, size_t count) const;
+
+    std::atomic<uint32_t> _sequence;  // odd while a publish is in progress
+    std::atomic<uint32_t> _count;
+    // each field is atomic so readers racing the writer are well defined, relaxed loads and stores
+    // compile to plain ones, the sequence number orders them
+    std::array<std::atomic<uint8_t>, kCapacity> _senders;
+    std::array<std::atomic<uint8_t>, kCapacity> _sensorIDs;
+    std::array<std::atomic<float>, kCapacity> _values;
+    std::array<std::atomic<uint32_t>, kCapacity> _sampleTimesUs;
+};
+
+}  // namespace comms
+
+#endif  // __SNAPSHOT_H__
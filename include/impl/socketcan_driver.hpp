@@ -0,0 +1,155 @@
+#ifndef __SOCKETCAN_DRIVER_H__
+#define __SOCKETCAN_DRIVER_H__
+
+/**========================================================================
+ *                           socketcan_driver.hpp
+ *
+ *  A CommsDriver for Linux SocketCAN interfaces (can0, vcan0, USB-CAN
+ *  adapters). Frames are moved in batches with recvmmsg/sendmmsg, so the
+ *  syscall cost is paid once per batch rather than once per frame.
+ *
+ *  Sent frames are queued and flushed when the queue fills up, when the
+ *  driver is polled for received frames, or when flush() is called.
+ *
+ *========================================================================**/
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <linux/can.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+#include "comms_driver.hpp"
+#include "id.hpp"
+
+namespace comms {
+
+/// @brief Configures a SocketCANDriver
+struct SocketCANConfig {
+    bool fd;                      // enable CAN FD frames on the socket
+    bool filterFromMessageTable;  // only let the kernel deliver IDs this MCU listens to
+    bool timestamps;              // ask for hardware, or failing that software, RX timestamps
+    uint16_t batchSize;           // the most frames moved by one recvmmsg/sendmmsg call
+
+    /// @brief Classic frames, kernel filters and timestamps on, batches of 32 frames
+    static SocketCANConfig defaults() { return SocketCANConfig{false, true, true, 32}; }
+};
+
+/// @brief A CommsDriver on a Linux SocketCAN raw socket
+class SocketCANDriver final : public CommsDriver {
+   public:
+    /// @brief Constructs a driver for a CAN interface, the socket is opened by install()
+    /// @param interfaceName The interface to bind to, e.g. "can0" or "vcan0"
+    /// @param me The ID of this MCU, used to build the kernel filters
+    /// @param config The socket options
+    SocketCANDriver(std::string interfaceName, MCUID me,
+                    SocketCANConfig config = SocketCANConfig::defaults());
+
+    /// @brief Constructs a driver over a socket that is already open, e.g. one end of a
+    /// socketpair(AF_UNIX, SOCK_SEQPACKET) standing in for a CAN interface in tests
+    /// @param socketFd The socket, owned by the driver from now on
+    /// @param config The socket options, filters and timestamps are skipped for non-CAN sockets
+    explicit SocketCANDriver(int socketFd, SocketCANConfig config = SocketCANConfig::defaults());
+
+    ~SocketCANDriver();
+
+    SocketCANDriver(const SocketCANDriver&) = delete;
+    SocketCANDriver& operator=(const SocketCANDriver&) = delete;
+
+    /// @brief Opens and configures the socket, and registers it with epoll
+    void install() override;
+
+    /// @brief Flushes queued frames and closes the socket
+    void uninstall() override;
+
+    /// @brief Queues a frame, sending the queue if it is full
+    void sendMessage(const RawCommsMessage& message) override;
+
+    /// @brief Takes the next received frame, reading a new batch from the socket when needed
+    bool receiveMessage(RawCommsMessage* res) override;
+
+    /// @brief Queues a batch of frames, and sends them with as few sendmmsg calls as possible
+    /// @return The number of frames of the batch the kernel took, the rest were dropped on a full
+    /// queue or wait in it for the next flush
+    size_t sendMessages(const RawCommsMessage* messages, size_t count) override;
+
+    /// @brief Takes up to a batch of received frames, with at most one recvmmsg call
+    size_t receiveMessages(RawCommsMessage* messages, size_t capacity) override;
+
+    bool supportsFD() const override { return _config.fd; }
+    uint8_t maxPayloadLength() const override { return _config.fd ? 64 : 8; }
+    bool sendFDMessage(const RawCommsFDMessage& message) override;
+    bool receiveFDMessage(RawCommsFDMessage* message) override;
+
+    /// @brief Sends every queued frame with one sendmmsg call
+    /// @return The number of frames the kernel took, frames it refused stay queued for the next one
+    size_t flush();
+
+    /// @brief Blocks until frames are waiting, or the timeout passes
+    /// @param timeoutMs How long to wait, -1 waits forever
+    /// @return True if frames are waiting
+    bool waitForFrames(int timeoutMs);
+
+    /// @brief The epoll instance watching the socket, to fold the driver into an existing loop
+    int epollFd() const { return _epollFd; }
+
+    /// @brief The receive timestamp of the last frame taken, in nanoseconds
+    /// @note Hardware timestamps are used when the adapter has them, 0 if there were none
+    uint64_t lastRxTimestampNs() const { return _lastRxTimestampNs; }
+
+    /// @brief The number of frames dropped because the kernel refused them
+    uint32_t txDrops() const { return _txDrops; }
+
+   private:
+    /// @brief Fills the receive batch with one recvmmsg call
+    /// @return True if any frames arrived
+    bool fill();
+
+    /// @brief Queues a frame for the next flush
+    void queue(uint32_t id, const uint8_t* data, uint8_t length, bool fd, bool bitRateSwitch);
+
+    /// @brief Takes the next frame out of the receive batch
+    /// @return The frame, or nullptr if none are waiting
+    const canfd_frame* next();
+
+    /// @brief Sizes the batch buffers and points the message headers at them
+    void allocateBatches();
+
+    /// @brief Installs one kernel filter per ID this MCU listens to
+    void installFilters();
+
+    std::string _interfaceName;
+    MCUID _me;
+    SocketCANConfig _config;
+    int _socket;
+    int _epollFd;
+    bool _isCANSocket;
+
+    // receive batch, frames [_rxHead, _rxCount) haven't been taken yet
+    std::vector<canfd_frame> _rxFrames;
+    std::vector<uint64_t> _rxTimestampsNs;
+    std::vector<iovec> _rxIov;
+    std::vector<mmsghdr> _rxHeaders;
+    std::vector<uint8_t> _rxControl;
+    size_t _rxHead;
+    size_t _rxCount;
+
+    // send batch
+    std::vector<canfd_frame> _txFrames;
+    std::vector<iovec> _txIov;
+    std::vector<mmsghdr> _txHeaders;
+    size_t _txCount;
+
+    uint64_t _lastRxTimestampNs;
+    uint32_t _txDrops;
+};
+
+}  // namespace comms
+
+#endif  // defined(__linux__) && !defined(ARDUINO)
+
+#endif  // __SOCKETCAN_DRIVER_H__
@@ -0,0 +1,77 @@
+#ifndef __SUBSCRIPTION_H__
+#define __SUBSCRIPTION_H__
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+
+#include "id.hpp"
+#include "sensor.hpp"
+
+namespace comms {
+
+/// @brief Identifies a subscription, so it can be removed again
+typedef uint16_t SubscriptionID;
+
+/// @brief Holds the latest sample of a sensor for a consumer that runs somewhere else, e.g. an
+/// interrupt or another thread
+/// @note Lock-free for one writer (the controller) and one reader. It is triple buffered, so the
+/// writer never waits and the reader always gets a whole sample, never a mix of two
+class SensorMailbox {
+   public:
+    SensorMailbox() : _slots{}, _middle(1), _back(0), _front(2) {}
+
+    SensorMailbox(const SensorMailbox&) = delete;
+    SensorMailbox& operator=(const SensorMailbox&) = delete;
+
+    /// @brief Publishes a sample, replacing one the reader hasn't taken yet
+    void post(const SensorStatus& sample) {
+        _slots[_back] = sample;
+        _back = _middle.exchange(_back | kFresh, std::memory_order_acq_rel) & kIndexMask;
+    }
+
+    /// @brief Takes the latest sample, if one was posted since the last take
+    /// @param sample Set to the sample
+    /// @return True if there was a new sample
+    bool take(SensorStatus* sample) {
+        if ((_middle.load(std::memory_order_relaxed) & kFresh) == 0) return false;
+
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & kIndexMask;
+        *sample = _slots[_front];
+        return true;
+    }
+
+   private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFresh = 0x4;
+
+    std::array<SensorStatus, 3> _slots;
+    std::atomic<uint8_t> _middle;  // the slot between writer and reader, with kFresh once posted
+    uint8_t _back;                 // only touched by the writer
+    uint8_t _front;                // only touched by the reader
+};
+
+/// @brief A consumer of sensor samples from one sensor, or every sensor of one node
+struct SensorSubscription {
+    SubscriptionID id;
+    MCUID sender;
+    bool allSensors;  // ignore sensorID and deliver every sensor of the sender
+    uint8_t sensorID;
+    uint32_t minIntervalMs;  // samples sooner than this after the last delivery are skipped
+    uint32_t lastDeliveryTime;
+    bool delivered;  // false until the first delivery, so the first sample is never skipped
+    std::function<void(const SensorStatus&)> callback;  // either this or mailbox is set
+    SensorMailbox* mailbox;
+    bool removed;  // unsubscribed while samples were being delivered, erased once that ends
+
+    /// @brief Checks if a sample from a sensor belongs to this subscription
+    bool matches(MCUID from, uint8_t sensor) const {
+        return sender == from && (allSensors || sensorID == sensor);
+    }
+};
+
+}  // namespace comms
+
+#endif  // __SUBSCRIPTION_H__
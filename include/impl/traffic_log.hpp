@@ -0,0 +1,285 @@
+#ifndef __TRAFFIC_LOG_H__
+#define __TRAFFIC_LOG_H__
+
+/**========================================================================
+ *                             traffic_log.hpp
+ *
+ *  Records bus traffic to a compact binary log, and plays it back.
+ *
+ *  A log is a TrafficLogHeader followed by fixed-size TrafficLogRecords,
+ *  appended in time order. Because every record has the same size and
+ *  8-byte alignment, a log can be memory-mapped and indexed in place,
+ *  without parsing.
+ *
+ *========================================================================**/
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <cstdio>
+
+#include "comms_driver.hpp"
+
+namespace comms {
+
+/// @brief Which way a recorded frame went, as seen by the node that recorded it
+enum TrafficDirection : uint8_t {
+    TD_RX,  // received by the recording node
+    TD_TX,  // sent by the recording node
+};
+
+/// @brief The header at the start of every traffic log
+struct TrafficLogHeader {
+    char magic[8];        // kMagic
+    uint16_t version;     // kVersion
+    uint16_t recordSize;  // sizeof(TrafficLogRecord), so readers can reject foreign layouts
+    uint32_t reserved;
+    uint64_t startTimeUs;  // Clock::micros() when recording started, for reference only
+
+    /// @brief Identifies a traffic log
+    static constexpr char kMagic[8] = {'R', 'D', 'S', 'C', 'L', 'O', 'G', '\0'};
+
+    /// @brief The layout version written by this library
+    static constexpr uint16_t kVersion = 1;
+};
+
+/// @brief One frame in a traffic log
+struct TrafficLogRecord {
+    uint64_t timestampUs;  // since recording started
+    uint32_t id;
+    uint8_t length;
+    uint8_t direction;  // TrafficDirection
+    uint16_t reserved;
+    uint64_t payload;
+};
+
+static_assert(sizeof(TrafficLogHeader) == 24, "TrafficLogHeader must stay 24 bytes");
+static_assert(sizeof(TrafficLogRecord) == 24, "TrafficLogRecord must stay 24 bytes");
+
+/// @brief Somewhere an append-only traffic log can be written to
+class TrafficLogSink {
+   public:
+    /// @brief Appends bytes to the log
+    /// @param data The bytes to append
+    /// @param size The number of bytes to append
+    /// @return True if all of the bytes were written, false if none were
+    virtual bool write(const void* data, size_t size) = 0;
+
+    /// @brief Pushes buffered bytes to their destination
+    virtual void flush() {}
+
+    virtual ~TrafficLogSink() = default;
+};
+
+/// @brief A sink writing into a caller-provided RAM buffer, for recording on an MCU
+/// @note Once the buffer is full, further writes are rejected rather than wrapping, so the log
+/// always starts with its header
+class MemoryTrafficLogSink : public TrafficLogSink {
+   public:
+    /// @brief Constructs a sink over a buffer
+    /// @param buffer The buffer to write into, it should be 8-byte aligned
+    /// @param capacity The size of the buffer in bytes
+    MemoryTrafficLogSink(uint8_t* buffer, size_t capacity)
+        : _buffer(buffer), _capacity(capacity), _size(0) {}
+
+    /// @brief Appends bytes to the buffer, if they fit
+    bool write(const void* data, size_t size) override;
+
+    /// @brief The bytes written so far
+    const uint8_t* data() const { return _buffer; }
+
+    /// @brief The number of bytes written so far
+    size_t size() const { return _size; }
+
+   private:
+    uint8_t* _buffer;
+    size_t _capacity;
+    size_t _size;
+};
+
+#ifndef ARDUINO
+
+/// @brief A sink appending to a file on a host
+class FileTrafficLogSink : public TrafficLogSink {
+   public:
+    /// @brief Opens a file for writing, truncating it
+    /// @param path The path of the log file
+    explicit FileTrafficLogSink(const char* path);
+
+    ~FileTrafficLogSink() override;
+
+    /// @brief Checks if the file was opened
+    bool isOpen() const { return _file != nullptr; }
+
+    /// @brief Appends bytes to the file
+    bool write(const void* data, size_t size) override;
+
+    /// @brief Flushes the stdio buffer to the file
+    void flush() override;
+
+   private:
+    FILE* _file;
+};
+
+#endif  // ARDUINO
+
+/// @brief A CommsDriver decorator that records every frame sent and received through it
+class RecordingDriver final : public CommsDriver {
+   public:
+    /// @brief Constructs a recorder around another driver
+    /// @param inner The driver that actually talks to the bus
+    /// @param sink Where the log is written, the header is written on install()
+    RecordingDriver(CommsDriver* inner, TrafficLogSink* sink);
+
+    /// @brief Installs the inner driver and starts the log
+    void install() override;
+
+    /// @brief Flushes the log and uninstalls the inner driver
+    void uninstall() override;
+
+    /// @brief Sends a message through the inner driver, and records it
+    void sendMessage(const RawCommsMessage& message) override;
+
+    /// @brief Receives a message from the inner driver, and records it
+    bool receiveMessage(RawCommsMessage* res) override;
+
+    /// @brief Sends a batch through the inner driver, and records it
+    size_t sendMessages(const RawCommsMessage* messages, size_t count) override;
+
+    /// @brief Receives a batch from the inner driver, and records it
+    size_t receiveMessages(RawCommsMessage* messages, size_t capacity) override;
+
+    /// @brief Reports the state of the inner driver's bus
+    BusState busState() override { return _inner->busState(); }
+
+    /// @brief The number of records the sink rejected, e.g. because it was full
+    uint32_t droppedRecords() const { return _droppedRecords; }
+
+   private:
+    /// @brief Appends one frame to the log
+    void record(const RawCommsMessage& message, TrafficDirection direction);
+
+    /// @brief Microseconds since recording started, without wrapping
+    uint64_t elapsedUs();
+
+    CommsDriver* _inner;
+    TrafficLogSink* _sink;
+    uint32_t _lastMicros;
+    uint64_t _elapsedUs;
+    uint32_t _droppedRecords;
+};
+
+/// @brief A read-only view of a traffic log held in memory, e.g. a memory-mapped file
+class TrafficLogView {
+   public:
+    /// @brief Constructs an empty, invalid view
+    TrafficLogView() : _records(nullptr), _count(0) {}
+
+    /// @brief Constructs a view over a log
+    /// @param data The start of the log, it must be 8-byte aligned
+    /// @param size The size of the log in bytes, a trailing partial record is ignored
+    TrafficLogView(const uint8_t* data, size_t size);
+
+    /// @brief Checks if the log had a valid header
+    bool isValid() const { return _records != nullptr; }
+
+    /// @brief The number of complete records in the log
+    size_t size() const { return _count; }
+
+    /// @brief Gets a record by index
+    /// @param index The index of the record, less than size()
+    const TrafficLogRecord& operator[](size_t index) const { return _records[index]; }
+
+   private:
+    const TrafficLogRecord* _records;
+    size_t _count;
+};
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+
+/// @brief A traffic log file memory-mapped read-only, on POSIX hosts
+class MappedTrafficLog {
+   public:
+    /// @brief Maps a log file
+    /// @param path The path of the log file
+    explicit MappedTrafficLog(const char* path);
+
+    ~MappedTrafficLog();
+
+    MappedTrafficLog(const MappedTrafficLog&) = delete;
+    MappedTrafficLog& operator=(const MappedTrafficLog&) = delete;
+
+    /// @brief A view of the mapped log, invalid if the file couldn't be mapped
+    TrafficLogView view() const;
+
+   private:
+    void* _data;
+    size_t _size;
+};
+
+#endif
+
+/// @brief How fast a ReplayDriver plays a log back
+enum ReplayMode : uint8_t {
+    RPM_REAL_TIME,  // frames come out with the same spacing they were recorded with
+    RPM_SCALED,     // like RPM_REAL_TIME, with time sped up or slowed down by a factor
+    RPM_MAX_SPEED,  // every frame is available immediately, for throughput benchmarks
+};
+
+/// @brief A CommsDriver that plays a recorded log back into a CommsController
+/// @note Frames the controller sends are counted and discarded
+class ReplayDriver final : public CommsDriver {
+   public:
+    /// @brief Constructs a replayer over a log
+    /// @param log The log to play back
+    /// @param mode How fast to play it back
+    /// @param speed The time scale for RPM_SCALED, 2.0 plays twice as fast
+    /// @param direction Which records to replay. TD_RX replays what the recording node received,
+    /// TD_TX replays what it sent, i.e. what its peers received
+    ReplayDriver(TrafficLogView log, ReplayMode mode = RPM_MAX_SPEED, float speed = 1.0f,
+                 TrafficDirection direction = TD_RX);
+
+    /// @brief Starts playback from the beginning of the log
+    void install() override;
+
+    /// @brief Does nothing
+    void uninstall() override {}
+
+    /// @brief Discards a frame sent by the controller
+    void sendMessage(const RawCommsMessage& message) override;
+
+    /// @brief Gets the next recorded frame, once it's due
+    /// @param res The replayed frame
+    /// @return True if a frame was due, false if the next one isn't due yet or the log is over
+    bool receiveMessage(RawCommsMessage* res) override;
+
+    /// @brief Checks if every record has been played back
+    bool finished() const { return _cursor >= _log.size(); }
+
+    /// @brief The number of frames played back so far
+    uint32_t replayed() const { return _replayed; }
+
+    /// @brief The number of frames the controller sent during playback
+    uint32_t discarded() const { return _discarded; }
+
+   private:
+    /// @brief Microseconds of log time that are due, scaled by the replay speed
+    uint64_t dueLogTimeUs();
+
+    TrafficLogView _log;
+    ReplayMode _mode;
+    float _speed;
+    TrafficDirection _direction;
+
+    size_t _cursor;
+    uint64_t _firstTimestampUs;
+    uint32_t _lastMicros;
+    uint64_t _elapsedUs;
+
+    uint32_t _replayed;
+    uint32_t _discarded;
+};
+
+}  // namespace comms
+
+#endif  // __TRAFFIC_LOG_H__
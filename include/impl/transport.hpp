@@ -0,0 +1,161 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stdint.h>
+
+#include <array>
+
+#include "comms_driver.hpp"
+#include "id.hpp"
+#include "option.hpp"
+
+namespace comms {
+
+/// @brief The state of a segmented transfer
+enum TransportStatus : uint8_t {
+    TS_IDLE,         // nothing has been sent to this target yet
+    TS_IN_PROGRESS,  // the transfer is still going
+    TS_COMPLETE,     // every frame went out and the receiver kept up
+    TS_FAILED,       // the receiver overflowed, or stopped sending flow control
+};
+
+/// @brief The kind of frame, stored in the high nibble of the protocol control byte
+enum TransportFrameType : uint8_t {
+    TFT_SINGLE = 0x0,       // a whole transfer of up to 6 bytes
+    TFT_FIRST = 0x1,        // the first 5 bytes of a longer transfer, and its length
+    TFT_CONSECUTIVE = 0x2,  // the next 6 bytes of a transfer, with a 4-bit sequence number
+    TFT_FLOW_CONTROL = 0x3, // sent by the receiver, paces the sender
+};
+
+/// @brief The flow status of a flow control frame, stored in its low nibble
+enum TransportFlowStatus : uint8_t {
+    TFS_CLEAR_TO_SEND = 0x0,
+    TFS_WAIT = 0x1,
+    TFS_OVERFLOW = 0x2,
+};
+
+/// @brief How a receiver paces the senders talking to it
+struct TransportConfig {
+    uint8_t blockSize;         // frames sent between flow control frames, 0 sends everything at once
+    uint32_t separationTimeUs; // the minimum gap between consecutive frames
+    uint8_t maxFramesPerTick;  // caps how many frames one tick() hands to the driver
+    uint32_t timeoutMs;        // how long either side waits for the other before giving up
+
+    /// @brief Paces transfers so they fit in the driver's transmit queue, without any gaps
+    static TransportConfig defaults() { return TransportConfig{8, 0, 8, 1000}; }
+};
+
+/// @brief Sends and receives payloads larger than a frame, ISO-TP style, over any CommsDriver
+/// @note The first byte of every frame is the target MCU (extended addressing), so one ID per sender
+/// is enough. Only single frame transfers can be broadcast, as flow control needs one receiver.
+class SegmentedTransport {
+   public:
+    /// @brief The largest transfer, the first frame carries a 12-bit length
+    static constexpr uint16_t kMaxTransferSize = 4095;
+
+    /// @brief How many transfers can be received at once, or held until receive() is called
+    static constexpr uint8_t kRxSlots = 4;
+
+    /// @brief How many transfers can be sent at once, to different targets
+    static constexpr uint8_t kTxSlots = 2;
+
+    /// @brief Constructs a SegmentedTransport
+    /// @param driver The driver to send frames on
+    /// @param me The ID of this MCU
+    /// @param config How this side paces the senders talking to it
+    SegmentedTransport(CommsDriver* driver, MCUID me,
+                       TransportConfig config = TransportConfig::defaults());
+
+    /// @brief Starts sending a buffer
+    /// @param target The MCU to send to
+    /// @param data The data to send, it is copied so it doesn't need to outlive the call
+    /// @param length The length of the data, at most kMaxTransferSize
+    /// @return True if the transfer was started, false if it is too long or no slot is free
+    bool send(MCUID target, const uint8_t* data, uint16_t length);
+
+    /// @brief Gets the status of the last transfer to a target
+    TransportStatus sendStatus(MCUID target) const;
+
+    /// @brief Takes a completed transfer, oldest first
+    /// @param sender Set to the MCU that sent the transfer
+    /// @param buffer Where to copy the data
+    /// @param capacity The size of the buffer, longer transfers are truncated
+    /// @return The length of the transfer, or none if nothing has completed
+    Option<uint16_t> receive(MCUID* sender, uint8_t* buffer, uint16_t capacity);
+
+    /// @brief Handles a transport frame
+    /// @param message The raw frame
+    /// @return True if the frame was a transport frame, false otherwise
+    bool handleMessage(const RawCommsMessage& message);
+
+    /// @brief Sends pending frames, and expires transfers that stalled
+    void tick();
+
+   private:
+    /// @brief The sending half of a transfer
+    struct TxSlot {
+        TransportStatus status;
+        bool waitingForFlowControl;
+        MCUID target;
+        uint16_t length;
+        uint16_t offset;
+        uint8_t sequence;
+        uint8_t blockRemaining;  // frames left in this block, 0 when the receiver set no limit
+        bool blockLimited;
+        uint32_t separationTimeUs;
+        uint32_t lastFrameTimeUs;
+        uint32_t lastFlowControlTime;
+        std::array<uint8_t, kMaxTransferSize> data;
+    };
+
+    /// @brief The receiving half of a transfer
+    struct RxSlot {
+        bool active;
+        bool complete;
+        MCUID sender;
+        uint16_t length;
+        uint16_t received;
+        uint8_t sequence;
+        uint8_t blockRemaining;
+        uint32_t lastFrameTime;
+        uint32_t completedOrder;  // so receive() hands out transfers in the order they completed
+        std::array<uint8_t, kMaxTransferSize> data;
+    };
+
+    /// @brief Sends one frame for a transfer
+    void sendFrame(MCUID target, const uint8_t* bytes, uint8_t length);
+
+    /// @brief Sends a flow control frame
+    void sendFlowControl(MCUID target, TransportFlowStatus status);
+
+    /// @brief Sends as many frames of a transfer as pacing allows
+    void pump(TxSlot& slot, uint8_t* budget);
+
+    void handleSingleFrame(MCUID sender, const RawCommsMessage& message);
+    void handleFirstFrame(MCUID sender, const RawCommsMessage& message);
+    void handleConsecutiveFrame(MCUID sender, const RawCommsMessage& message);
+    void handleFlowControl(MCUID sender, const RawCommsMessage& message);
+
+    /// @brief Finds a free receive slot, or none if all are in use
+    RxSlot* allocateRxSlot(MCUID sender);
+
+    /// @brief Finds the transfer currently being received from a sender
+    RxSlot* findActiveRxSlot(MCUID sender);
+
+    /// @brief Encodes a separation time as an ISO 15765-2 STmin byte
+    static uint8_t encodeSeparationTime(uint32_t us);
+
+    /// @brief Decodes an ISO 15765-2 STmin byte
+    static uint32_t decodeSeparationTime(uint8_t stMin);
+
+    CommsDriver* _driver;
+    MCUID _me;
+    TransportConfig _config;
+    uint32_t _completedCount;
+    std::array<TxSlot, kTxSlots> _tx;
+    std::array<RxSlot, kRxSlots> _rx;
+};
+
+}  // namespace comms
+
+#endif  // __TRANSPORT_H__
@@ -0,0 +1,44 @@
+#ifndef __REPLAY_EXAMPLE_H__
+#define __REPLAY_EXAMPLE_H__
+
+#include <chrono>
+#include <cstdio>
+
+#include "comms.hpp"
+
+using namespace comms;
+
+namespace replay {
+
+/// @brief Plays a recorded log into a high-level controller as fast as possible, and prints how
+/// many frames per second the controller got through. The same log always gives the same
+/// workload, so this makes a throughput benchmark out of real traffic.
+/// @param path The path of a log recorded with a RecordingDriver on the high-level node
+/// @return True if the log could be played back
+inline bool run(const char* path) {
+    MappedTrafficLog log(path);
+    if (!log.view().isValid()) {
+        printf("Unable to read traffic log %s\n", path);
+        return false;
+    }
+
+    ReplayDriver driver(log.view(), ReplayMode::RPM_MAX_SPEED);
+    CommsController controller(driver, MCUID::MCU_HIGH_LEVEL);
+    controller.initialize();
+
+    auto start = std::chrono::steady_clock::now();
+    while (!driver.finished()) {
+        controller.tick();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("replayed %u frames in %.3f ms, %.0f frames/s, %u frames sent by the controller\n",
+           static_cast<unsigned>(driver.replayed()), seconds * 1e3, driver.replayed() / seconds,
+           static_cast<unsigned>(driver.discarded()));
+    return true;
+}
+
+}  // namespace replay
+
+#endif  // __REPLAY_EXAMPLE_H__
@@ -26,6 +26,16 @@ static float sensorRead() {
 }
 static void sensorCleanup() { /* no-op */ }
 
+// runs the motor commands the high level sends, each takes one tick
+class MotorCommandHandler : public CommandHandler {
+   public:
+    void start(const CommandMessagePayload& payload) override {
+        MotorControlCommandOpt opt;
+        opt.payload = payload.payload;
+        Serial.printf("Moving motor %d to %d\n", opt.motorNumber, opt.value);
+    }
+};
+
 void setup() {
     // add a sensor
     g_controller.addSensor(
@@ -34,11 +44,19 @@ void setup() {
         // how to use the sensor!
         std::make_shared<LambdaSensor>(sensorInitialize, sensorRead, sensorCleanup));
 
+    g_controller.setCommandHandler(CommandType::CMD_MOTOR_CONTROL,
+                                   std::make_shared<MotorCommandHandler>());
+
     g_controller.initialize();
 }
 
 void loop() {
     g_controller.tick();
+
+#ifdef COMMS_DEFERRED_LOG
+    // the tick only queued its debug output, print a few messages of it now
+    DeferredLog::drainText([](const char* text) { Serial.print(text); }, 8);
+#endif
 }
 
 }  // namespace rx
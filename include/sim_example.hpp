@@ -0,0 +1,65 @@
+#ifndef __SIM_EXAMPLE_H__
+#define __SIM_EXAMPLE_H__
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "comms.hpp"
+
+using namespace comms;
+
+namespace sim {
+
+/// @brief Runs one high-level and four low-level controllers on a simulated bus, and prints the
+/// bus load and per-message latency. Run it again after changing node counts or sensor rates to
+/// see whether the bus can take it.
+/// @param baudRate The bit rate of the bus
+/// @param sensorsPerNode How many sensors each low-level node streams
+/// @param sensorRateMs How often each sensor is sent
+/// @param durationMs How long to simulate, after a 100 ms warm-up
+inline void run(CANBaudRate baudRate = CANBaudRate::CBR_500KBPS, uint8_t sensorsPerNode = 4,
+                uint32_t sensorRateMs = 5, uint32_t durationMs = 10000) {
+    VirtualClock clock;
+    Clock::setSource(&clock);
+
+    SimulatedCANBus bus(baudRate, &clock);
+
+    CommsController high(bus.addNode(), MCUID::MCU_HIGH_LEVEL);
+    high.initialize();
+
+    std::vector<std::unique_ptr<CommsController>> lows;
+    for (MCUID id : {MCU_LOW_LEVEL_0, MCU_LOW_LEVEL_1, MCU_LOW_LEVEL_2, MCU_LOW_LEVEL_3}) {
+        std::unique_ptr<CommsController> low(new CommsController(bus.addNode(), id));
+        for (uint8_t sensor = 0; sensor < sensorsPerNode; sensor++) {
+            low->addSensor(sensorRateMs, sensor,
+                           std::make_shared<LambdaSensor>([]() { return true; },
+                                                          [&clock]() { return clock.millis() * 0.01f; },
+                                                          []() {}));
+        }
+        low->initialize();
+        lows.push_back(std::move(low));
+    }
+
+    high.enableHeartbeatRequestDispatching(100, {MCU_LOW_LEVEL_0, MCU_LOW_LEVEL_1,
+                                                 MCU_LOW_LEVEL_2, MCU_LOW_LEVEL_3});
+
+    auto step = [&]() {
+        high.tick();
+        for (auto& low : lows) {
+            low->tick();
+        }
+    };
+
+    // every node runs a 10 kHz loop
+    bus.run(100000, 100, step);
+    bus.resetStats();
+    bus.run(static_cast<uint64_t>(durationMs) * 1000, 100, step);
+
+    bus.printReport(stdout);
+    Clock::setSource(nullptr);
+}
+
+}  // namespace sim
+
+#endif  // __SIM_EXAMPLE_H__
@@ -17,44 +17,69 @@ CommsController g_controller{
     MCUID::MCU_HIGH_LEVEL  // we are the high level
 };
 
+// set once the low level has run everything it was sent
+bool g_segmentDone = true;
+
+// when the last segment was sent
+uint32_t g_segmentSentMs = 0;
+
+// the fastest a new segment is sent
+constexpr uint32_t kSegmentPeriodMs = 100;
+
+// the done report isn't acknowledged, if it is lost or the low level rebooted, send anyway
+constexpr uint32_t kSegmentTimeoutMs = 1000;
+
 void setup() {
     Serial.begin(9600);
     Serial.println("TX Example Start!");
     g_controller.initialize();
-}
-
-void loop() {
-    Serial.println("Loop!");
-    g_controller.tick();
 
     // enable heartbeats
     g_controller.enableHeartbeatRequestDispatching(100,                      // how often?
                                                    {MCUID::MCU_LOW_LEVEL_0}  // who to monitor?
     );
 
+    // print out the data recieved by the sensor, as soon as it arrives
+    g_controller.subscribeSensor(MCUID::MCU_LOW_LEVEL_0,  // who is sending the sensor data?
+                                 0,                       // what sensor do we want?
+                                 [](const SensorStatus& status) {
+                                     Serial.printf("%0.2f\n", status.value);
+                                 });
+
+    // the low level reports each slice it executes, the last one ends the segment
+    g_controller.onExecutionStatus([](const ExecutionReport& report) {
+        Serial.printf("Executed %d commands in %dms\n", report.executed, report.elapsedMs);
+        if (report.executionDone) g_segmentDone = true;
+    });
+}
+
+void loop() {
+    g_controller.tick();
+
+#ifdef COMMS_DEFERRED_LOG
+    // the tick only queued its debug output, print a few messages of it now
+    DeferredLog::drainText([](const char* text) { Serial.print(text); }, 8);
+#endif
+
+    uint32_t sinceSentMs = millis() - g_segmentSentMs;
+    if (sinceSentMs < kSegmentPeriodMs) return;
+    if (!g_segmentDone) {
+        if (sinceSentMs < kSegmentTimeoutMs) return;  // the last segment is still running
+        Serial.println("No done report for the last segment, sending the next one anyway");
+    }
+
     MotorControlCommandOpt commandDesc(MCUID::MCU_LOW_LEVEL_0,               // who is recieving it?
                                        0,                                    // what motor?
                                        MotorControlCommandType::MC_CMD_POS,  // the control type
                                        10                                    // the value to control
     );
-
     CommandMessagePayload motorCmd = CommandBuilder::motorControl(g_controller.me(), commandDesc);
 
     g_controller.sendCommand(motorCmd);
-
-    // print out the data recieved by the sensor
-    Option<float> sensorValueOpt =
-        g_controller.getSensorValue(MCUID::MCU_LOW_LEVEL_0,  // who is sending the sensor data?
-                                    0                        // what sensor do we want?
-        );
-
-    if (sensorValueOpt.isNone()) {
-        Serial.println("No sensor value yet!");
-    } else {
-        Serial.printf("%0.2f\n", sensorValueOpt.value());
-    }
-
-    delay(100);  // bad
+    g_controller.sendCommand(CommandBuilder::beginExecution(
+        g_controller.me(), BeginExecutionCommandOpt(MCUID::MCU_LOW_LEVEL_0)));
+    g_segmentDone = false;
+    g_segmentSentMs = millis();
 }
 
 }  // namespace tx
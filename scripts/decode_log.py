@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+"""Decodes a binary deferred log, as written by DeferredLog::drainBinary(), back into text.
+
+The MCU only sends format IDs, the FNV-1a hashes of the format strings. This script finds the
+format strings by scanning the sources for COMMS_DEBUG_* calls, so run it against the same
+revision the firmware was built from.
+
+    scripts/decode_log.py capture.bin
+    cat /dev/ttyACM0 | scripts/decode_log.py -
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+HEADER = struct.Struct("<IIHBB")  # timestamp, format ID, line, flags, argument count
+DROPPED_FORMAT_ID = 0
+
+FLAG_ERROR = 0x01
+FLAG_NEWLINE = 0x02
+
+ARG_I32, ARG_U32, ARG_I64, ARG_U64, ARG_F64, ARG_STR = range(6)
+ARG_FORMATS = {ARG_I32: "<i", ARG_U32: "<I", ARG_I64: "<q", ARG_U64: "<Q", ARG_F64: "<d"}
+
+LOG_CALL = re.compile(r"COMMS_DEBUG_PRINT(?:_ERROR)?(?:LN)?\s*\(")
+STRING_LITERAL = re.compile(r'\s*"((?:[^"\\\n]|\\.)*)"')
+CONVERSION = re.compile(
+    r"%([-+ #0]*)(\d+|\*)?(?:\.(\d+|\*))?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGaAcsp%])")
+
+COLOR_RED = "\033[31m"
+COLOR_BLUE = "\033[34m"
+COLOR_RETURN = "\033[0m"
+
+
+def fnv1a(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def unescape(literal):
+    """Turns the body of a C string literal into the bytes the compiler stores."""
+    out = bytearray()
+    i = 0
+    simple = {"n": 10, "t": 9, "r": 13, "0": 0, "a": 7, "b": 8, "f": 12, "v": 11,
+              "\\": 92, '"': 34, "'": 39, "?": 63, "e": 27}
+    while i < len(literal):
+        c = literal[i]
+        if c != "\\":
+            out += c.encode()
+            i += 1
+            continue
+        nxt = literal[i + 1]
+        if nxt == "x":
+            match = re.match(r"[0-9a-fA-F]+", literal[i + 2:])
+            out.append(int(match.group(0), 16) & 0xFF)
+            i += 2 + len(match.group(0))
+        elif nxt in "01234567":
+            match = re.match(r"[0-7]{1,3}", literal[i + 1:])
+            out.append(int(match.group(0), 8) & 0xFF)
+            i += 1 + len(match.group(0))
+        else:
+            out.append(simple.get(nxt, ord(nxt)))
+            i += 2
+    return bytes(out)
+
+
+def scan_sources(roots):
+    """Maps every format ID to the formats and sites that produce it."""
+    formats = {}
+    for root in roots:
+        root = os.path.normpath(root)
+        if os.path.isfile(root):
+            paths = [root]
+        else:
+            paths = [os.path.join(directory, name)
+                     for directory, _, files in os.walk(root) for name in sorted(files)
+                     if name.endswith((".cpp", ".hpp", ".h", ".c"))]
+        for path in paths:
+            # sites are named from the folder above the root, e.g. include/comms.hpp
+            site = os.path.relpath(path, os.path.dirname(root))
+            with open(path, encoding="utf-8", errors="replace") as source:
+                text = source.read()
+            for call in LOG_CALL.finditer(text):
+                # adjacent literals are one string, a call without one is a macro definition
+                position = call.end()
+                pieces = []
+                while True:
+                    literal = STRING_LITERAL.match(text, position)
+                    if literal is None:
+                        break
+                    pieces.append(literal.group(1))
+                    position = literal.end()
+                if not pieces:
+                    continue
+                fmt = b"".join(unescape(piece) for piece in pieces)
+                line = text.count("\n", 0, call.start()) + 1
+                sites = formats.setdefault(fnv1a(fmt), (fmt.decode(errors="replace"), []))[1]
+                sites.append((site, line))
+    return formats
+
+
+def read_args(data, count):
+    args = []
+    offset = 0
+    for _ in range(count):
+        if offset >= len(data):
+            break
+        tag = data[offset]
+        if tag == ARG_STR:
+            length = data[offset + 1]
+            args.append(data[offset + 2:offset + 2 + length].decode(errors="replace"))
+            offset += 2 + length
+        elif tag in ARG_FORMATS:
+            fmt = ARG_FORMATS[tag]
+            size = struct.calcsize(fmt)
+            args.append(struct.unpack_from(fmt, data, offset + 1)[0])
+            offset += 1 + size
+        else:
+            break
+    return args
+
+
+def format_message(fmt, args):
+    """Formats like printf, an argument that is missing or doesn't fit its conversion is a ?"""
+    remaining = list(args)
+
+    def convert(match):
+        flags, width, precision, _, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        if not remaining:
+            return "?"
+        value = remaining.pop(0)
+        if conversion == "p":
+            conversion, flags = "x", (flags or "") + "#"
+        spec = "%" + (flags or "") + (width or "") + ("." + precision if precision else "")
+        try:
+            if conversion == "s":
+                return (spec + "s") % value if isinstance(value, str) else "?"
+            if conversion in "eEfFgGaA":
+                return (spec + conversion.replace("a", "e").replace("A", "E")) % float(value)
+            if isinstance(value, str):
+                return "?"
+            if conversion == "c":
+                return (spec + "c") % chr(value & 0xFF)
+            return (spec + conversion.replace("u", "d").replace("i", "d")) % value
+        except (TypeError, ValueError):
+            return "?"
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def records(stream):
+    """Yields every record of a stream, skipping bytes until the next sync byte on garbage."""
+    buffer = b""
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            break
+        buffer += chunk
+        while True:
+            start = buffer.find(bytes([SYNC]))
+            if start < 0:
+                buffer = b""
+                break
+            buffer = buffer[start:]
+            if len(buffer) < 2:
+                break
+            length = buffer[1]
+            if length < HEADER.size:
+                buffer = buffer[1:]
+                continue
+            if len(buffer) < 2 + length:
+                break
+            body = buffer[2:2 + length]
+            buffer = buffer[2 + length:]
+            timestamp, format_id, line, flags, count = HEADER.unpack_from(body)
+            yield timestamp, format_id, line, flags, read_args(body[HEADER.size:], count)
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="the binary log, or - for stdin")
+    library = [os.path.join(here, "..", "include"), os.path.join(here, "..", "src")]
+    parser.add_argument("--sources", nargs="*", default=[],
+                        help="more folders or files to find format strings in, besides the "
+                        "library's")
+    parser.add_argument("--color", action="store_true", help="color the prefixes like the MCU does")
+    options = parser.parse_args()
+
+    formats = scan_sources(library + options.sources)
+    stream = sys.stdin.buffer if options.log == "-" else open(options.log, "rb")
+    out = sys.stdout
+
+    for timestamp, format_id, line, flags, args in records(stream):
+        if format_id == DROPPED_FORMAT_ID:
+            text = "%d log messages dropped, the ring was full" % (args[0] if args else 0)
+            site = "?"
+        elif format_id in formats:
+            fmt, sites = formats[format_id]
+            # the same format may be logged from several places, the line tells them apart
+            path = min(sites, key=lambda s: abs(s[1] - line))[0]
+            text = format_message(fmt, args)
+            site = "%s:%d" % (path, line)
+        else:
+            text = "unknown format 0x%08x, args %s" % (format_id, args)
+            site = "?:%d" % line
+
+        color = COLOR_RED if flags & FLAG_ERROR else COLOR_BLUE
+        prefix = "[%d][COMMS][%s] " % (timestamp, site)
+        if options.color:
+            prefix = color + prefix + COLOR_RETURN
+        out.write(prefix + text + ("\n" if flags & FLAG_NEWLINE else ""))
+    out.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,241 @@
+#include "impl/can_bus_sim.hpp"
+
+#include <algorithm>
+
+#include "impl/debug.hpp"
+
+namespace comms {
+
+namespace {
+
+/// @brief Orders frames the way bitwise arbitration does, lower wins
+/// @note A standard frame beats an extended one with the same base ID, as its RTR bit is dominant
+/// where the extended frame sends a recessive SRR bit
+uint32_t arbitrationKey(uint32_t id) {
+    if (!isExtendedID(id)) return id << 20;
+
+    uint32_t canID = id & kExtendedIDMask;
+    return ((canID >> 18) << 20) | (0x3 << 18) | (canID & 0x3FFFF);
+}
+
+}  // namespace
+
+void SimulatedCANNode::sendMessage(const RawCommsMessage& message) {
+    if (_tx.size() >= _bus->_txMailboxes) {
+        _bus->recordTxDrop(message.id);
+        return;
+    }
+
+    PendingFrame frame;
+    frame.message = message;
+    frame.enqueuedUs = _bus->_clock->nowUs();
+    frame.sequence = _bus->_sequence++;
+    _tx.push_back(frame);
+}
+
+bool SimulatedCANNode::receiveMessage(RawCommsMessage* res) {
+    if (_rx.empty()) return false;
+
+    *res = _rx.front();
+    _rx.pop_front();
+    return true;
+}
+
+size_t SimulatedCANNode::receiveMessages(RawCommsMessage* messages, size_t capacity) {
+    size_t count = 0;
+    while (count < capacity && !_rx.empty()) {
+        messages[count++] = _rx.front();
+        _rx.pop_front();
+    }
+    return count;
+}
+
+SimulatedCANBus::SimulatedCANBus(CANBaudRate baudRate, VirtualClock* clock, size_t txMailboxes,
+                                 size_t rxMailboxes)
+    : _baudRate(baudRate),
+      _bitTimeNs(1000000000UL / canBaudRateBps(baudRate)),
+      _clock(clock),
+      _txMailboxes(txMailboxes),
+      _rxMailboxes(rxMailboxes),
+      _sequence(0),
+      _busy(false),
+      _inFlight(),
+      _idleSinceUs(clock->nowUs()),
+      _statsStartUs(clock->nowUs()),
+      _busyUs(0),
+      _frames(0) {}
+
+SimulatedCANNode& SimulatedCANBus::addNode() {
+    _nodes.push_back(std::unique_ptr<SimulatedCANNode>(new SimulatedCANNode(this, _nodes.size())));
+    return *_nodes.back();
+}
+
+void SimulatedCANBus::advanceTo(uint64_t timeUs) {
+    while (true) {
+        if (_busy) {
+            if (_inFlight.endUs > timeUs) return;
+
+            complete(_inFlight);
+            _idleSinceUs = _inFlight.endUs;
+            _busy = false;
+            continue;
+        }
+
+        // the bus is idle, the next arbitration starts when the earliest waiting frame was queued
+        bool anyPending = false;
+        uint64_t earliestUs = 0;
+        for (const auto& node : _nodes) {
+            for (const SimulatedCANNode::PendingFrame& frame : node->_tx) {
+                if (!anyPending || frame.enqueuedUs < earliestUs) earliestUs = frame.enqueuedUs;
+                anyPending = true;
+            }
+        }
+        if (!anyPending) return;
+
+        uint64_t startUs = std::max(_idleSinceUs, earliestUs);
+        if (startUs >= timeUs) return;
+
+        _busy = arbitrate(startUs, &_inFlight);
+        if (!_busy) return;
+    }
+}
+
+void SimulatedCANBus::run(uint64_t durationUs, uint32_t stepUs, std::function<void()> step) {
+    uint64_t endUs = _clock->nowUs() + durationUs;
+    while (_clock->nowUs() < endUs) {
+        step();
+        advanceTo(_clock->nowUs() + stepUs);
+        _clock->advance(stepUs);
+    }
+}
+
+SimBusStats SimulatedCANBus::busStats() const {
+    SimBusStats stats{};
+    stats.elapsedUs = _clock->nowUs() - _statsStartUs;
+    stats.busyUs = _busyUs;
+    stats.load = stats.elapsedUs == 0 ? 0.0f
+                                      : static_cast<float>(_busyUs) / static_cast<float>(stats.elapsedUs);
+    stats.frames = _frames;
+    for (const auto& kv : _records) {
+        stats.txDrops += kv.second.txDrops;
+        stats.rxDrops += kv.second.rxDrops;
+    }
+    return stats;
+}
+
+std::vector<SimMessageStats> SimulatedCANBus::messageStats() const {
+    std::vector<SimMessageStats> result;
+    for (const auto& kv : _records) {
+        const IDRecord& record = kv.second;
+
+        SimMessageStats stats{};
+        stats.id = kv.first;
+        stats.sent = static_cast<uint32_t>(record.latenciesUs.size());
+        stats.txDrops = record.txDrops;
+        stats.rxDrops = record.rxDrops;
+
+        if (!record.latenciesUs.empty()) {
+            std::vector<uint32_t> sorted = record.latenciesUs;
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&sorted](uint32_t p) {
+                return sorted[(static_cast<size_t>(p) * (sorted.size() - 1)) / 100];
+            };
+            stats.latencyP50Us = percentile(50);
+            stats.latencyP90Us = percentile(90);
+            stats.latencyP99Us = percentile(99);
+            stats.latencyMaxUs = sorted.back();
+            stats.meanQueueingUs = static_cast<uint32_t>(record.queueingUs / sorted.size());
+        }
+
+        result.push_back(stats);
+    }
+    return result;
+}
+
+void SimulatedCANBus::resetStats() {
+    _statsStartUs = _clock->nowUs();
+    _busyUs = 0;
+    _frames = 0;
+    _records.clear();
+}
+
+void SimulatedCANBus::printReport(FILE* out) const {
+    SimBusStats bus = busStats();
+    fprintf(out, "bus: %u bps, %.3f s simulated, load %.1f%%, %u frames, %u tx drops, %u rx drops\n",
+            static_cast<unsigned>(canBaudRateBps(_baudRate)), bus.elapsedUs / 1e6,
+            bus.load * 100.0f, static_cast<unsigned>(bus.frames),
+            static_cast<unsigned>(bus.txDrops), static_cast<unsigned>(bus.rxDrops));
+    fprintf(out, "%8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "id", "sent", "txdrop", "rxdrop",
+            "p50us", "p90us", "p99us", "maxus", "queueus");
+    for (const SimMessageStats& s : messageStats()) {
+        fprintf(out, "%8x %8u %8u %8u %8u %8u %8u %8u %8u\n", static_cast<unsigned>(s.id),
+                static_cast<unsigned>(s.sent), static_cast<unsigned>(s.txDrops),
+                static_cast<unsigned>(s.rxDrops), static_cast<unsigned>(s.latencyP50Us),
+                static_cast<unsigned>(s.latencyP90Us), static_cast<unsigned>(s.latencyP99Us),
+                static_cast<unsigned>(s.latencyMaxUs), static_cast<unsigned>(s.meanQueueingUs));
+    }
+}
+
+void SimulatedCANBus::recordTxDrop(uint32_t id) {
+    _records[id].txDrops++;
+}
+
+bool SimulatedCANBus::arbitrate(uint64_t startUs, InFlight* winner) {
+    SimulatedCANNode* winningNode = nullptr;
+    size_t winningIndex = 0;
+
+    for (const auto& node : _nodes) {
+        // each controller offers its highest priority mailbox, lowest ID first, then oldest
+        for (size_t i = 0; i < node->_tx.size(); i++) {
+            const SimulatedCANNode::PendingFrame& frame = node->_tx[i];
+            if (frame.enqueuedUs > startUs) continue;
+
+            if (winningNode != nullptr) {
+                const SimulatedCANNode::PendingFrame& best = winningNode->_tx[winningIndex];
+                uint32_t key = arbitrationKey(frame.message.id);
+                uint32_t bestKey = arbitrationKey(best.message.id);
+                if (key > bestKey) continue;
+                if (key == bestKey && frame.sequence > best.sequence) continue;
+            }
+            winningNode = node.get();
+            winningIndex = i;
+        }
+    }
+
+    if (winningNode == nullptr) return false;
+
+    winner->node = winningNode->_index;
+    winner->frame = winningNode->_tx[winningIndex];
+    winningNode->_tx.erase(winningNode->_tx.begin() + winningIndex);
+
+    const RawCommsMessage& message = winner->frame.message;
+    uint32_t bits = canFrameBits(message.id & kExtendedIDMask, isExtendedID(message.id),
+                                 message.length, message.payloadBytes);
+    uint64_t durationNs = static_cast<uint64_t>(bits) * _bitTimeNs;
+
+    winner->startUs = startUs;
+    winner->endUs = startUs + (durationNs + 999) / 1000;
+    return true;
+}
+
+void SimulatedCANBus::complete(const InFlight& frame) {
+    const RawCommsMessage& message = frame.frame.message;
+    IDRecord& record = _records[message.id];
+
+    record.latenciesUs.push_back(static_cast<uint32_t>(frame.endUs - frame.frame.enqueuedUs));
+    record.queueingUs += frame.startUs - frame.frame.enqueuedUs;
+    _busyUs += frame.endUs - frame.startUs;
+    _frames++;
+
+    for (const auto& node : _nodes) {
+        if (node->_index == frame.node) continue;
+
+        if (node->_rx.size() >= _rxMailboxes) {
+            record.rxDrops++;
+            continue;
+        }
+        node->_rx.push_back(message);
+    }
+}
+
+}  // namespace comms
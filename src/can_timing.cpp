@@ -0,0 +1,94 @@
+#include "impl/can_timing.hpp"
+
+namespace comms {
+
+namespace {
+
+/// @brief Collects the stuffable part of a frame (SOF through CRC) one bit at a time
+class FrameBitWriter {
+   public:
+    FrameBitWriter() : _crc(0), _stuffBits(0), _runLength(0), _lastBit(2), _bits(0) {}
+
+    /// @brief Appends a field, most significant bit first, and includes it in the CRC
+    void pushField(uint32_t value, uint8_t width) {
+        for (int8_t i = width - 1; i >= 0; i--) {
+            bool bit = (value >> i) & 1;
+            updateCRC(bit);
+            pushBit(bit);
+        }
+    }
+
+    /// @brief Appends the CRC of everything pushed so far
+    void pushCRC() {
+        uint16_t crc = _crc;
+        for (int8_t i = 14; i >= 0; i--) {
+            pushBit((crc >> i) & 1);
+        }
+    }
+
+    /// @brief The number of bits written, including stuff bits
+    uint32_t bits() const { return _bits + _stuffBits; }
+
+   private:
+    void updateCRC(bool bit) {
+        bool next = bit ^ ((_crc >> 14) & 1);
+        _crc = (_crc << 1) & 0x7FFF;
+        if (next) _crc ^= 0x4599;
+    }
+
+    void pushBit(bool bit) {
+        _bits++;
+        if (bit == _lastBit) {
+            _runLength++;
+        } else {
+            _lastBit = bit;
+            _runLength = 1;
+        }
+
+        // after five equal bits the transmitter inserts one of the opposite polarity, which
+        // starts the next run
+        if (_runLength == 5) {
+            _stuffBits++;
+            _lastBit = !bit;
+            _runLength = 1;
+        }
+    }
+
+    uint16_t _crc;
+    uint32_t _stuffBits;
+    uint8_t _runLength;
+    uint8_t _lastBit;
+    uint32_t _bits;
+};
+
+}  // namespace
+
+uint32_t canFrameBits(uint32_t id, bool extended, uint8_t length, const uint8_t* data) {
+    if (length > 8) length = 8;
+
+    FrameBitWriter writer;
+    writer.pushField(0, 1);  // SOF
+    if (extended) {
+        writer.pushField((id >> 18) & 0x7FF, 11);  // base ID
+        writer.pushField(1, 1);                    // SRR
+        writer.pushField(1, 1);                    // IDE
+        writer.pushField(id & 0x3FFFF, 18);        // extended ID
+        writer.pushField(0, 1);                    // RTR
+        writer.pushField(0, 2);                    // r1, r0
+    } else {
+        writer.pushField(id & 0x7FF, 11);
+        writer.pushField(0, 1);  // RTR
+        writer.pushField(0, 1);  // IDE
+        writer.pushField(0, 1);  // r0
+    }
+    writer.pushField(length, 4);  // DLC
+    for (uint8_t i = 0; i < length; i++) {
+        writer.pushField(data[i], 8);
+    }
+    writer.pushCRC();
+
+    // CRC delimiter, ACK slot and delimiter, EOF and interframe space are never stuffed
+    return writer.bits() + 1 + 2 + 7 + 3;
+}
+
+}  // namespace comms
@@ -0,0 +1,57 @@
+#include "impl/clock.hpp"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+namespace comms {
+
+ClockSource* Clock::_source = nullptr;
+
+#ifdef ARDUINO
+
+uint32_t Clock::millis() {
+    if (_source != nullptr) return _source->millis();
+    return ::millis();
+}
+
+uint32_t Clock::micros() {
+    if (_source != nullptr) return _source->micros();
+    return ::micros();
+}
+
+void Clock::delayMicros(uint32_t us) {
+    if (_source != nullptr) return;
+    ::delayMicroseconds(us);
+}
+
+#else  // ARDUINO
+
+uint32_t Clock::millis() {
+    if (_source != nullptr) return _source->millis();
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+uint32_t Clock::micros() {
+    if (_source != nullptr) return _source->micros();
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+void Clock::delayMicros(uint32_t us) {
+    if (_source != nullptr) return;
+    uint32_t start = micros();
+    while (micros() - start < us) {
+    }
+}
+
+#endif  // ARDUINO
+
+void Clock::setSource(ClockSource* source) {
+    _source = source;
+}
+
+}  // namespace comms
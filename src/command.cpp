@@ -1,80 +1,305 @@
 #include "impl/command.hpp"
 
-#include <Arduino.h>
 #include <stdint.h>
 
 #include <iostream>
+#include <limits>
 
+#include "impl/clock.hpp"
 #include "impl/debug.hpp"
+#include "impl/motion.hpp"
+#include "impl/profile.hpp"
 
 using namespace comms;
 
-uint16_t CommandBuilder::__cmdCounter = 0;
+namespace {
 
-CommandBuffer::CommandBuffer() : _currentSlice(CommandSlice::empty()) {}
+/// @brief The nodes a start for every low level node may go to
+const MCUID kLowLevelNodes[] = {MCUID::MCU_LOW_LEVEL_0, MCUID::MCU_LOW_LEVEL_1,
+                                MCUID::MCU_LOW_LEVEL_2, MCUID::MCU_LOW_LEVEL_3,
+                                MCUID::MCU_PALM};
 
-void CommandBuffer::addCommand(CommandMessagePayload command) {
-    _commands.push_back(command);
+/// @brief Gets the node a command is for, the first byte of every command-specific payload
+MCUID targetOf(const CommandMessagePayload& payload) {
+    return static_cast<MCUID>(payload.payload & 0xFF);
+}
+
+/// @brief Checks if a time is at or after another, across a wrap of the microsecond clock
+bool atOrAfter(uint32_t timeUs, uint32_t referenceUs) {
+    return static_cast<int32_t>(timeUs - referenceUs) >= 0;
+}
+
+/// @brief Narrows a count or duration to a field of a status frame
+template <typename T>
+T saturate(size_t value) {
+    return value > std::numeric_limits<T>::max() ? std::numeric_limits<T>::max()
+                                                 : static_cast<T>(value);
+}
+
+}  // namespace
+
+std::atomic<uint16_t> CommandBuilder::__cmdCounter(0);
+
+CommandBuffer::CommandBuffer()
+    : _activeBank(0),
+      _currentSlice(CommandSlice::empty()),
+      _numCompletedCommands(0),
+      _isExecuting(false),
+      _startTime(0),
+      _isCalibrating(false),
+      _sliceStartUs(0),
+      _sliceFailure(EF_NONE),
+      _numExecutedCommands(0),
+      _lastCommandID(0) {
+    _isStartScheduled.fill(false);
+    _scheduledStartUs.fill(0);
+}
+
+void CommandBuffer::addCommand(CommandMessagePayload command, uint8_t bank) {
+    if (bank >= kNumCommandBanks) {
+        COMMS_DEBUG_PRINT_ERRORLN("Command bank %d doesn't exist!", bank);
+        return;
+    }
+    _banks[bank].push_back(command);
 }
 
 void CommandBuffer::tick() {
+    // the starts that are due, earliest first, so the banks queue up in the order they were meant
+    // to run
+    uint32_t now = Clock::micros();
+    while (true) {
+        int8_t due = -1;
+        for (uint8_t bank = 0; bank < kNumCommandBanks; bank++) {
+            if (!_isStartScheduled[bank] || !atOrAfter(now, _scheduledStartUs[bank])) continue;
+            if (due < 0 || !atOrAfter(_scheduledStartUs[bank], _scheduledStartUs[due])) due = bank;
+        }
+        if (due < 0) break;
+
+        _isStartScheduled[due] = false;
+        startExecution(due);
+    }
+
     if (_isExecuting == false) {
         return;
     }
 
-    if (CommandSlice::isEmpty(_currentSlice)) {
-        _currentSlice = findNextSlice(_currentSlice);
+    if (CommandSlice::isEmpty(_currentSlice) && !advanceSlice()) {
+        completeExecution(true, EF_NONE);
+        return;
     }
 
-    if (CommandSlice::isEmpty(_currentSlice)) {
-        _isExecuting = false;
-        return;
+    for (size_t i = _currentSlice.start(); i < _currentSlice.end(); i++) {
+        if (_finished[i - _currentSlice.start()]) continue;
+
+        // find the handler, a copy since a handler may add commands
+        CommandMessagePayload commandPayload = _banks[_activeBank][i];
+
+        std::shared_ptr<CommandHandler> handler = _handlers[commandPayload.type];
+        CommandProgress progress = CommandProgress::failed(EF_NO_HANDLER);
+        if (handler != nullptr) {
+            COMMS_PROFILE_ZONE(PZ_COMMAND_HANDLER);
+            handler->update(commandPayload);
+            progress = handler->progress(commandPayload);
+            if (!progress.done) continue;
+            handler->end(commandPayload);
+        }
+
+        _finished[i - _currentSlice.start()] = true;
+        _numCompletedCommands++;
+        if (progress.failure != EF_NONE && _sliceFailure == EF_NONE) {
+            _sliceFailure = progress.failure;
+        }
+    }
+
+    if (_numCompletedCommands < _currentSlice.size()) return;
+
+    completeSlice();
+
+    // the next slice, possibly of the next bank, starts right away so motions run back to back
+    if (_isExecuting && !advanceSlice()) {
+        completeExecution(true, EF_NONE);
     }
+}
+
+bool CommandBuffer::advanceSlice() {
+    _currentSlice = findNextSlice(_currentSlice);
+
+    while (CommandSlice::isEmpty(_currentSlice)) {
+        if (_queuedBanks.empty()) return false;
+
+        // an empty bank that was started is skipped
+        _activeBank = _queuedBanks.front();
+        _queuedBanks.erase(_queuedBanks.begin());
+        _currentSlice = findNextSlice(CommandSlice::empty());
+    }
+
+    startSlice();
+    return true;
+}
+
+void CommandBuffer::startSlice() {
+    _numCompletedCommands = 0;
+    _sliceFailure = EF_NONE;
+    _sliceStartUs = Clock::micros();
+    _finished.assign(_currentSlice.size(), false);
 
     for (size_t i = _currentSlice.start(); i < _currentSlice.end(); i++) {
-        // find the handler
-        CommandMessagePayload commandPayload = _commands[i];
+        CommandMessagePayload commandPayload = _banks[_activeBank][i];
+        std::shared_ptr<CommandHandler> handler = _handlers[commandPayload.type];
+        if (handler == nullptr) continue;
 
-        std::shared_ptr<CommandHandler> handler = _handlers[commandPayload.commandID];
-        if (handler == nullptr) continue;  // no handler
+        COMMS_PROFILE_ZONE(PZ_COMMAND_HANDLER);
+        handler->start(commandPayload);
     }
+}
 
-    if (_numCompletedCommands == _currentSlice.size()) {
-        _currentSlice = CommandSlice::empty();
-        _numCompletedCommands = 0;
+void CommandBuffer::completeSlice() {
+    std::vector<CommandMessagePayload>& commands = _banks[_activeBank];
+
+    ExecutionStats stats{};
+    stats.time = (Clock::micros() - _sliceStartUs) / 1000;
+    stats.executed = saturate<uint8_t>(_currentSlice.size());
+    stats.success = _sliceFailure == EF_NONE;
+    stats.failure = _sliceFailure;
+    stats.lastCommandID = commands[_currentSlice.end() - 1].commandID;
+    stats.remaining = 0;
+    stats.finished = false;
+    stats.bank = _activeBank;
+    stats.bankDone = false;
+    _numExecutedCommands += _currentSlice.size();
+    _lastCommandID = stats.lastCommandID;
+
+    // the commands that arrived during the slice move up, the next slice starts at the front
+    commands.erase(commands.begin(), commands.begin() + _currentSlice.end());
+    _currentSlice = CommandSlice::empty();
+    _numCompletedCommands = 0;
+
+    if (!stats.success) {
+        // the rest was planned assuming this slice succeeded, and so were the banks after it
+        commands.clear();
+        _queuedBanks.clear();
+    }
+    stats.remaining = commands.size();
+    for (uint8_t bank : _queuedBanks) stats.remaining += _banks[bank].size();
+    stats.bankDone = commands.empty();
+    stats.finished = stats.remaining == 0;
+    reportSlice(stats);
 
-        ExecutionStats stats = {
-            .time = millis() - _startTime,
-            .executed = static_cast<uint8_t>(_currentSlice.size()),
-            .success = true,
-        };
+    if (stats.finished) completeExecution(stats.success, stats.failure);
+}
 
-        for (auto& callback : _onExecutionCompleteCallbacks) {
-            callback(stats);
-        }
+void CommandBuffer::completeExecution(bool success, uint8_t failure) {
+    if (_numExecutedCommands == 0) {
+        // nothing was buffered, still tell whoever started it
+        ExecutionStats empty{};
+        empty.time = 0;
+        empty.executed = 0;
+        empty.success = true;
+        empty.failure = EF_NONE;
+        empty.lastCommandID = 0;
+        empty.remaining = 0;
+        empty.finished = true;
+        empty.bank = _activeBank;
+        empty.bankDone = true;
+        reportSlice(empty);
+    }
 
-        _isExecuting = false;
+    ExecutionStats stats{};
+    stats.time = Clock::millis() - _startTime;
+    stats.executed = saturate<uint8_t>(_numExecutedCommands);
+    stats.success = success;
+    stats.failure = failure;
+    stats.lastCommandID = _lastCommandID;
+    stats.remaining = 0;
+    stats.finished = true;
+    stats.bank = _activeBank;
+    stats.bankDone = true;
+    _isExecuting = false;
+    _numExecutedCommands = 0;
+    _queuedBanks.clear();
+
+    for (auto& callback : _onExecutionCompleteCallbacks) {
+        callback(stats);
     }
 }
 
+void CommandBuffer::reportSlice(const ExecutionStats& stats) {
+    for (auto& callback : _onSliceCompleteCallbacks) {
+        callback(stats);
+    }
+}
+
+void CommandBuffer::onExecutionComplete(std::function<void(ExecutionStats)> callback) {
+    _onExecutionCompleteCallbacks.push_back(callback);
+}
+
+void CommandBuffer::onSliceComplete(std::function<void(ExecutionStats)> callback) {
+    _onSliceCompleteCallbacks.push_back(callback);
+}
+
 void CommandBuffer::setHandler(CommandType type, std::shared_ptr<CommandHandler> handler) {
+    if (type >= CMD_COUNT) return;
     _handlers[type] = handler;
 }
 
-void CommandBuffer::startExecution() {
+void CommandBuffer::startExecution(uint8_t bank) {
+    if (bank >= kNumCommandBanks) {
+        COMMS_DEBUG_PRINT_ERRORLN("Command bank %d doesn't exist!", bank);
+        return;
+    }
+
     if (_isExecuting) {
-        std::cerr << "Command buffer is already executing" << std::endl;
+        if (bank == _activeBank) {
+            std::cerr << "Command buffer is already executing" << std::endl;
+            return;
+        }
+        for (uint8_t queued : _queuedBanks) {
+            if (queued == bank) return;
+        }
+        // preloaded while another bank runs, it takes over at the slice that empties that bank
+        _queuedBanks.push_back(bank);
         return;
     }
 
-    this->_startTime = millis();
+    this->_startTime = Clock::millis();
+    _numExecutedCommands = 0;
+    _lastCommandID = 0;
+    _activeBank = bank;
+    _currentSlice = CommandSlice::empty();
 
     _isExecuting = true;
 }
 
+void CommandBuffer::startExecutionAt(uint32_t localTimeUs, uint8_t bank) {
+    if (bank >= kNumCommandBanks) {
+        COMMS_DEBUG_PRINT_ERRORLN("Command bank %d doesn't exist!", bank);
+        return;
+    }
+
+    _isStartScheduled[bank] = true;
+    _scheduledStartUs[bank] = localTimeUs;
+    tick();
+}
+
 void CommandBuffer::clear() {
-    _commands.clear();
+    for (auto& commands : _banks) commands.clear();
+    _queuedBanks.clear();
     _currentSlice = CommandBuffer::CommandSlice::empty();
+    _numCompletedCommands = 0;
+}
+
+bool CommandBuffer::clearBank(uint8_t bank) {
+    if (bank >= kNumCommandBanks || (_isExecuting && bank == _activeBank)) return false;
+
+    _banks[bank].clear();
+    for (size_t i = 0; i < _queuedBanks.size();) {
+        if (_queuedBanks[i] == bank) {
+            _queuedBanks.erase(_queuedBanks.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    return true;
 }
 
 void CommandBuffer::reset() {
@@ -105,54 +330,125 @@ bool CommandBuffer::CommandSlice::isEmpty(const CommandSlice& slice) {
 }
 
 CommandBuffer::CommandSlice CommandBuffer::findNextSlice(const CommandSlice& currentSlice) {
-    std::size_t start = currentSlice.end();
-    std::size_t end = currentSlice.end();
+    // a finished slice is erased, so the next one always starts at the front
+    const std::vector<CommandMessagePayload>& commands = _banks[_activeBank];
+    std::size_t start = CommandSlice::isEmpty(currentSlice) ? 0 : currentSlice.end();
+    std::size_t end = start;
 
-    if (start >= _commands.size()) {
+    if (start >= commands.size()) {
         return CommandSlice::empty();
     }
 
-    std::vector<CommandMessagePayload> slice(_commands.size());
-
-    for (std::size_t i = currentSlice.end(); i < _commands.size(); i++) {
-        slice.push_back(_commands[i]);
-        CommandMessagePayload commandPayload = _commands[i];
+    std::vector<CommandMessagePayload> slice;
 
-        std::shared_ptr<CommandHandler> handler = _handlers[commandPayload.commandID];
-        if (handler == nullptr) continue;  // no handler
+    for (std::size_t i = start; i < commands.size(); i++) {
+        slice.push_back(commands[i]);
+        CommandMessagePayload commandPayload = commands[i];
 
-        if (!handler->isParallelizable(slice)) {
-            end = i + 1;
+        // the handler of the joining command decides, the first command always starts a slice
+        std::shared_ptr<CommandHandler> handler = _handlers[commandPayload.type];
+        if (i > start && (handler == nullptr || !handler->isParallelizable(slice))) {
             break;
         }
+        end = i + 1;
     }
 
     return CommandSlice(start, end);
 }
 
-CommandManager::CommandManager(CommsDriver* driver, MCUID me) : _driver(driver), _me(me) {}
+CommandManager::CommandManager(MessageOutbox* driver, MCUID me)
+    : _driver(driver), _me(me), _batch(driver) {
+    _typeQoS.fill(QOS_RELIABLE);
+    _typeQoS[CMD_MOTION] = QOS_BEST_EFFORT;
+
+    if (_me != MCUID::MCU_HIGH_LEVEL) {
+        _cmdBuf.onSliceComplete([this](CommandBuffer::ExecutionStats stats) {
+            sendExecutionStatus(stats);
+        });
+    }
+}
+
+void CommandManager::setCommandHandler(CommandType type, std::shared_ptr<CommandHandler> handler) {
+    _cmdBuf.setHandler(type, handler);
+}
+
+void CommandManager::setQoS(CommandType type, QoSPolicy policy) {
+    if (type >= CMD_COUNT) return;
+    if (type == CMD_MOTION && policy == QOS_RELIABLE) {
+        COMMS_DEBUG_PRINT_ERRORLN("Motion can't be reliable, it is never acknowledged!");
+        return;
+    }
+    _typeQoS[type] = policy;
+}
+
+void CommandManager::setQoS(CommandType type, MCUID target, uint8_t motor, QoSPolicy policy) {
+    if (type == CMD_MOTION && policy == QOS_RELIABLE) {
+        COMMS_DEBUG_PRINT_ERRORLN("Motion can't be reliable, it is never acknowledged!");
+        return;
+    }
+    CommandMessagePayload key(type, _me, 0, type == CMD_MOTION ? target : target | motor << 8);
+    _streamQoS[key.streamKey()] = policy;
+}
+
+QoSPolicy CommandManager::qosOf(uint32_t streamKey) const {
+    auto it = _streamQoS.find(streamKey);
+    if (it != _streamQoS.end()) return it->second;
+
+    uint8_t type = static_cast<uint8_t>(streamKey >> 16);
+    return type < CMD_COUNT ? _typeQoS[type] : QOS_RELIABLE;
+}
+
+void CommandManager::queueLatest(uint32_t streamKey, const RawCommsMessage& message,
+                                 bool replace) {
+    if (replace) {
+        for (size_t i = 0; i < _latestValueFrames.size();) {
+            if (_latestValueFrames[i].streamKey == streamKey) {
+                _latestValueFrames.erase(_latestValueFrames.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+    _latestValueFrames.push_back(LatestValueFrame{streamKey, message});
+}
 
 void CommandManager::tick() {
-    if (_startCommandEnqueued && _unackedCommands.size() == 0) {
-        // we are good to go!
-        _driver->sendMessage(_startCommandMessage);
-        _startCommandEnqueued = false;
+    COMMS_PROFILE_ZONE(PZ_COMMANDS);
+    if (_me != MCUID::MCU_HIGH_LEVEL) {
+        _cmdBuf.tick();
+        return;
     }
 
+    dispatchStarts();
+
     // figure out if we need to retransmit
-    uint32_t now = millis();
+    uint32_t now = Clock::millis();
     for (auto& pair : _unackedCommands) {
-        if (now - pair.second.lastSent > 1000) {
+        if (now - pair.second.lastSent >= kRetransmitIntervalMs) {
             // retransmit
-            if (pair.second.numRetries <= 3) {
+            if (pair.second.numRetries < kMaxRetransmissions) {
                 _driver->sendMessage(pair.second.message);
                 pair.second.numRetries++;
+                pair.second.lastSent = now;
                 COMMS_DEBUG_PRINT("Retransmitting command...");
             } else {
                 // mark for removal
                 CommandMessagePayload payload =
                     CommandMessagePayload::fromRaw(pair.second.message).value();
                 _toRemoveUnackedCommands.push_back(payload.commandID);
+                _completions.resolve(pair.second.completion, CS_TIMED_OUT);
+
+                // the node will never be ready, so its group can't start together
+                uint8_t bit = static_cast<uint8_t>(1 << pair.second.target);
+                for (size_t i = 0; i < _pendingStarts.size();) {
+                    if (_pendingStarts[i].groupMask & bit) {
+                        COMMS_DEBUG_PRINT_ERRORLN("Cancelling start, node %d never acknowledged",
+                                                  pair.second.target);
+                        _pendingStarts.erase(_pendingStarts.begin() + i);
+                    } else {
+                        i++;
+                    }
+                }
             }
         }
     }
@@ -162,84 +458,325 @@ void CommandManager::tick() {
         _unackedCommands.erase(commandID);
     }
     _toRemoveUnackedCommands.clear();
+
+    // last, so the callbacks and coroutines see this tick's retransmissions and give-ups
+    _completions.runCompletions();
 }
 
-void CommandManager::sendCommand(CommandMessagePayload payload) {
+CommandTicket CommandManager::sendCommand(CommandMessagePayload payload) {
     if (_me != MCUID::MCU_HIGH_LEVEL) {
         // we should not be able to send the command
         COMMS_DEBUG_PRINT_ERRORLN("Unable to send a command! We are not high level!");
+        return CommandTicket(CS_NOT_SENT);
+    }
+
+    if (payload.commandType() == CommandType::CMD_BEGIN) {
+        // an unsynchronized start, once the target has acknowledged everything sent to it
+        MCUID target = targetOf(payload);
+        if (target == MCUID::MCU_LOW_LEVEL_ANY || target == MCUID::MCU_ANY) {
+            // only the nodes known to be on the bus, a missing one would never become ready
+            std::vector<MCUID> present;
+            for (MCUID node : kLowLevelNodes) {
+                if ((_answeredNodes & (1 << node)) != 0 || !isNodeReady(node)) {
+                    present.push_back(node);
+                }
+            }
+            if (present.empty()) {
+                COMMS_DEBUG_PRINT_ERRORLN("Unable to start! No low level node has answered yet");
+                return CommandTicket(CS_NOT_SENT);
+            }
+            beginExecution(present, 0, payload.bank());
+        } else {
+            beginExecution({target}, 0, payload.bank());
+        }
+        COMMS_DEBUG_PRINTLN("Enqueuing start command!");
+        return CommandTicket(CS_UNTRACKED);
+    }
+
+    return sendWithPolicy(payload, qosOf(payload.streamKey()));
+}
+
+void CommandManager::beginExecution(const std::vector<MCUID>& group, uint32_t leadTimeUs,
+                                    uint8_t bank) {
+    if (_me != MCUID::MCU_HIGH_LEVEL) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to begin execution! We are not high level!");
+        return;
+    }
+
+    if (bank >= kNumCommandBanks) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to begin execution! Command bank %d doesn't exist", bank);
         return;
     }
 
-    RawCommsMessage raw;
+    PendingStart start{0, leadTimeUs, bank};
+    for (MCUID node : group) start.groupMask |= static_cast<uint8_t>(1 << node);
+    _pendingStarts.push_back(start);
+    dispatchStarts();
+}
+
+bool CommandManager::isNodeReady(MCUID node) const {
+    for (const auto& pair : _unackedCommands) {
+        if (pair.second.target == node) return false;
+    }
+    return true;
+}
+
+void CommandManager::dispatchStarts() {
+    for (size_t i = 0; i < _pendingStarts.size();) {
+        PendingStart start = _pendingStarts[i];
+
+        bool ready = true;
+        for (uint8_t node = 0; node < 8 && ready; node++) {
+            if (start.groupMask & (1 << node)) ready = isNodeReady(static_cast<MCUID>(node));
+        }
+        if (!ready) {
+            i++;
+            continue;
+        }
+
+        // every node gets the same start time, the bus time is our own clock
+        uint32_t startAtBusUs = Clock::micros() + start.leadTimeUs;
+        for (uint8_t node = 0; node < 8; node++) {
+            if ((start.groupMask & (1 << node)) == 0) continue;
+
+            MCUID target = static_cast<MCUID>(node);
+            BeginExecutionCommandOpt opt = start.leadTimeUs == 0
+                                               ? BeginExecutionCommandOpt(target)
+                                               : BeginExecutionCommandOpt(target, startAtBusUs);
+            CommandMessagePayload begin = CommandBuilder::beginExecution(_me, opt);
+            CommandTicket ticket =
+                sendWithPolicy(CommandBuilder::inBank(begin, start.bank), QOS_RELIABLE);
+            ticket.onComplete([target](CommandStatus status) {
+                if (status != CS_NACKED) return;
+                COMMS_DEBUG_PRINT_ERRORLN("%d refused its start as too late, start the group again",
+                                          target);
+            });
+        }
+        _pendingStarts.erase(_pendingStarts.begin() + i);
+    }
+}
+
+CommandTicket CommandManager::sendWithPolicy(CommandMessagePayload payload, QoSPolicy policy) {
+    if (policy == QOS_BEST_EFFORT) {
+        payload.type = static_cast<CommandType>(payload.type | CommandMessagePayload::kNoAckFlag);
+    }
+
+    RawCommsMessage raw{};
+    raw.length = sizeof(payload.raw);
     raw.payload = payload.raw;
 
     Option<uint32_t> idOpt = MessageInfo::getMessageID(_me, MessageContentType::MT_COMMAND);
     if (idOpt.isNone()) {
         COMMS_DEBUG_PRINT_ERRORLN(
             "Unable to send a command! No ID found for command messages for me\n");
-        return;
+        return CommandTicket(CS_NOT_SENT);
     }
     raw.id = idOpt.value();
 
-    if (payload.type == CommandType::CMD_BEGIN) {
-        // enqueue the command
-        _startCommandEnqueued = true;
-        _startCommandMessage = raw;
-        COMMS_DEBUG_PRINTLN("Enqueuing start command!");
-        return;
+    uint32_t streamKey = payload.streamKey();
+    if (policy == QOS_BEST_EFFORT) {
+        sendFrame(raw);
+        return CommandTicket(CS_UNTRACKED);
     }
 
-    _driver->sendMessage(raw);
+    if (policy == QOS_LATEST_VALUE) {
+        // the older commands of the stream are given up on, only this one is retransmitted
+        for (auto it = _unackedCommands.begin(); it != _unackedCommands.end();) {
+            if (it->second.streamKey == streamKey) {
+                _completions.resolve(it->second.completion, CS_SUPERSEDED);
+                it = _unackedCommands.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        queueLatest(streamKey, raw, true);
+    } else {
+        sendFrame(raw);
+    }
 
     // add this to the list of unacknowledged commands
     CommandAcknowledgementInfo ackInfo;
-    ackInfo.lastSent = millis();
+    ackInfo.lastSent = Clock::millis();
     ackInfo.numRetries = 0;
     ackInfo.message = raw;
+    ackInfo.target = targetOf(payload);
+    ackInfo.streamKey = streamKey;
+    CommandTicket ticket = _completions.acquire(&ackInfo.completion);
 
     _unackedCommands[payload.commandID] = ackInfo;
+    return ticket;
 }
 
-void CommandManager::handleCommandMessage(MessageInfo info, RawCommsMessage message) {
+void CommandManager::sendMotion(const MotionCommand& motion) {
+    if (_me != MCUID::MCU_HIGH_LEVEL) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send motion! We are not high level!");
+        return;
+    }
+
+    Option<uint32_t> idOpt = MessageInfo::getMessageID(_me, MessageContentType::MT_COMMAND);
+    if (idOpt.isNone()) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send motion! No ID found for command messages for me");
+        return;
+    }
+
+    MotionFramePayload frames[MotionCommand::kMaxFrames];
+    uint8_t count = motion.toFrames(_motionSequence++, frames);
+    if (count == 0) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send motion! No setpoints were set");
+        return;
+    }
+
+    CommandMessagePayload key(CMD_MOTION, _me, 0, motion.target());
+    bool latest = qosOf(key.streamKey()) == QOS_LATEST_VALUE;
+    for (uint8_t i = 0; i < count; i++) {
+        RawCommsMessage raw{};
+        raw.id = idOpt.value();
+        raw.length = sizeof(frames[i].raw);
+        raw.payload = frames[i].raw;
+        if (latest) {
+            // the whole group replaces the queued one
+            queueLatest(key.streamKey(), raw, i == 0);
+        } else {
+            sendFrame(raw);
+        }
+    }
+}
+
+void CommandManager::handleCommandMessage(MessageInfo info, RawCommsMessage message,
+                                          const BusTimeSync& timeSync) {
     Result<CommandMessagePayload> cmdRes = CommandMessagePayload::fromRaw(message);
     if (cmdRes.isError()) {
-        COMMS_DEBUG_PRINT_ERROR("Unable to handle command: %s,", cmdRes.error());
+        COMMS_DEBUG_PRINT_ERROR("Unable to handle command: %s,", cmdRes.error().c_str());
         return;
     }
 
     CommandMessagePayload cmd = cmdRes.value();
     if (_me != MCUID::MCU_HIGH_LEVEL) {
-        // acknoweldge the command by copying the payload
-        RawCommsMessage ack;
-        ack.payload = cmd.raw;
-        _driver->sendMessage(ack);
+        // commands go to every node, and only the target may acknowledge one
+        MCUID target = targetOf(cmd);
+        if (target != _me && target != MCUID::MCU_LOW_LEVEL_ANY && target != MCUID::MCU_ANY) {
+            return;
+        }
+
+        bool wantsAck = (cmd.type & CommandMessagePayload::kNoAckFlag) == 0;
+        uint8_t bank = cmd.bank();
+        cmd.type = cmd.commandType();
 
+        bool accepted = true;
         switch (cmd.type) {
-            case CMD_BEGIN:
-                _cmdBuf.startExecution();
+            case CMD_BEGIN: {
+                BeginExecutionCommandOpt begin = BeginExecutionCommandOpt::fromPayload(cmd.payload);
+                if (!begin.isSynchronized()) {
+                    _cmdBuf.startExecution(bank);
+                    break;
+                }
+                if (!timeSync.isSynced()) {
+                    COMMS_DEBUG_PRINT_ERRORLN("Starting now, no bus time to synchronize to yet!");
+                    _cmdBuf.startExecution(bank);
+                    break;
+                }
+                uint32_t now = Clock::micros();
+                uint32_t startAtBusUs = begin.startAtBusUs(timeSync.toBus(now));
+                uint32_t startAtUs = timeSync.toLocal(startAtBusUs);
+                if (static_cast<int32_t>(now - startAtUs) > static_cast<int32_t>(kStartGraceUs)) {
+                    COMMS_DEBUG_PRINT_ERRORLN("Refusing a start %lu us late!",
+                                              static_cast<unsigned long>(now - startAtUs));
+                    accepted = false;
+                    break;
+                }
+                _cmdBuf.startExecutionAt(startAtUs, bank);
                 break;
+            }
             case CMD_STOP:
                 COMMS_DEBUG_PRINT_ERROR("Command stop unimplemented!!!");
+                accepted = false;
                 break;
             case CMD_MOTOR_CONTROL:
-                _cmdBuf.addCommand(cmd);
+                _cmdBuf.addCommand(cmd, bank);
+                break;
+            case CMD_CLEAR_BANK:
+                // the running bank can't be swapped out from under its handlers
+                accepted = _cmdBuf.clearBank(bank);
                 break;
             default:
                 COMMS_DEBUG_PRINT_ERRORLN("Invalid command recieved!");
+                accepted = false;
                 break;
         }
+
+        // acknoweldge the command by copying the payload, or refuse it so the sender stops waiting
+        Option<uint32_t> ackIdOpt = MessageInfo::getMessageID(_me, MessageContentType::MT_COMMAND);
+        if (wantsAck && ackIdOpt.isSome()) {
+            CommandMessagePayload answer = cmd;
+            if (!accepted) {
+                answer.type =
+                    static_cast<CommandType>(answer.type | CommandMessagePayload::kNackFlag);
+            }
+
+            RawCommsMessage ack{};
+            ack.id = ackIdOpt.value();
+            ack.length = sizeof(answer.raw);
+            ack.payload = answer.raw;
+            sendFrame(ack);
+        }
     } else {
         // we are recieving an acknowledgement
+        if (info.sender < 8) _answeredNodes |= static_cast<uint8_t>(1 << info.sender);
+
         // check if it's true
-        if (_unackedCommands.find(cmd.commandID) == _unackedCommands.end()) {
-            // we recieved an ack for a command that we never sent
-            COMMS_DEBUG_PRINT_ERRORLN("Received acknowledgement for command %d but don't need one!",
-                                      cmd.commandID);
+        auto it = _unackedCommands.find(cmd.commandID);
+        if (it == _unackedCommands.end()) {
+            // a retransmission was acknowledged twice, or a newer value replaced the command
+            COMMS_DEBUG_PRINTLN("Received acknowledgement for command %d but don't need one!",
+                                cmd.commandID);
             return;
         }
 
+        // a refused command isn't retransmitted either, the target would refuse it again
+        bool refused = (cmd.type & CommandMessagePayload::kNackFlag) != 0;
+        _completions.resolve(it->second.completion, refused ? CS_NACKED : CS_ACKED);
+
         // erase it from the unacked commdns
-        _unackedCommands.erase(cmd.commandID);
+        _unackedCommands.erase(it);
+    }
+}
+
+void CommandManager::flush() {
+    for (const LatestValueFrame& frame : _latestValueFrames) {
+        sendFrame(frame.message);
+    }
+    _latestValueFrames.clear();
+    _batch.flush();
+}
+
+void CommandManager::sendExecutionStatus(const CommandBuffer::ExecutionStats& stats) {
+    Option<uint32_t> idOpt = MessageInfo::getMessageID(_me, MessageContentType::MT_EXEC_STATUS);
+    if (idOpt.isNone()) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send execution status! No ID found for me");
+        return;
+    }
+
+    ExecutionStatusPayload status;
+    status.flags = static_cast<uint8_t>(stats.bank << ExecutionStatusPayload::kBankShift);
+    if (stats.finished) status.flags |= ExecutionStatusPayload::kFlagExecutionDone;
+    if (stats.bankDone) status.flags |= ExecutionStatusPayload::kFlagBankDone;
+    status.failure = stats.failure;
+    status.lastCommandID = stats.lastCommandID;
+    status.executed = stats.executed;
+    status.remaining = saturate<uint8_t>(stats.remaining);
+    status.elapsedMs = saturate<uint16_t>(stats.time);
+
+    RawCommsMessage raw{};
+    raw.id = idOpt.value();
+    raw.length = sizeof(status.raw);
+    raw.payload = status.raw;
+    sendFrame(raw);
+}
+
+void CommandManager::sendFrame(const RawCommsMessage& message) {
+    if (!_driver->supportsFD()) {
+        _driver->sendMessage(message);
+        return;
     }
-}
\ No newline at end of file
+    _batch.add(message.id, message.payloadBytes);
+}
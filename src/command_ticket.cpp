@@ -0,0 +1,138 @@
+#include "impl/command_ticket.hpp"
+
+#include "impl/debug.hpp"
+
+namespace comms {
+
+CommandTicket::CommandTicket(CommandStatus status)
+    : _pool(nullptr), _slot(CommandCompletionRef::kNone), _status(status) {}
+
+CommandTicket::CommandTicket(CommandCompletionPool* pool, uint8_t slot)
+    : _pool(pool), _slot(slot), _status(CS_PENDING) {
+    _pool->addRef(_slot);
+}
+
+CommandTicket::CommandTicket(const CommandTicket& other)
+    : _pool(other._pool), _slot(other._slot), _status(other._status) {
+    if (_pool != nullptr) _pool->addRef(_slot);
+}
+
+CommandTicket& CommandTicket::operator=(const CommandTicket& other) {
+    if (this == &other) return *this;
+
+    // take the new reference first, the two may share a slot
+    if (other._pool != nullptr) other._pool->addRef(other._slot);
+    if (_pool != nullptr) _pool->release(_slot);
+
+    _pool = other._pool;
+    _slot = other._slot;
+    _status = other._status;
+    return *this;
+}
+
+CommandTicket::~CommandTicket() {
+    if (_pool != nullptr) _pool->release(_slot);
+}
+
+CommandStatus CommandTicket::status() const {
+    if (_pool == nullptr) return _status;
+    return _pool->_slots[_slot].status;
+}
+
+void CommandTicket::onComplete(std::function<void(CommandStatus)> callback) {
+    if (callback == nullptr) return;
+
+    if (_pool == nullptr) {
+        callback(_status);
+        return;
+    }
+
+    CommandCompletionPool::Slot& slot = _pool->_slots[_slot];
+    if (slot.status != CS_PENDING && !slot.completionDue) {
+        // resolved and its completion already ran, nothing will call this later
+        callback(slot.status);
+        return;
+    }
+    slot.callback = callback;
+}
+
+CommandCompletionPool::CommandCompletionPool() {
+    for (Slot& slot : _slots) {
+        slot.used = false;
+        slot.completionDue = false;
+        slot.refs = 0;
+        slot.generation = 0;
+        slot.status = CS_PENDING;
+    }
+}
+
+CommandTicket CommandCompletionPool::acquire(CommandCompletionRef* ref) {
+    for (uint8_t i = 0; i < kCapacity; i++) {
+        Slot& slot = _slots[i];
+        if (slot.used) continue;
+
+        slot.used = true;
+        slot.completionDue = false;
+        slot.status = CS_PENDING;
+        *ref = CommandCompletionRef(i, slot.generation);
+        return CommandTicket(this, i);
+    }
+
+    COMMS_DEBUG_PRINTLN("Every command ticket is in use, the command won't be tracked");
+    *ref = CommandCompletionRef();
+    return CommandTicket(CS_UNTRACKED);
+}
+
+void CommandCompletionPool::resolve(CommandCompletionRef ref, CommandStatus status) {
+    if (ref.slot >= kCapacity) return;
+
+    Slot& slot = _slots[ref.slot];
+    if (!slot.used || slot.generation != ref.generation || slot.status != CS_PENDING) return;
+
+    slot.status = status;
+    slot.completionDue = true;
+}
+
+void CommandCompletionPool::runCompletions() {
+    for (uint8_t i = 0; i < kCapacity; i++) {
+        Slot& slot = _slots[i];
+        if (!slot.used || !slot.completionDue) continue;
+
+        slot.completionDue = false;
+        if (slot.callback != nullptr) {
+            // take it out first, resuming a coroutine may drop the last ticket and free the slot
+            std::function<void(CommandStatus)> callback = std::move(slot.callback);
+            slot.callback = nullptr;
+            callback(slot.status);
+        }
+        freeIfUnused(i);
+    }
+}
+
+size_t CommandCompletionPool::inUse() const {
+    size_t count = 0;
+    for (const Slot& slot : _slots) {
+        if (slot.used) count++;
+    }
+    return count;
+}
+
+void CommandCompletionPool::addRef(uint8_t slot) {
+    _slots[slot].refs++;
+}
+
+void CommandCompletionPool::release(uint8_t slot) {
+    _slots[slot].refs--;
+    freeIfUnused(slot);
+}
+
+void CommandCompletionPool::freeIfUnused(uint8_t slot) {
+    Slot& s = _slots[slot];
+    if (!s.used || s.refs != 0 || s.callback != nullptr || s.completionDue) return;
+
+    // a command still unacknowledged refers to the old generation, its answer is ignored now
+    s.used = false;
+    s.generation++;
+}
+
+}  // namespace comms
@@ -1,24 +1,90 @@
 #include "comms.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 namespace comms {
 
-CommsController::CommsController(CommsDriver& driver, MCUID id)
-    : _driver(driver),
-      _me(id),
-      _heartbeatManager(&driver, id),
-      _errorManager(&driver, id),
-      _commandManager(&driver, id) {}
+namespace {
+
+/// @brief Packs a sender and sensor ID into the key of a sensor history
+uint16_t historyKey(MCUID sender, uint8_t sensorID) {
+    return static_cast<uint16_t>(sender << 8 | sensorID);
+}
+
+}  // namespace
+
+CommsControllerBase::CommsControllerBase(CommsDriver& driver, MCUID id)
+    : _outbox(&driver),
+      _commandManager(&_outbox, id),
+      _lastBackgroundUs(0),
+      _snapshotDirty(false),
+      _nextSubscriptionID(0),
+      _notifyDepth(0),
+      _heartbeatManager(&_outbox, id),
+      _errorManager(&_outbox, id),
+      _motionReceiver(id),
+      _transport(nullptr),
+      _me(id) {}
 
-void CommsController::initialize() {
-    _driver.install();
+void CommsControllerBase::initialize() {
+    _outbox.install();
     _errorManager.initialize(500);
 }
 
-void CommsController::sendCommand(CommandMessagePayload payload) {
-    _commandManager.sendCommand(payload);
+CommandTicket CommsControllerBase::sendCommand(CommandMessagePayload payload) {
+    return _commandManager.sendCommand(payload);
+}
+
+void CommsControllerBase::sendMotion(const MotionCommand& motion) {
+    _commandManager.sendMotion(motion);
+}
+
+void CommsControllerBase::setCommandQoS(CommandType type, QoSPolicy policy) {
+    _commandManager.setQoS(type, policy);
+}
+
+void CommsControllerBase::setCommandQoS(CommandType type, MCUID target, uint8_t motor,
+                                        QoSPolicy policy) {
+    _commandManager.setQoS(type, target, motor, policy);
+}
+
+void CommsControllerBase::beginExecution(const std::vector<MCUID>& group, uint32_t leadTimeUs,
+                                         uint8_t bank) {
+    _commandManager.beginExecution(group, leadTimeUs, bank);
+}
+
+bool CommsControllerBase::isNodeReady(MCUID node) const {
+    return _commandManager.isNodeReady(node);
+}
+
+void CommsControllerBase::onExecutionStatus(
+    std::function<void(const ExecutionReport&)> callback) {
+    _executionMonitor.onExecutionStatus(callback);
+}
+
+Option<ExecutionMetrics> CommsControllerBase::getExecutionMetrics(MCUID node) const {
+    return _executionMonitor.metrics(node);
+}
+
+void CommsControllerBase::setCommandHandler(CommandType type,
+                                            std::shared_ptr<CommandHandler> handler) {
+    _commandManager.setCommandHandler(type, handler);
+}
+
+uint32_t CommsControllerBase::busTimeUs() const {
+    return _heartbeatManager.timeSync().toBus(Clock::micros());
+}
+
+bool CommsControllerBase::isBusTimeSynced() const {
+    return _heartbeatManager.timeSync().isSynced();
+}
+
+void CommsControllerBase::setMotionHandler(std::function<void(const MotionSetpoints&)> handler) {
+    _motionReceiver.setHandler(handler);
 }
 
-Option<float> CommsController::getSensorValue(MCUID sender, uint8_t sensorID) {
+Option<float> CommsControllerBase::getSensorValue(MCUID sender, uint8_t sensorID) {
     // simple linear search
     bool found = false;
     SensorStatus status;
@@ -35,35 +101,222 @@ Option<float> CommsController::getSensorValue(MCUID sender, uint8_t sensorID) {
     return Option<float>::none();
 }
 
-void CommsController::enableHeartbeatRequestDispatching(uint32_t intvervalMs,
-                                                        const std::vector<MCUID> toMonitor) {
+bool CommsControllerBase::isSensorAlive(MCUID sender, uint8_t sensorID, uint32_t timeoutMs) {
+    for (const SensorStatus& s : _sensorStatuses) {
+        if (s.sender == sender && s.sensorID == sensorID) {
+            return Clock::millis() - s.lastUpdateTime <= timeoutMs;
+        }
+    }
+
+    return false;
+}
+
+Option<SensorEnvelope> CommsControllerBase::getSensorEnvelope(MCUID sender, uint8_t sensorID) {
+    for (const SensorStatus& s : _sensorStatuses) {
+        if (s.sender == sender && s.sensorID == sensorID) {
+            return Option<SensorEnvelope>::some(SensorEnvelope{s.min, s.max});
+        }
+    }
+
+    return Option<SensorEnvelope>::none();
+}
+
+bool CommsControllerBase::snapshotNode(MCUID sender, SensorSnapshot* out) const {
+    return _snapshotTable.readNode(sender, out);
+}
+
+bool CommsControllerBase::snapshotGroup(const SensorKey* sensors, size_t count,
+                                        SensorSnapshot* out) const {
+    return _snapshotTable.readGroup(sensors, count, out);
+}
+
+void CommsControllerBase::publishSnapshot() {
+    if (!_snapshotDirty) return;
+    COMMS_PROFILE_ZONE(PZ_SNAPSHOT);
+    _snapshotTable.publish(_sensorStatuses.data(), _sensorStatuses.size());
+    _snapshotDirty = false;
+}
+
+void CommsControllerBase::enableSensorHistory(MCUID sender, uint8_t sensorID, size_t capacity,
+                                              uint32_t windowMs) {
+    uint16_t key = historyKey(sender, sensorID);
+    _sensorHistories.erase(key);
+    _sensorHistories.emplace(key, SensorHistory(capacity, windowMs * 1000));
+}
+
+const SensorHistory* CommsControllerBase::getSensorHistory(MCUID sender, uint8_t sensorID) const {
+    auto it = _sensorHistories.find(historyKey(sender, sensorID));
+    if (it == _sensorHistories.end()) return nullptr;
+    return &it->second;
+}
+
+SubscriptionID CommsControllerBase::subscribeSensor(
+    MCUID sender, uint8_t sensorID, std::function<void(const SensorStatus&)> callback,
+    uint32_t minIntervalMs) {
+    SensorSubscription subscription{};
+    subscription.sender = sender;
+    subscription.sensorID = sensorID;
+    subscription.minIntervalMs = minIntervalMs;
+    subscription.callback = callback;
+    return addSubscription(subscription);
+}
+
+SubscriptionID CommsControllerBase::subscribeSensor(MCUID sender, uint8_t sensorID,
+                                                    SensorMailbox* mailbox,
+                                                    uint32_t minIntervalMs) {
+    SensorSubscription subscription{};
+    subscription.sender = sender;
+    subscription.sensorID = sensorID;
+    subscription.minIntervalMs = minIntervalMs;
+    subscription.mailbox = mailbox;
+    return addSubscription(subscription);
+}
+
+SubscriptionID CommsControllerBase::subscribeNode(
+    MCUID sender, std::function<void(const SensorStatus&)> callback, uint32_t minIntervalMs) {
+    SensorSubscription subscription{};
+    subscription.sender = sender;
+    subscription.allSensors = true;
+    subscription.minIntervalMs = minIntervalMs;
+    subscription.callback = callback;
+    return addSubscription(subscription);
+}
+
+bool CommsControllerBase::unsubscribe(SubscriptionID id) {
+    for (auto it = _subscriptions.begin(); it != _subscriptions.end(); it++) {
+        if (it->id != id || it->removed) continue;
+        if (_notifyDepth != 0) {
+            // erasing would shift the subscriptions a delivery is iterating over
+            it->removed = true;
+        } else {
+            _subscriptions.erase(it);
+        }
+        return true;
+    }
+    return false;
+}
+
+SubscriptionID CommsControllerBase::addSubscription(SensorSubscription subscription) {
+    subscription.id = _nextSubscriptionID++;
+    _subscriptions.push_back(subscription);
+    return subscription.id;
+}
+
+void CommsControllerBase::publishSample(SensorStatus& status) {
+    status.sampleTimeUs = Clock::micros();
+    _snapshotDirty = true;
+
+    if (!_sensorHistories.empty()) {
+        auto it = _sensorHistories.find(historyKey(status.sender, status.sensorID));
+        if (it != _sensorHistories.end()) it->second.push(status.sampleTimeUs, status.value);
+    }
+    notifySubscribers(status);
+}
+
+void CommsControllerBase::notifySubscribers(const SensorStatus& status) {
+    uint32_t now = Clock::millis();
+    _notifyDepth++;
+    // indexed, as a callback may subscribe and grow the vector
+    for (size_t i = 0; i < _subscriptions.size(); i++) {
+        SensorSubscription& subscription = _subscriptions[i];
+        if (subscription.removed || !subscription.matches(status.sender, status.sensorID)) {
+            continue;
+        }
+        if (subscription.delivered &&
+            now - subscription.lastDeliveryTime < subscription.minIntervalMs) {
+            continue;
+        }
+
+        subscription.delivered = true;
+        subscription.lastDeliveryTime = now;
+        if (subscription.mailbox != nullptr) {
+            subscription.mailbox->post(status);
+        } else if (subscription.callback) {
+            // copied, the callback may unsubscribe itself
+            std::function<void(const SensorStatus&)> callback = subscription.callback;
+            callback(status);
+        }
+    }
+    _notifyDepth--;
+
+    if (_notifyDepth == 0) {
+        _subscriptions.erase(
+            std::remove_if(_subscriptions.begin(), _subscriptions.end(),
+                           [](const SensorSubscription& s) { return s.removed; }),
+            _subscriptions.end());
+    }
+}
+
+void CommsControllerBase::enableHeartbeatRequestDispatching(uint32_t intvervalMs,
+                                                            const std::vector<MCUID> toMonitor) {
     _heartbeatManager.initialize(intvervalMs, toMonitor);
 }
 
-void CommsController::reportError(ErrorCode error, ErrorSeverity severity, ErrorBehavior behavior) {
+void CommsControllerBase::reportError(ErrorCode error, ErrorSeverity severity,
+                                      ErrorBehavior behavior) {
     _errorManager.reportError(error, severity, behavior);
 }
 
-void CommsController::clearError(ErrorCode error) {
+void CommsControllerBase::clearError(ErrorCode error) {
     _errorManager.clearError(error);
 }
 
-void CommsController::addSensor(uint32_t updateRateMs, uint8_t id, std::shared_ptr<Sensor> sensor) {
-    SensorDatastream stream(&_driver, me(), updateRateMs, id, sensor);
+void CommsControllerBase::addSensor(uint32_t updateRateMs, uint8_t id,
+                                    std::shared_ptr<Sensor> sensor,
+                                    SensorTransmissionPolicy policy) {
+    SensorDatastream stream(&_outbox, me(), updateRateMs, id, sensor, policy);
     stream.initialize();
     _sensorDatastreams[id] = stream;
 }
 
-Option<CommsTickResult> CommsController::tick() {
-    COMMS_DEBUG_PRINTLN("Listening...");
-    updateDatastreams();
+void CommsControllerBase::addSensor(uint32_t updateRateMs, uint8_t id,
+                                    std::shared_ptr<AsyncSensor> sensor,
+                                    SensorTransmissionPolicy policy) {
+    SensorDatastream stream(&_outbox, me(), updateRateMs, id, sensor, policy);
+    stream.initialize();
+    _sensorDatastreams[id] = stream;
+}
+
+bool CommsControllerBase::setSensorSampling(uint8_t sensorID, SensorSamplingConfig sampling) {
+    auto it = _sensorDatastreams.find(sensorID);
+    if (it == _sensorDatastreams.end()) return false;
+
+    it->second.setSampling(sampling);
+    return true;
+}
+
+void CommsControllerBase::tickManagers(bool fd) {
+    updateDatastreams(fd);
     updateHeartbeats();
     _commandManager.tick();
+    _motionReceiver.tick();
     _errorManager.tick();
+    if (_transport != nullptr) _transport->tick();
+}
 
-    RawCommsMessage message;
-    if (!_driver.receiveMessage(&message)) return Option<CommsTickResult>::none();
+void CommsControllerBase::tickUrgent() {
+    _motionReceiver.tick();
+    _commandManager.tick();
+}
+
+void CommsControllerBase::tickManagersWithinBudget(bool fd, uint32_t startUs,
+                                                   CommsTickReport* report) {
+    _errorManager.tick();
+    updateDatastreamsWithinBudget(fd, startUs, report);
+
+    // heartbeats are checked over seconds, a few milliseconds late costs nothing
+    uint32_t now = Clock::micros();
+    if (!withinBudget(startUs, *report) && now - _lastBackgroundUs < kMaxBackgroundDelayUs) {
+        report->backgroundDeferred = true;
+        return;
+    }
+    _lastBackgroundUs = now;
+    updateHeartbeats();
+    if (_transport != nullptr) _transport->tick();
+}
 
+Option<CommsTickResult> CommsControllerBase::handleFrame(const RawCommsMessage& message,
+                                                         const uint8_t* bytes, uint8_t length) {
     Option<MessageInfo> senderInfoOpt = MessageInfo::getInfo(message.id);
     if (senderInfoOpt.isNone()) {
         if (_unregisteredMessageHandler != nullptr) {
@@ -95,69 +348,148 @@ Option<CommsTickResult> CommsController::tick() {
         return Option<CommsTickResult>::none();
     }
 
+    bool aggregated = length > FDRecordBatch::kRecordSize &&
+                      (info.type == MT_SENSOR_DATA || info.type == MT_COMMAND);
+    if (!aggregated) {
+        dispatch(info, message);
+    } else {
+        // a CAN FD frame packed with records, each is handled like its own message
+        for (uint8_t offset = 0; offset + FDRecordBatch::kRecordSize <= length;
+             offset += FDRecordBatch::kRecordSize) {
+            const uint8_t* recordBytes = bytes + offset;
+            if (FDRecordBatch::isPadding(recordBytes)) continue;
+
+            RawCommsMessage record{};
+            record.id = message.id;
+            record.length = FDRecordBatch::kRecordSize;
+            memcpy(record.payloadBytes, recordBytes, FDRecordBatch::kRecordSize);
+            dispatch(info, record);
+        }
+    }
+
+    CommsTickResult res{message, info};
+    return Option<CommsTickResult>::some(res);
+}
+
+void CommsControllerBase::dispatch(MessageInfo info, const RawCommsMessage& message) {
+    COMMS_PROFILE_ZONE(PZ_DISPATCH);
     switch (info.type) {
         case MessageContentType::MT_COMMAND:
-            _commandManager.handleCommandMessage(info, message);
+            if (info.sender == MCUID::MCU_HIGH_LEVEL && message.payloadBytes[0] == CMD_MOTION) {
+                MotionFramePayload frame;
+                frame.raw = message.payload;
+                _motionReceiver.handleFrame(frame, _heartbeatManager.timeSync());
+            } else {
+                _commandManager.handleCommandMessage(info, message,
+                                                     _heartbeatManager.timeSync());
+            }
             break;
         case MessageContentType::MT_HEARTBEAT:
-            // this is a response
-            if (_me != MCUID::MCU_HIGH_LEVEL) {
+            if (_me == MCUID::MCU_HIGH_LEVEL) {
+                // this is a response
                 _heartbeatManager.updateHeartbeatStatus(info.sender);
+            } else {
+                // this is a request, every one carries the bus time, only ours get an answer
+                HearbeatMessageRequestPayload request;
+                request.raw = message.payload;
+                _heartbeatManager.handleHeartbeatRequest(request);
             }
             break;
         case MessageContentType::MT_ERROR:
             _errorManager.handleErrorRecieve(info, message);
             break;
         case MessageContentType::MT_SENSOR_DATA:
-            {
-                SensorMessagePayload sensorPayload;
-                sensorPayload.raw = message.payload;
-                // find a sensor status and update it
-                bool found = false;
-                for (SensorStatus &status : _sensorStatuses) {
-                    if (status.sender == info.sender && status.sensorID == sensorPayload.sensorID) {
-                        // update this guy
-                        found = true;
-                        status.value = sensorPayload.value;
-                    }
-                }
-
-                if (!found) {
-                    // add a new sensor status
-                    COMMS_DEBUG_PRINTLN("Recieved sensor message for the first time!");
-                    SensorStatus status;
-                    status.sender = info.sender;
-                    status.sensorID = sensorPayload.sensorID;
-                    status.value = sensorPayload.value;
-                    _sensorStatuses.push_back(status);
-                }
-            }
+            handleSensorMessage(info, message);
+            break;
+        case MessageContentType::MT_TRANSPORT:
+            if (_transport != nullptr) _transport->handleMessage(message);
+            break;
+        case MessageContentType::MT_EXEC_STATUS:
+            if (_me == MCUID::MCU_HIGH_LEVEL) _executionMonitor.handleMessage(info, message);
             break;
         default:
             break;
     }
-
-    CommsTickResult res{message, info};
-    return Option<CommsTickResult>::some(res);
 }
 
-MCUID CommsController::me() const {
+MCUID CommsControllerBase::me() const {
     return _me;
 }
 
-void CommsController::setUnregisteredMessageHandler(std::function<void(RawCommsMessage)> handler) {
+void CommsControllerBase::setUnregisteredMessageHandler(
+    std::function<void(RawCommsMessage)> handler) {
     _unregisteredMessageHandler = handler;
 }
 
-void CommsController::updateDatastreams() {
+void CommsControllerBase::attachTransport(SegmentedTransport* transport) {
+    _transport = transport;
+}
+
+void CommsControllerBase::updateDatastreams(bool fd) {
+    COMMS_PROFILE_ZONE(PZ_SENSOR_STREAMS);
     // update all of our sensor datastreams
-    for (auto s : _sensorDatastreams) {
-        s.second.tick();
-        delayMicroseconds(1);
+    // frames land in the outbox, and go out together at the end of the tick
+    if (!fd) {
+        for (auto& s : _sensorDatastreams) {
+            s.second.tick();
+        }
+        return;
+    }
+
+    // on CAN FD, every reading due this tick shares as few frames as possible
+    FDRecordBatch batch(&_outbox);
+    RawCommsMessage message;
+    for (auto& s : _sensorDatastreams) {
+        if (s.second.poll(&message)) batch.add(message.id, message.payloadBytes);
+    }
+    batch.flush();
+}
+
+void CommsControllerBase::updateDatastreamsWithinBudget(bool fd, uint32_t startUs,
+                                                        CommsTickReport* report) {
+    COMMS_PROFILE_ZONE(PZ_SENSOR_STREAMS);
+    _dueDatastreams.clear();
+    for (auto& s : _sensorDatastreams) {
+        if (s.second.isDue()) _dueDatastreams.push_back(&s.second);
+    }
+    std::sort(_dueDatastreams.begin(), _dueDatastreams.end(),
+              [](const SensorDatastream* a, const SensorDatastream* b) {
+                  return a->overdueMs() > b->overdueMs();
+              });
+
+    FDRecordBatch batch(&_outbox);
+    RawCommsMessage message;
+    for (size_t i = 0; i < _dueDatastreams.size(); i++) {
+        if (i != 0 && !withinBudget(startUs, *report)) {
+            report->sensorsDeferred = static_cast<uint16_t>(_dueDatastreams.size() - i);
+            break;
+        }
+
+        if (!fd) {
+            _dueDatastreams[i]->tick();
+        } else if (_dueDatastreams[i]->poll(&message)) {
+            batch.add(message.id, message.payloadBytes);
+        }
+        report->sensorsUpdated++;
+    }
+
+    // streams that aren't due only take samples, if their sampling stage is enabled, unless one
+    // came due in the meantime
+    for (auto& s : _sensorDatastreams) {
+        if (!withinBudget(startUs, *report)) break;
+        if (s.second.isDue() || !s.second.poll(&message)) continue;
+
+        if (fd) {
+            batch.add(message.id, message.payloadBytes);
+        } else {
+            _outbox.sendMessage(message);
+        }
     }
+    batch.flush();
 }
 
-void CommsController::updateHeartbeats() {
+void CommsControllerBase::updateHeartbeats() {
+    COMMS_PROFILE_ZONE(PZ_HEARTBEATS);
     // update our heartbeat manager
     bool good = _heartbeatManager.tick() || _me != MCUID::MCU_HIGH_LEVEL;
     if (!good) {
@@ -165,4 +497,56 @@ void CommsController::updateHeartbeats() {
     }
 }
 
+namespace {
+
+/// @brief Applies a full or envelope frame to a sensor status
+void setSensorStatusValue(SensorStatus* status, const SensorMessagePayload& payload) {
+    status->value = payload.value;
+    status->max = payload.value;
+    status->min = payload.value;
+    if (payload.flags & SMF_ENVELOPE) {
+        status->min = payload.value - payload.envelopeSpan();
+    }
+}
+
+}  // namespace
+
+void CommsControllerBase::handleSensorMessage(MessageInfo info, RawCommsMessage message) {
+    SensorMessagePayload sensorPayload =
+        SensorMessagePayload::fromFrame(message.payload, message.length);
+    bool compact = message.length < SensorMessagePayload::kFullLength;
+
+    // find a sensor status and update it
+    for (SensorStatus& status : _sensorStatuses) {
+        if (status.sender != info.sender || status.sensorID != sensorPayload.sensorID) continue;
+
+        status.lastUpdateTime = Clock::millis();
+        if (sensorPayload.flags & SMF_KEEPALIVE) return;
+
+        if (compact && (sensorPayload.flags & SMF_DELTA)) {
+            status.value += std::ldexp(static_cast<float>(sensorPayload.delta),
+                                       sensorPayload.deltaExponent());
+            status.min = status.value;
+            status.max = status.value;
+        } else {
+            setSensorStatusValue(&status, sensorPayload);
+        }
+        publishSample(status);
+        return;
+    }
+
+    // compact frames mean nothing without a value to apply them to, wait for a full frame
+    if (compact) return;
+
+    // add a new sensor status
+    COMMS_DEBUG_PRINTLN("Recieved sensor message for the first time!");
+    SensorStatus status;
+    status.sender = info.sender;
+    status.sensorID = sensorPayload.sensorID;
+    setSensorStatusValue(&status, sensorPayload);
+    status.lastUpdateTime = Clock::millis();
+    _sensorStatuses.push_back(status);
+    publishSample(_sensorStatuses.back());
+}
+
 }  // namespace comms
@@ -0,0 +1,242 @@
+#include "impl/deferred_log.hpp"
+
+#ifdef COMMS_DEFERRED_LOG
+
+#include <stdio.h>
+
+#include "impl/clock.hpp"
+#include "impl/debug.hpp"
+
+namespace comms {
+
+namespace {
+
+constexpr size_t kMaxTextLength = 256;
+constexpr size_t kMaxSpecLength = 16;
+
+/// @brief Reads an argument of a record
+/// @return The bytes it took, or 0 if the record is cut short there
+size_t readArg(const uint8_t* args, size_t remaining, DeferredLogArgType* type, uint64_t* bits,
+               const char** text, uint8_t* textLength) {
+    if (remaining < 1) return 0;
+    *type = static_cast<DeferredLogArgType>(args[0]);
+
+    if (*type == DLA_STR) {
+        if (remaining < 2 || remaining < 2u + args[1]) return 0;
+        *textLength = args[1];
+        *text = reinterpret_cast<const char*>(&args[2]);
+        return 2 + args[1];
+    }
+
+    size_t size = (*type == DLA_I32 || *type == DLA_U32) ? 4 : 8;
+    if (remaining < 1 + size) return 0;
+    *bits = 0;
+    memcpy(bits, &args[1], size);
+    return 1 + size;
+}
+
+/// @brief Formats one conversion of a format string with one argument
+/// @param spec The conversion, e.g. "%04x", its length modifier is replaced to fit the argument
+void formatArg(char* out, size_t size, const char* spec, size_t specLength, DeferredLogArgType type,
+               uint64_t bits, const char* text, uint8_t textLength) {
+    char conversion = spec[specLength - 1];
+    bool wantsString = conversion == 's';
+    bool wantsFloat = strchr("eEfFgGaA", conversion) != nullptr;
+
+    // the flags, width and precision, without a length modifier
+    char base[kMaxSpecLength];
+    size_t baseLength = 0;
+    for (size_t i = 0; i + 1 < specLength && baseLength + 4 < sizeof(base); i++) {
+        if (strchr("hljztL", spec[i]) == nullptr) base[baseLength++] = spec[i];
+    }
+
+    char fmt[kMaxSpecLength];
+    if (wantsString && type == DLA_STR) {
+        snprintf(fmt, sizeof(fmt), "%.*ss", static_cast<int>(baseLength), base);
+        char copy[256];
+        memcpy(copy, text, textLength);
+        copy[textLength] = '\0';
+        snprintf(out, size, fmt, copy);
+    } else if (wantsFloat && type == DLA_F64) {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        snprintf(fmt, sizeof(fmt), "%.*s%c", static_cast<int>(baseLength), base, conversion);
+        snprintf(out, size, fmt, value);
+    } else if (conversion == 'c' && (type == DLA_I32 || type == DLA_U32)) {
+        snprintf(fmt, sizeof(fmt), "%.*sc", static_cast<int>(baseLength), base);
+        snprintf(out, size, fmt, static_cast<int>(bits));
+    } else if (!wantsString && !wantsFloat && type != DLA_STR && type != DLA_F64) {
+        // every integer is printed as a long long, a pointer as its address in hex
+        snprintf(fmt, sizeof(fmt), "%s%.*sll%c", conversion == 'p' ? "0x" : "",
+                 static_cast<int>(baseLength), base, conversion == 'p' ? 'x' : conversion);
+        if (type == DLA_I32) {
+            snprintf(out, size, fmt, static_cast<long long>(static_cast<int32_t>(bits)));
+        } else if (type == DLA_I64) {
+            snprintf(out, size, fmt, static_cast<long long>(bits));
+        } else {
+            snprintf(out, size, fmt, static_cast<unsigned long long>(bits));
+        }
+    } else {
+        // the argument doesn't match the conversion, printing it anyway could crash
+        snprintf(out, size, "?");
+    }
+}
+
+/// @brief Formats a record's message, the way printf would have
+void formatMessage(const DeferredLogRecord& record, char* out, size_t size) {
+    const char* format = record.site->format;
+    size_t length = 0;
+    size_t offset = 0;
+    uint8_t argIndex = 0;
+
+    auto append = [&](const char* text, size_t textLength) {
+        if (length + textLength >= size) textLength = size - 1 - length;
+        memcpy(out + length, text, textLength);
+        length += textLength;
+    };
+
+    for (const char* c = format; *c != '\0' && length + 1 < size; c++) {
+        if (*c != '%') {
+            append(c, 1);
+            continue;
+        }
+        if (c[1] == '%') {
+            append("%", 1);
+            c++;
+            continue;
+        }
+
+        // find the end of the conversion
+        size_t specLength = 1;
+        while (c[specLength] != '\0' && strchr("diouxXeEfFgGaAcsp", c[specLength]) == nullptr &&
+               specLength + 1 < kMaxSpecLength) {
+            specLength++;
+        }
+        if (c[specLength] == '\0') break;
+        specLength++;
+
+        char piece[kMaxTextLength];
+        DeferredLogArgType type;
+        uint64_t bits = 0;
+        const char* text = nullptr;
+        uint8_t textLength = 0;
+        size_t used = argIndex < record.argCount
+                          ? readArg(record.args + offset, record.length - offset, &type, &bits,
+                                    &text, &textLength)
+                          : 0;
+        if (used == 0) {
+            // left out, the record was full
+            snprintf(piece, sizeof(piece), "?");
+        } else {
+            formatArg(piece, sizeof(piece), c, specLength, type, bits, text, textLength);
+            offset += used;
+            argIndex++;
+        }
+        append(piece, strlen(piece));
+        c += specLength - 1;
+    }
+    out[length] = '\0';
+}
+
+}  // namespace
+
+MPSCQueue<DeferredLogRecord, DeferredLog::kCapacity> DeferredLog::_ring;
+std::atomic<uint32_t> DeferredLog::_dropped{0};
+uint32_t DeferredLog::_reportedDrops = 0;
+
+void DeferredLogRecord::addString(const char* value) {
+    if (value == nullptr) value = "(null)";
+    if (length + 2u > kMaxArgBytes) return;
+
+    size_t textLength = strnlen(value, kMaxStringLength);
+    size_t room = kMaxArgBytes - length - 2;
+    if (textLength > room) textLength = room;
+
+    args[length] = DLA_STR;
+    args[length + 1] = static_cast<uint8_t>(textLength);
+    memcpy(&args[length + 2], value, textLength);
+    length += 2 + textLength;
+    argCount++;
+}
+
+void DeferredLog::push(DeferredLogRecord& record) {
+    record.timestampUs = Clock::micros();
+    if (!_ring.push(record)) _dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t DeferredLog::takeUnreportedDrops() {
+    uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+    uint32_t unreported = dropped - _reportedDrops;
+    _reportedDrops = dropped;
+    return unreported;
+}
+
+size_t DeferredLog::drainText(const std::function<void(const char*)>& sink, size_t maxRecords) {
+    char line[kMaxTextLength + 128];
+
+    uint32_t drops = takeUnreportedDrops();
+    if (drops != 0) {
+        snprintf(line, sizeof(line), COLOR_RED "[" COMMS_SYSTEM_STR "] %lu log messages dropped, "
+                                               "the ring was full" COLOR_RETURN "\n",
+                 static_cast<unsigned long>(drops));
+        sink(line);
+    }
+
+    size_t drained = 0;
+    DeferredLogRecord record;
+    while (drained < maxRecords && _ring.pop(&record)) {
+        const DeferredLogSite& site = *record.site;
+        char message[kMaxTextLength];
+        formatMessage(record, message, sizeof(message));
+
+        snprintf(line, sizeof(line), "%s[%lu][" COMMS_SYSTEM_STR "][%s:%u] " COLOR_RETURN "%s%s",
+                 (site.flags & DLF_ERROR) != 0 ? COLOR_RED : COMMS_COLOR_STR,
+                 static_cast<unsigned long>(record.timestampUs), site.file,
+                 static_cast<unsigned>(site.line), message,
+                 (site.flags & DLF_NEWLINE) != 0 ? "\n" : "");
+        sink(line);
+        drained++;
+    }
+    return drained;
+}
+
+size_t DeferredLog::drainBinary(const std::function<void(const uint8_t*, size_t)>& sink,
+                                size_t maxRecords) {
+    constexpr size_t kHeaderLength = 12;
+    uint8_t frame[2 + kHeaderLength + DeferredLogRecord::kMaxArgBytes];
+
+    auto encode = [&](uint32_t timestampUs, uint32_t formatID, uint16_t line, uint8_t flags,
+                      uint8_t argCount, const uint8_t* args, uint8_t length) {
+        frame[0] = kSync;
+        frame[1] = static_cast<uint8_t>(kHeaderLength + length);
+        memcpy(&frame[2], &timestampUs, 4);
+        memcpy(&frame[6], &formatID, 4);
+        memcpy(&frame[10], &line, 2);
+        frame[12] = flags;
+        frame[13] = argCount;
+        memcpy(&frame[14], args, length);
+        sink(frame, 2 + kHeaderLength + length);
+    };
+
+    uint32_t drops = takeUnreportedDrops();
+    if (drops != 0) {
+        uint8_t args[5] = {DLA_U32};
+        memcpy(&args[1], &drops, 4);
+        encode(Clock::micros(), kDroppedFormatID, 0, DLF_ERROR | DLF_NEWLINE, 1, args,
+               sizeof(args));
+    }
+
+    size_t drained = 0;
+    DeferredLogRecord record;
+    while (drained < maxRecords && _ring.pop(&record)) {
+        const DeferredLogSite& site = *record.site;
+        encode(record.timestampUs, site.formatID, site.line, site.flags, record.argCount,
+               record.args, record.length);
+        drained++;
+    }
+    return drained;
+}
+
+}  // namespace comms
+
+#endif  // COMMS_DEFERRED_LOG
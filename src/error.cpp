@@ -1,7 +1,7 @@
 #include "impl/error.hpp"
 #include "impl/id.hpp"
-
-#include <Arduino.h>  // for millis()
+#include "impl/clock.hpp"
+#include "impl/profile.hpp"
 
 #include <array>
 #include <cstring>
@@ -12,7 +12,7 @@ namespace comms {
 
 uint32_t ErrorManager::_errorCounter = 0;
 
-ErrorManager::ErrorManager(CommsDriver* driver, MCUID me)
+ErrorManager::ErrorManager(MessageOutbox* driver, MCUID me)
     : _driver(driver), _me(me), _errorRetransmissionTimeMs(0) {
 }
 
@@ -21,7 +21,8 @@ void ErrorManager::initialize(uint32_t errorRetransmissionTimeMs) {
 }
 
 void ErrorManager::tick() {
-    uint32_t now = millis();
+    COMMS_PROFILE_ZONE(PZ_ERRORS);
+    uint32_t now = Clock::millis();
 
     // Iterate over every outstanding error that we have in the map.
     for (auto& kv : _errorStatus) {
@@ -31,15 +32,16 @@ void ErrorManager::tick() {
         // If enough time has passed, retransmit
         if (now - status.lastTransmissionTime >= _errorRetransmissionTimeMs) {
             // Re‐build the raw CAN message with the same payload
-            ErrorMessagePayload wrapper;
+            ErrorMessagePayload wrapper{};
             wrapper.error = status.error;       // same severity/behavior/code
             wrapper.errorNumber = errorNumber;  // same unique number
 
             // Look up our own MT_ERROR ID to send on
             Option<uint32_t> idOpt = MessageInfo::getMessageID(_me, MessageContentType::MT_ERROR);
             if (idOpt.isSome()) {
-                RawCommsMessage raw;
+                RawCommsMessage raw{};
                 raw.id = idOpt.value();
+                raw.length = sizeof(wrapper.raw);
                 raw.payload = wrapper.raw;
                 _driver->sendMessage(raw);
 
@@ -71,7 +73,7 @@ void ErrorManager::handleErrorRecieve(MessageInfo sender, RawCommsMessage messag
     if (payload.error.behavior == ErrorBehavior::EB_LATCH) {
         ManagedErrorStatus& status = _errorStatus[payload.errorNumber];
         status.error = payload.error;
-        status.lastTransmissionTime = millis();  // store the time we first saw it
+        status.lastTransmissionTime = Clock::millis();  // store the time we first saw it
     }
 }
 
@@ -80,7 +82,7 @@ void ErrorManager::reportError(ErrorCode code, ErrorSeverity severity, ErrorBeha
     uint32_t newNumber = _errorCounter++;
 
     // Populate the struct
-    ErrorMessagePayload wrapper;
+    ErrorMessagePayload wrapper{};
     wrapper.errorNumber = newNumber;
     wrapper.error.severity = severity;
     wrapper.error.behavior = behavior;
@@ -89,14 +91,15 @@ void ErrorManager::reportError(ErrorCode code, ErrorSeverity severity, ErrorBeha
     // Store it so tick() will retransmit later
     ManagedErrorStatus status;
     status.error = wrapper.error;
-    status.lastTransmissionTime = millis();
+    status.lastTransmissionTime = Clock::millis();
     _errorStatus[newNumber] = status;
 
     // Immediately send out the first copy
     Option<uint32_t> idOpt = MessageInfo::getMessageID(_me, MessageContentType::MT_ERROR);
     if (idOpt.isSome()) {
-        RawCommsMessage raw;
+        RawCommsMessage raw{};
         raw.id = idOpt.value();
+        raw.length = sizeof(wrapper.raw);
         raw.payload = wrapper.raw;
         _driver->sendMessage(raw);
     }
@@ -0,0 +1,63 @@
+#include "impl/exec_status.hpp"
+
+#include "impl/clock.hpp"
+#include "impl/debug.hpp"
+
+namespace comms {
+
+ExecutionMonitor::ExecutionMonitor() {
+    _metrics.fill(ExecutionMetrics{});
+    _reported.fill(false);
+}
+
+void ExecutionMonitor::onExecutionStatus(std::function<void(const ExecutionReport&)> callback) {
+    _callbacks.push_back(callback);
+}
+
+void ExecutionMonitor::handleMessage(MessageInfo info, const RawCommsMessage& message) {
+    if (info.sender >= kMaxNodes) {
+        COMMS_DEBUG_PRINT_ERRORLN("Execution status from unknown node %d", info.sender);
+        return;
+    }
+
+    ExecutionStatusPayload payload;
+    payload.raw = message.payload;
+
+    ExecutionReport report;
+    report.node = info.sender;
+    report.executionDone = (payload.flags & ExecutionStatusPayload::kFlagExecutionDone) != 0;
+    report.bank =
+        (payload.flags & ExecutionStatusPayload::kBankMask) >> ExecutionStatusPayload::kBankShift;
+    report.bankDone = (payload.flags & ExecutionStatusPayload::kFlagBankDone) != 0;
+    report.failure = payload.failure;
+    report.lastCommandID = payload.lastCommandID;
+    report.executed = payload.executed;
+    report.remaining = payload.remaining;
+    report.elapsedMs = payload.elapsedMs;
+
+    ExecutionMetrics& metrics = _metrics[info.sender];
+    _reported[info.sender] = true;
+    if (report.executed != 0) {
+        // an empty start only ends the execution, there was no slice
+        metrics.slices++;
+        metrics.commands += report.executed;
+        metrics.totalSliceMs += report.elapsedMs;
+        if (report.elapsedMs > metrics.maxSliceMs) metrics.maxSliceMs = report.elapsedMs;
+        metrics.lastCommandID = report.lastCommandID;
+    }
+    if (!report.succeeded()) metrics.failures++;
+    if (report.executionDone) metrics.executions++;
+    metrics.executing = !report.executionDone;
+    metrics.lastReportMs = Clock::millis();
+
+    for (auto& callback : _callbacks) {
+        callback(report);
+    }
+}
+
+Option<ExecutionMetrics> ExecutionMonitor::metrics(MCUID node) const {
+    if (node >= kMaxNodes || !_reported[node]) return Option<ExecutionMetrics>::none();
+    return Option<ExecutionMetrics>::some(_metrics[node]);
+}
+
+}  // namespace comms
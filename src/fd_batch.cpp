@@ -0,0 +1,40 @@
+#include "impl/fd_batch.hpp"
+
+#include "impl/can_timing.hpp"
+#include "impl/debug.hpp"
+
+namespace comms {
+
+FDRecordBatch::FDRecordBatch(CommsDriver* driver) : _driver(driver), _frame{}, _count(0) {}
+
+void FDRecordBatch::add(uint32_t id, const uint8_t* record) {
+    if (_count != 0 && (_frame.id != id || _count == kMaxRecords)) flush();
+
+    _frame.id = id;
+    memcpy(_frame.payloadBytes + _count * kRecordSize, record, kRecordSize);
+    _count++;
+}
+
+void FDRecordBatch::flush() {
+    if (_count == 0) return;
+
+    uint8_t length = _count * kRecordSize;
+    uint8_t padded = canFDPaddedLength(length);
+    memset(_frame.payloadBytes + length, 0xFF, padded - length);
+
+    _frame.length = padded;
+    _frame.bitRateSwitch = true;
+    if (!_driver->sendFDMessage(_frame)) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send an FD frame of %d bytes!", padded);
+    }
+    _count = 0;
+}
+
+bool FDRecordBatch::isPadding(const uint8_t* record) {
+    for (uint8_t i = 0; i < kRecordSize; i++) {
+        if (record[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+}  // namespace comms
@@ -1,17 +1,27 @@
 #include "impl/heartbeat.hpp"
 
-#include <Arduino.h>
-
+#include "impl/clock.hpp"
 #include "impl/debug.hpp"
 
 namespace comms {
 
-HeartbeatManager::HeartbeatManager(CommsDriver* driver, MCUID me)
-    : _driver(driver), _me(me), _myStatus{0} {}
+HeartbeatManager::HeartbeatManager(MessageOutbox* driver, MCUID me)
+    : _driver(driver), _me(me), _myStatus{0}, _timeSync(me == MCUID::MCU_HIGH_LEVEL) {}
+
+void BusTimeSync::update(uint32_t busTimeUs, uint32_t localTimeUs) {
+    int32_t offsetUs = static_cast<int32_t>(busTimeUs - localTimeUs);
+    if (!_synced || offsetUs > _offsetUs) {
+        // the first stamp, or one that was delayed less than any before it
+        _offsetUs = offsetUs;
+        _synced = true;
+        return;
+    }
+    _offsetUs -= (_offsetUs - offsetUs) >> kDriftShift;
+}
 
 void HeartbeatManager::initialize(uint32_t intervalTimeMs, const std::vector<MCUID> nodesToCheck) {
     _nodesToCheck = nodesToCheck;
-    _lastDispatch = millis();
+    _lastDispatch = Clock::millis();
     _intervalTimeMs = intervalTimeMs;
     // send out first requests to nodes
     for (MCUID id : _nodesToCheck) {
@@ -23,13 +33,13 @@ bool HeartbeatManager::tick() {
     if (_me != MCUID::MCU_HIGH_LEVEL) return false;
 
     // send out requests if needed
-    if (millis() - _lastDispatch >= _intervalTimeMs) {
+    if (Clock::millis() - _lastDispatch >= _intervalTimeMs) {
         // dispatch
         for (MCUID id : _nodesToCheck) {
             sendHeartbeatRequest(id);
         }
 
-        _lastDispatch = millis();
+        _lastDispatch = Clock::millis();
     }
 
     _badNodes.clear();
@@ -37,29 +47,13 @@ bool HeartbeatManager::tick() {
     for (auto statusPair : _requestStatuses) {
         HeartbeatRequestStatus status = statusPair.second;
 
-        if (status.lastResponse - status.lastRequest > 5000) {
-            // too long of a time has passed
+        // only a request that's still waiting for its response can be late
+        bool outstanding = status.expectedHeartbeatCount > status.actualHeartbeatCount;
+        if (outstanding && Clock::millis() - status.lastResponse > 5000) {
+            // too long of a time has passed, the periodic dispatch keeps asking
             COMMS_DEBUG_PRINT_ERRORLN(
                 "Too much time has elapsed between heartbeat request and last response for node %d",
                 status.id);
-            COMMS_DEBUG_PRINTLN("Resending request...");
-
-            Option<uint32_t> idOpt =
-                MessageInfo::getMessageID(_me, MessageContentType::MT_HEARTBEAT);
-            if (idOpt.isNone()) {
-                COMMS_DEBUG_PRINT_ERRORLN("Cannot send a heartbeat response! No ID available!");
-                continue;
-            }
-
-            // send the message
-            HearbeatMessageRequestPayload payload;
-            payload.id = status.id;
-
-            RawCommsMessage message;
-            message.id = idOpt.value();
-            message.payload = payload.raw;
-
-            _driver->sendMessage(message);
 
             _badNodes.push_back(status.id);
             continue;
@@ -88,7 +82,7 @@ void HeartbeatManager::updateHeartbeatStatus(MCUID id) {
 
     status.id = id;
     status.actualHeartbeatCount++;
-    status.lastResponse = millis();
+    status.lastResponse = Clock::millis();
 
     _requestStatuses[id] = status;
 }
@@ -106,11 +100,14 @@ void HeartbeatManager::sendHeartbeatRequest(MCUID destination) {
     }
 
     // send the message
-    HearbeatMessageRequestPayload payload;
+    HearbeatMessageRequestPayload payload{};
     payload.id = destination;
+    payload.hasBusTime = true;
+    payload.busTimeUs = Clock::micros();
 
-    RawCommsMessage message;
+    RawCommsMessage message{};
     message.id = idOpt.value();
+    message.length = sizeof(payload.raw);
     message.payload = payload.raw;
 
     _driver->sendMessage(message);
@@ -123,7 +120,7 @@ void HeartbeatManager::sendHeartbeatRequest(MCUID destination) {
 
     status.id = destination;
     status.expectedHeartbeatCount++;
-    status.lastRequest = millis();
+    status.lastRequest = Clock::millis();
 
     _requestStatuses[destination] = status;
 }
@@ -141,14 +138,20 @@ void HeartbeatManager::sendHeartbeatResponse() {
         return;
     }
 
-    HeartbeatMessageResponsePayload payload;
+    HeartbeatMessageResponsePayload payload{};
     payload.heartbeatValue = _myStatus.heartbeatCount;
 
-    RawCommsMessage message;
+    RawCommsMessage message{};
     message.id = idOpt.value();
+    message.length = sizeof(payload.raw);
     message.payload = payload.raw;
 
     _driver->sendMessage(message);
 };
 
+void HeartbeatManager::handleHeartbeatRequest(const HearbeatMessageRequestPayload& request) {
+    if (request.hasBusTime) _timeSync.update(request.busTimeUs, Clock::micros());
+    if (request.id == _me) sendHeartbeatResponse();
+}
+
 }  // namespace comms
\ No newline at end of file
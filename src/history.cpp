@@ -0,0 +1,138 @@
+#include "impl/history.hpp"
+
+namespace comms {
+
+namespace {
+
+/// @brief Rounds up to a power of two, at least 2 so there is something to interpolate between
+size_t roundUpToPowerOfTwo(size_t n) {
+    size_t rounded = 2;
+    while (rounded < n) rounded <<= 1;
+    return rounded;
+}
+
+/// @brief Checks if a time is at or after another, across a wrap of the microsecond clock
+bool atOrAfter(uint32_t timeUs, uint32_t referenceUs) {
+    return static_cast<int32_t>(timeUs - referenceUs) >= 0;
+}
+
+}  // namespace
+
+SensorHistory::SensorHistory(size_t capacity, uint32_t windowUs)
+    : _samples(roundUpToPowerOfTwo(capacity)),
+      _mask(static_cast<uint32_t>(_samples.size() - 1)),
+      _count(0),
+      _sequence(0),
+      _windowUs(windowUs),
+      _windowStart(0),
+      _windowSum(0),
+      _minQueue{std::vector<uint32_t>(_samples.size()), 0, 0},
+      _maxQueue{std::vector<uint32_t>(_samples.size()), 0, 0} {}
+
+void SensorHistory::push(uint32_t timeUs, float value) {
+    // the sample about to be overwritten can't stay in the window
+    while (_sequence - _windowStart >= _samples.size()) evictFromWindow();
+
+    _samples[_sequence & _mask] = SensorSample{timeUs, value};
+    if (_count < _samples.size()) _count++;
+
+    _windowSum += value;
+    while (_minQueue.count != 0 && bySequence(_minQueue.back()).value >= value) {
+        _minQueue.popBack();
+    }
+    _minQueue.pushBack(_sequence);
+    while (_maxQueue.count != 0 && bySequence(_maxQueue.back()).value <= value) {
+        _maxQueue.popBack();
+    }
+    _maxQueue.pushBack(_sequence);
+    _sequence++;
+
+    // age out, the newest sample always stays
+    while (_sequence - _windowStart > 1 &&
+           timeUs - bySequence(_windowStart).timeUs > _windowUs) {
+        evictFromWindow();
+    }
+}
+
+void SensorHistory::evictFromWindow() {
+    _windowSum -= bySequence(_windowStart).value;
+    if (_minQueue.count != 0 && _minQueue.front() == _windowStart) _minQueue.popFront();
+    if (_maxQueue.count != 0 && _maxQueue.front() == _windowStart) _maxQueue.popFront();
+    _windowStart++;
+}
+
+const SensorSample& SensorHistory::newest(size_t age) const {
+    return bySequence(_sequence - 1 - static_cast<uint32_t>(age));
+}
+
+size_t SensorHistory::countSince(uint32_t timeUs) const {
+    // samples are in time order, so find the oldest one at or after the time
+    size_t low = 0;
+    size_t high = _count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (atOrAfter(newest(mid).timeUs, timeUs)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t SensorHistory::copyLast(size_t n, SensorSample* out) const {
+    if (n > _count) n = _count;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = newest(n - 1 - i);
+    }
+    return n;
+}
+
+size_t SensorHistory::copySince(uint32_t timeUs, SensorSample* out, size_t capacity) const {
+    size_t n = countSince(timeUs);
+    return copyLast(n < capacity ? n : capacity, out);
+}
+
+Option<float> SensorHistory::valueAt(uint32_t timeUs) const {
+    if (_count == 0) return Option<float>::none();
+    if (!atOrAfter(newest().timeUs, timeUs)) return Option<float>::none();
+    if (!atOrAfter(timeUs, newest(_count - 1).timeUs)) return Option<float>::none();
+
+    // after is the oldest sample at or after the time, before is the one just older than it
+    size_t since = countSince(timeUs);
+    const SensorSample& after = newest(since - 1);
+    if (after.timeUs == timeUs || since == _count) return Option<float>::some(after.value);
+
+    const SensorSample& before = newest(since);
+    float t = static_cast<float>(timeUs - before.timeUs) /
+              static_cast<float>(after.timeUs - before.timeUs);
+    return Option<float>::some(before.value + (after.value - before.value) * t);
+}
+
+Option<float> SensorHistory::derivative() const {
+    if (_count < 2) return Option<float>::none();
+
+    const SensorSample& latest = newest(0);
+    const SensorSample& previous = newest(1);
+    uint32_t dtUs = latest.timeUs - previous.timeUs;
+    if (dtUs == 0) return Option<float>::none();
+
+    return Option<float>::some((latest.value - previous.value) * 1e6f / dtUs);
+}
+
+Option<float> SensorHistory::windowMin() const {
+    if (_count == 0) return Option<float>::none();
+    return Option<float>::some(bySequence(_minQueue.front()).value);
+}
+
+Option<float> SensorHistory::windowMax() const {
+    if (_count == 0) return Option<float>::none();
+    return Option<float>::some(bySequence(_maxQueue.front()).value);
+}
+
+Option<float> SensorHistory::windowMean() const {
+    if (_count == 0) return Option<float>::none();
+    return Option<float>::some(static_cast<float>(_windowSum / windowSize()));
+}
+
+}  // namespace comms
@@ -0,0 +1,132 @@
+#include "host_runtime.hpp"
+
+#ifndef ARDUINO
+
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+namespace comms {
+
+HostRuntime::HostRuntime(CommsDriver& driver, MCUID id, uint32_t idleSleepUs)
+    : _controller(driver, id),
+      _idleSleepUs(idleSleepUs),
+      _running(false),
+      _ticks(0),
+      _requestsHandled(0),
+      _requestsRejected(0) {}
+
+HostRuntime::~HostRuntime() {
+    stop();
+}
+
+void HostRuntime::start() {
+    if (isRunning()) return;
+
+    _controller.initialize();
+    _running.store(true, std::memory_order_relaxed);
+    _thread = std::thread(&HostRuntime::run, this);
+}
+
+void HostRuntime::stop() {
+    if (!isRunning()) return;
+
+    _running.store(false, std::memory_order_relaxed);
+    _thread.join();
+
+    // the thread is gone, so this thread may use the controller now
+    drainRequests();
+    _controller.tick();
+}
+
+bool HostRuntime::sendCommand(CommandMessagePayload payload) {
+    return sendCommand(payload, nullptr);
+}
+
+bool HostRuntime::sendCommand(CommandMessagePayload payload,
+                              std::function<void(CommandStatus)> onComplete) {
+    HostRequest request;
+    request.type = HRT_COMMAND;
+    request.command = payload;
+    request.onComplete = std::move(onComplete);
+    return push(request);
+}
+
+bool HostRuntime::sendMotion(const MotionCommand& motion) {
+    HostRequest request;
+    request.type = HRT_MOTION;
+    request.motion = motion;
+    return push(request);
+}
+
+Option<float> HostRuntime::getSensorValue(MCUID sender, uint8_t sensorID) const {
+    SensorKey key{sender, sensorID};
+    SensorSnapshotBuffer<1> buffer;
+    SensorSnapshot snapshot = buffer.view();
+
+    // the writer only holds the table for the length of one copy, so this rarely goes around
+    while (!_controller.snapshotGroup(&key, 1, &snapshot)) {
+        std::this_thread::yield();
+    }
+
+    if (std::isnan(snapshot.values[0])) return Option<float>::none();
+    return Option<float>::some(snapshot.values[0]);
+}
+
+bool HostRuntime::snapshotNode(MCUID sender, SensorSnapshot* out) const {
+    return _controller.snapshotNode(sender, out);
+}
+
+bool HostRuntime::snapshotGroup(const SensorKey* sensors, size_t count,
+                                SensorSnapshot* out) const {
+    return _controller.snapshotGroup(sensors, count, out);
+}
+
+HostRuntimeStats HostRuntime::stats() const {
+    return HostRuntimeStats{_ticks.load(std::memory_order_relaxed),
+                            _requestsHandled.load(std::memory_order_relaxed),
+                            _requestsRejected.load(std::memory_order_relaxed)};
+}
+
+void HostRuntime::run() {
+    while (_running.load(std::memory_order_relaxed)) {
+        size_t handled = drainRequests();
+        Option<CommsTickResult> result = _controller.tick();
+        _ticks.fetch_add(1, std::memory_order_relaxed);
+
+        // sleep only when there was nothing to do, a busy bus is served back to back
+        if (handled == 0 && result.isNone() && _idleSleepUs != 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(_idleSleepUs));
+        }
+    }
+}
+
+size_t HostRuntime::drainRequests() {
+    size_t handled = 0;
+    HostRequest request;
+    while (_requests.pop(&request)) {
+        switch (request.type) {
+            case HRT_COMMAND:
+                // the ticket can't leave this thread, so only its outcome goes back
+                _controller.sendCommand(request.command).onComplete(std::move(request.onComplete));
+                break;
+            case HRT_MOTION:
+                _controller.sendMotion(request.motion);
+                break;
+        }
+        handled++;
+    }
+    _requestsHandled.fetch_add(handled, std::memory_order_relaxed);
+    return handled;
+}
+
+bool HostRuntime::push(const HostRequest& request) {
+    if (_requests.push(request)) return true;
+
+    _requestsRejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+}  // namespace comms
+
+#endif  // ARDUINO
@@ -0,0 +1,110 @@
+#include "impl/loopback_driver.hpp"
+
+#include "impl/can_timing.hpp"
+
+namespace comms {
+
+void LoopbackDriver::sendMessage(const RawCommsMessage& message) {
+    sendMessages(&message, 1);
+}
+
+bool LoopbackDriver::receiveMessage(RawCommsMessage* res) {
+    return receiveMessages(res, 1) == 1;
+}
+
+size_t LoopbackDriver::sendMessages(const RawCommsMessage* messages, size_t count) {
+    LoopbackBus::Lock lock(_bus);
+    RawCommsFDMessage fd{};
+    for (size_t i = 0; i < count; i++) {
+        fd.id = messages[i].id;
+        fd.length = messages[i].length > 8 ? 8 : messages[i].length;
+        memcpy(fd.payloadBytes, messages[i].payloadBytes, fd.length);
+        _bus->broadcast(this, fd);
+    }
+    return count;
+}
+
+size_t LoopbackDriver::receiveMessages(RawCommsMessage* messages, size_t capacity) {
+    LoopbackBus::Lock lock(_bus);
+    size_t count = 0;
+    while (count < capacity && !_rx.empty()) {
+        const RawCommsFDMessage& fd = _rx.front();
+        RawCommsMessage& res = messages[count++];
+        res.id = fd.id;
+        res.length = fd.length > 8 ? 8 : fd.length;
+        res.payload = 0;
+        memcpy(res.payloadBytes, fd.payloadBytes, res.length);
+        _rx.pop_front();
+    }
+    return count;
+}
+
+bool LoopbackDriver::supportsFD() const {
+    return _bus->isFD();
+}
+
+uint8_t LoopbackDriver::maxPayloadLength() const {
+    return _bus->isFD() ? RawCommsFDMessage::kMaxLength : 8;
+}
+
+bool LoopbackDriver::sendFDMessage(const RawCommsFDMessage& message) {
+    if (message.length > maxPayloadLength()) return false;
+
+    // pad like a real controller would, the receiver sees the length on the wire
+    RawCommsFDMessage padded = message;
+    padded.length = canFDPaddedLength(message.length);
+    memset(padded.payloadBytes + message.length, 0, padded.length - message.length);
+
+    LoopbackBus::Lock lock(_bus);
+    _bus->broadcast(this, padded);
+    return true;
+}
+
+bool LoopbackDriver::receiveFDMessage(RawCommsFDMessage* message) {
+    LoopbackBus::Lock lock(_bus);
+    if (_rx.empty()) return false;
+
+    *message = _rx.front();
+    _rx.pop_front();
+    return true;
+}
+
+size_t LoopbackDriver::pending() const {
+    LoopbackBus::Lock lock(_bus);
+    return _rx.size();
+}
+
+void LoopbackDriver::deliver(const RawCommsFDMessage& message) {
+    if (_rx.size() >= _rxCapacity) {
+        _dropped++;
+        return;
+    }
+    _rx.push_back(message);
+}
+
+#ifndef ARDUINO
+LoopbackBus::Lock::Lock(const LoopbackBus* bus) : _bus(bus) {
+    _bus->_mutex.lock();
+}
+
+LoopbackBus::Lock::~Lock() {
+    _bus->_mutex.unlock();
+}
+#else   // ARDUINO
+LoopbackBus::Lock::Lock(const LoopbackBus* bus) : _bus(bus) {}
+
+LoopbackBus::Lock::~Lock() {}
+#endif  // ARDUINO
+
+LoopbackDriver& LoopbackBus::addDriver(size_t rxCapacity) {
+    _drivers.emplace_back(new LoopbackDriver(this, rxCapacity));
+    return *_drivers.back();
+}
+
+void LoopbackBus::broadcast(const LoopbackDriver* from, const RawCommsFDMessage& message) {
+    for (auto& driver : _drivers) {
+        if (driver.get() != from) driver->deliver(message);
+    }
+}
+
+}  // namespace comms
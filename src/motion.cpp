@@ -0,0 +1,206 @@
+#include "impl/motion.hpp"
+
+#include "impl/clock.hpp"
+#include "impl/debug.hpp"
+
+namespace comms {
+
+namespace {
+
+/// @brief Checks if a time is at or after another, across a wrap of the microsecond clock
+bool atOrAfter(uint32_t timeUs, uint32_t referenceUs) {
+    return static_cast<int32_t>(timeUs - referenceUs) >= 0;
+}
+
+/// @brief An empty set of setpoints
+MotionSetpoints emptySetpoints() {
+    MotionSetpoints setpoints{};
+    return setpoints;
+}
+
+}  // namespace
+
+uint8_t MotionFramePayload::frameMotors() const {
+    if (!isCommit()) return motorMask;
+
+    uint8_t left = __builtin_popcount(motorMask) % 2 == 1 ? 1 : 2;
+    uint8_t motors = 0;
+    for (int8_t motor = kMaxMotionMotors - 1; motor >= 0 && left > 0; motor--) {
+        uint8_t bit = static_cast<uint8_t>(1 << motor);
+        if ((motorMask & bit) == 0) continue;
+        motors |= bit;
+        left--;
+    }
+    return motors;
+}
+
+MotionCommand::MotionCommand(MCUID target)
+    : _target(target), _setpoints(emptySetpoints()), _applyAtBusUs(0) {}
+
+MotionCommand& MotionCommand::set(uint8_t motor, MotorControlCommandType type, int16_t value) {
+    if (motor >= kMaxMotionMotors) {
+        COMMS_DEBUG_PRINT_ERRORLN("Motor %d is out of range for a motion command!", motor);
+        return *this;
+    }
+
+    uint8_t bit = static_cast<uint8_t>(1 << motor);
+    _setpoints.motorMask |= bit;
+    if (type == MC_CMD_VEL) {
+        _setpoints.velocityMask |= bit;
+    } else {
+        _setpoints.velocityMask &= static_cast<uint8_t>(~bit);
+    }
+    _setpoints.values[motor] = value;
+    return *this;
+}
+
+MotionCommand& MotionCommand::applyAt(uint32_t busTimeUs) {
+    _setpoints.timed = true;
+    _applyAtBusUs = busTimeUs;
+    return *this;
+}
+
+uint8_t MotionCommand::toFrames(uint8_t sequence, MotionFramePayload* frames) const {
+    if (_setpoints.motorMask == 0) return 0;
+
+    uint8_t sequenceBits = static_cast<uint8_t>(
+        (sequence & MotionFramePayload::kControlSequenceMask)
+        << MotionFramePayload::kControlSequenceShift);
+
+    uint8_t count = 0;
+    if (_setpoints.timed) {
+        MotionFramePayload& timing = frames[count++];
+        timing = MotionFramePayload();
+        timing.targetID = _target;
+        timing.control = sequenceBits;
+        timing.applyAtUs = _applyAtBusUs;
+    }
+
+    // two setpoints per frame, in ascending motor order
+    uint8_t inFrame = 0;
+    for (uint8_t motor = 0; motor < kMaxMotionMotors; motor++) {
+        if (!_setpoints.has(motor)) continue;
+
+        if (inFrame == 0) {
+            frames[count] = MotionFramePayload();
+            frames[count].targetID = _target;
+            frames[count].control = sequenceBits;
+        }
+
+        MotionFramePayload& frame = frames[count];
+        frame.motorMask |= static_cast<uint8_t>(1 << motor);
+        frame.setpoints[inFrame] = _setpoints.values[motor];
+        if (_setpoints.typeOf(motor) == MC_CMD_VEL) frame.control |= 1 << inFrame;
+
+        if (++inFrame == 2) {
+            inFrame = 0;
+            count++;
+        }
+    }
+    if (inFrame != 0) count++;
+
+    // the commit frame tells the whole group, so the receiver can tell if a frame went missing
+    MotionFramePayload& commit = frames[count - 1];
+    commit.motorMask = _setpoints.motorMask;
+    commit.control |= MotionFramePayload::kControlCommit;
+    if (_setpoints.timed) commit.control |= MotionFramePayload::kControlTimed;
+    return count;
+}
+
+MotionReceiver::MotionReceiver(MCUID me)
+    : _me(me),
+      _pending(emptySetpoints()),
+      _collecting(false),
+      _pendingSequence(0),
+      _pendingApplyAtBusUs(0),
+      _scheduled(emptySetpoints()),
+      _hasScheduled(false) {}
+
+void MotionReceiver::setHandler(std::function<void(const MotionSetpoints&)> handler) {
+    _handler = handler;
+}
+
+void MotionReceiver::handleFrame(const MotionFramePayload& frame, const BusTimeSync& timeSync) {
+    if (frame.targetID != _me) return;
+
+    if (_collecting && frame.sequence() != _pendingSequence) {
+        // the commit of the last group was lost, half of a group must never be applied
+        COMMS_DEBUG_PRINT_ERRORLN("Dropping incomplete motion group %d", _pendingSequence);
+        _collecting = false;
+    }
+    if (!_collecting) {
+        _pending = emptySetpoints();
+        _pendingSequence = frame.sequence();
+        _collecting = true;
+    }
+
+    if (frame.isTiming()) {
+        _pending.timed = true;
+        _pendingApplyAtBusUs = frame.applyAtUs;
+    } else {
+        uint8_t motors = frame.frameMotors();
+        uint8_t inFrame = 0;
+        for (uint8_t motor = 0; motor < kMaxMotionMotors && inFrame < 2; motor++) {
+            uint8_t bit = static_cast<uint8_t>(1 << motor);
+            if ((motors & bit) == 0) continue;
+
+            _pending.motorMask |= bit;
+            if (frame.control & (1 << inFrame)) {
+                _pending.velocityMask |= bit;
+            } else {
+                _pending.velocityMask &= static_cast<uint8_t>(~bit);
+            }
+            _pending.values[motor] = frame.setpoints[inFrame];
+            inFrame++;
+        }
+    }
+
+    if (!frame.isCommit()) return;
+    _collecting = false;
+
+    bool timed = (frame.control & MotionFramePayload::kControlTimed) != 0;
+    if (_pending.motorMask != frame.motorMask || _pending.timed != timed) {
+        // a frame in the middle was lost, the group would move some motors with stale setpoints
+        COMMS_DEBUG_PRINT_ERRORLN("Dropping motion group %d, a frame of it was lost",
+                                  _pendingSequence);
+        return;
+    }
+
+    // a newer group replaces a timed one still waiting, it was meant to supersede it
+    _hasScheduled = false;
+
+    if (!_pending.timed) {
+        apply(_pending);
+        return;
+    }
+
+    if (!timeSync.isSynced()) {
+        // better late than never, the time can't be known until a heartbeat request arrives
+        COMMS_DEBUG_PRINT_ERRORLN("Applying a timed motion group now, no bus time yet!");
+        _pending.timed = false;
+        apply(_pending);
+        return;
+    }
+
+    _pending.applyAtUs = timeSync.toLocal(_pendingApplyAtBusUs);
+    _scheduled = _pending;
+    _hasScheduled = true;
+    tick();
+}
+
+void MotionReceiver::tick() {
+    if (!_hasScheduled || !atOrAfter(Clock::micros(), _scheduled.applyAtUs)) return;
+
+    _hasScheduled = false;
+    apply(_scheduled);
+}
+
+void MotionReceiver::apply(const MotionSetpoints& setpoints) {
+    if (_handler == nullptr) {
+        COMMS_DEBUG_PRINT_ERRORLN("Received motion but no handler is set!");
+        return;
+    }
+    _handler(setpoints);
+}
+
+}  // namespace comms
@@ -0,0 +1,157 @@
+#include "impl/multi_bus_driver.hpp"
+
+#include "impl/clock.hpp"
+#include "impl/debug.hpp"
+
+namespace comms {
+
+MultiBusDriver::MultiBusDriver(std::vector<CommsDriver*> buses, MultiBusPolicy policy)
+    : _buses(std::move(buses)),
+      _policy(policy),
+      _nextRxBus(0),
+      _recent{},
+      _recentHead(0),
+      _duplicateWindowMs(10) {
+    if (_buses.size() > kMaxBuses) {
+        COMMS_DEBUG_PRINT_ERRORLN("MultiBusDriver only supports %d buses, ignoring the rest!",
+                                  static_cast<int>(kMaxBuses));
+        _buses.resize(kMaxBuses);
+    }
+    _routes.fill(0);
+    _healthy.fill(true);
+}
+
+void MultiBusDriver::install() {
+    for (CommsDriver* bus : _buses) {
+        bus->install();
+    }
+}
+
+void MultiBusDriver::uninstall() {
+    for (CommsDriver* bus : _buses) {
+        bus->uninstall();
+    }
+}
+
+void MultiBusDriver::sendMessage(const RawCommsMessage& message) {
+    if (_buses.empty()) return;
+
+    if (_policy == MBP_SPLIT) {
+        _buses[pickBus(message)]->sendMessage(message);
+        return;
+    }
+
+    bool sent = false;
+    for (uint8_t i = 0; i < _buses.size(); i++) {
+        if (!isBusHealthy(i)) continue;
+        _buses[i]->sendMessage(message);
+        sent = true;
+    }
+
+    // every bus is down, keep trying the primary so it can recover
+    if (!sent) _buses[0]->sendMessage(message);
+}
+
+bool MultiBusDriver::receiveMessage(RawCommsMessage* res) {
+    // every bus gets one chance per call, starting after the one we read last
+    for (uint8_t attempts = 0; attempts < _buses.size(); attempts++) {
+        uint8_t bus = _nextRxBus;
+        _nextRxBus = (_nextRxBus + 1) % _buses.size();
+
+        // drain copies on this bus until we find something new
+        while (_buses[bus]->receiveMessage(res)) {
+            if (_policy == MBP_REDUNDANT && isDuplicate(*res, bus)) continue;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+BusState MultiBusDriver::busState() {
+    BusState best = BS_BUS_OFF;
+    for (CommsDriver* bus : _buses) {
+        BusState state = bus->busState();
+        if (state < best) best = state;
+    }
+    return best;
+}
+
+void MultiBusDriver::setRoute(MessageContentType type, uint8_t busIndex) {
+    if (type >= _routes.size() || busIndex >= _buses.size()) {
+        COMMS_DEBUG_PRINT_ERRORLN("Invalid route for content type %d to bus %d", type, busIndex);
+        return;
+    }
+    _routes[type] = busIndex;
+}
+
+void MultiBusDriver::setDuplicateWindow(uint32_t windowMs) {
+    _duplicateWindowMs = windowMs;
+}
+
+bool MultiBusDriver::isBusHealthy(uint8_t busIndex) {
+    bool healthy = _buses[busIndex]->busState() != BS_BUS_OFF;
+
+    if (healthy != _healthy[busIndex]) {
+        if (healthy) {
+            COMMS_DEBUG_PRINTLN("Bus %d recovered", busIndex);
+        } else {
+            COMMS_DEBUG_PRINT_ERRORLN("Bus %d went bus-off, failing over!", busIndex);
+        }
+        _healthy[busIndex] = healthy;
+    }
+
+    return healthy;
+}
+
+uint8_t MultiBusDriver::pickBus(const RawCommsMessage& message) {
+    uint8_t preferred = 0;
+    Option<MessageInfo> infoOpt = MessageInfo::getInfo(message.id);
+    if (infoOpt.isSome() && infoOpt.value().type < _routes.size()) {
+        preferred = _routes[infoOpt.value().type];
+    }
+
+    // walk the buses starting at the preferred one until one is healthy
+    for (uint8_t offset = 0; offset < _buses.size(); offset++) {
+        uint8_t bus = (preferred + offset) % _buses.size();
+        if (isBusHealthy(bus)) return bus;
+    }
+
+    return preferred;
+}
+
+bool MultiBusDriver::isDuplicate(const RawCommsMessage& message, uint8_t busIndex) {
+    uint32_t now = Clock::millis();
+    uint8_t busBit = 1 << busIndex;
+
+    for (RecentFrame& frame : _recent) {
+        if (!frame.valid || frame.id != message.id || frame.length != message.length ||
+            frame.payload != message.payload) {
+            continue;
+        }
+        if (now - frame.seenTime > _duplicateWindowMs) continue;
+
+        if ((frame.busMask & busBit) == 0) {
+            // a copy of a frame we already delivered from another bus
+            frame.busMask |= busBit;
+            return true;
+        }
+
+        // the same bus sent it again, so it's a new frame with the same contents
+        frame.busMask = busBit;
+        frame.seenTime = now;
+        return false;
+    }
+
+    RecentFrame& slot = _recent[_recentHead];
+    _recentHead = (_recentHead + 1) % _recent.size();
+    slot.id = message.id;
+    slot.length = message.length;
+    slot.payload = message.payload;
+    slot.seenTime = now;
+    slot.busMask = busBit;
+    slot.valid = true;
+    return false;
+}
+
+}  // namespace comms
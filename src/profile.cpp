@@ -0,0 +1,189 @@
+#include "impl/profile.hpp"
+
+#ifdef COMMS_PROFILE
+
+#include <stdio.h>
+
+#include <limits>
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+namespace comms {
+
+namespace {
+
+const char* const kZoneNames[PZ_COUNT] = {
+    "tick",
+    "driver_rx",
+    "driver_tx",
+    "dispatch",
+    "sensor_read",
+    "sensor_streams",
+    "commands",
+    "cmd_handler",
+    "heartbeats",
+    "errors",
+    "transport",
+    "snapshot",
+    "user_0",
+    "user_1",
+};
+
+/// @brief The index of the highest set bit, value must not be 0
+uint8_t highestBit(uint32_t value) {
+    return 31 - __builtin_clz(value);
+}
+
+}  // namespace
+
+std::array<Profiler::Zone, PZ_COUNT> Profiler::_zones;
+bool Profiler::_initialized = false;
+
+const char* profileZoneName(ProfileZone zone) {
+    if (zone >= PZ_COUNT) return "unknown";
+    return kZoneNames[zone];
+}
+
+void Profiler::initialize() {
+#if defined(ARDUINO) && defined(ARM_DWT_CYCCNT)
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+    _initialized = true;
+}
+
+float Profiler::cyclesPerUs() {
+#if defined(ARDUINO) && defined(ARM_DWT_CYCCNT)
+#ifdef F_CPU_ACTUAL
+    return F_CPU_ACTUAL / 1000000.0f;
+#else
+    return F_CPU / 1000000.0f;
+#endif
+#elif !defined(ARDUINO) && (defined(__x86_64__) || defined(__i386__))
+    // the rate of the TSC isn't told anywhere portable, measure it once over 10 ms
+    static float rate = 0.0f;
+    if (rate == 0.0f) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startCycles = __rdtsc();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(10)) {
+        }
+        uint64_t elapsedCycles = __rdtsc() - startCycles;
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        float elapsedUs =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 1000.0f;
+        rate = elapsedCycles / elapsedUs;
+    }
+    return rate;
+#elif !defined(ARDUINO)
+    return 1000.0f;
+#else
+    return 1.0f;
+#endif
+}
+
+void Profiler::record(ProfileZone zone, uint32_t cycles) {
+    if (zone >= PZ_COUNT) return;
+    if (!_initialized) initialize();
+
+    Zone& z = _zones[zone];
+    if (z.count == 0 || cycles < z.minCycles) z.minCycles = cycles;
+    if (cycles > z.maxCycles) z.maxCycles = cycles;
+    z.count++;
+    z.totalCycles += cycles;
+    z.buckets[bucketOf(cycles)]++;
+}
+
+ProfileZoneStats Profiler::stats(ProfileZone zone) {
+    ProfileZoneStats stats{};
+    if (zone >= PZ_COUNT) return stats;
+
+    const Zone& z = _zones[zone];
+    stats.count = z.count;
+    stats.totalCycles = z.totalCycles;
+    stats.minCycles = z.minCycles;
+    stats.maxCycles = z.maxCycles;
+    if (z.count == 0) return stats;
+
+    // the bucket the 99th percentile timing falls in, its upper bound overestimates it at most
+    // by a quarter of an octave
+    uint32_t rank = z.count - z.count / 100;
+    uint32_t seen = 0;
+    for (size_t bucket = 0; bucket < kNumBuckets; bucket++) {
+        seen += z.buckets[bucket];
+        if (seen >= rank) {
+            uint32_t bound = bucketUpperBound(bucket);
+            stats.p99Cycles = bound < z.maxCycles ? bound : z.maxCycles;
+            break;
+        }
+    }
+    return stats;
+}
+
+void Profiler::reset() {
+    for (Zone& z : _zones) {
+        z.count = 0;
+        z.totalCycles = 0;
+        z.minCycles = 0;
+        z.maxCycles = 0;
+        z.buckets.fill(0);
+    }
+}
+
+size_t Profiler::format(char* buffer, size_t size) {
+    if (buffer == nullptr || size == 0) return 0;
+
+    size_t length = 0;
+    auto append = [&](int written) {
+        if (written < 0) return false;
+        if (length + written >= size) {
+            length = size - 1;
+            return false;
+        }
+        length += written;
+        return true;
+    };
+
+    buffer[0] = '\0';
+    if (!append(snprintf(buffer, size, "%-14s %8s %9s %9s %9s %9s\n", "zone", "count", "mean_us",
+                         "min_us", "max_us", "p99_us"))) {
+        return length;
+    }
+
+    for (uint8_t i = 0; i < PZ_COUNT; i++) {
+        ProfileZoneStats s = stats(static_cast<ProfileZone>(i));
+        if (s.count == 0) continue;
+
+        int written =
+            snprintf(buffer + length, size - length, "%-14s %8lu %9.2f %9.2f %9.2f %9.2f\n",
+                     kZoneNames[i], static_cast<unsigned long>(s.count), toUs(s.meanCycles()),
+                     toUs(s.minCycles), toUs(s.maxCycles), toUs(s.p99Cycles));
+        if (!append(written)) break;
+    }
+    return length;
+}
+
+size_t Profiler::bucketOf(uint32_t cycles) {
+    if (cycles < 4) return cycles;
+
+    // four buckets per octave, told apart by the two bits under the highest
+    uint8_t octave = highestBit(cycles);
+    uint8_t sub = (cycles >> (octave - 2)) & 0x3;
+    return 4 + (octave - 2) * 4 + sub;
+}
+
+uint32_t Profiler::bucketUpperBound(size_t bucket) {
+    if (bucket < 4) return bucket;
+
+    uint8_t octave = (bucket - 4) / 4 + 2;
+    uint8_t sub = (bucket - 4) % 4;
+    uint64_t lower = static_cast<uint64_t>(4 + sub) << (octave - 2);
+    uint64_t upper = lower + (static_cast<uint64_t>(1) << (octave - 2)) - 1;
+    if (upper > std::numeric_limits<uint32_t>::max()) return std::numeric_limits<uint32_t>::max();
+    return static_cast<uint32_t>(upper);
+}
+
+}  // namespace comms
+
+#endif  // COMMS_PROFILE
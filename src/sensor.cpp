@@ -1,51 +1,251 @@
 #include "impl/sensor.hpp"
 
-#include <Arduino.h>
+#include <string.h>
 
+#include <cmath>
+
+#include "impl/clock.hpp"
 #include "impl/debug.hpp"
+#include "impl/profile.hpp"
 
 namespace comms {
 
+namespace {
+
+/// @brief Decodes a non-negative IEEE 754 half float
+float halfToFloat(uint16_t half) {
+    uint16_t exponent = (half >> 10) & 0x1F;
+    uint16_t mantissa = half & 0x3FF;
+    if (exponent == 0) return std::ldexp(static_cast<float>(mantissa), -24);
+    if (exponent == 0x1F) return INFINITY;
+    return std::ldexp(static_cast<float>(0x400 | mantissa), exponent - 25);
+}
+
+/// @brief Encodes a non-negative float as the smallest half float that is not below it
+uint16_t floatToHalfCeil(float value) {
+    if (!(value > 0.0f)) return 0;
+    if (value > 65504.0f) return 0x7C00;  // infinity
+
+    int exponent;
+    std::frexp(value, &exponent);  // value = m * 2^exponent, m in [0.5, 1)
+    uint16_t half;
+    if (exponent - 1 < -14) {
+        // subnormal
+        half = static_cast<uint16_t>(std::ldexp(value, 24));
+    } else {
+        float mantissa = std::ldexp(value, 1 - exponent) - 1.0f;
+        half = static_cast<uint16_t>(((exponent + 14) << 10) |
+                                     static_cast<uint16_t>(std::ldexp(mantissa, 10)));
+    }
+    // the conversion above truncates, step up one ulp if that lost anything
+    if (halfToFloat(half) < value) half++;
+    return half;
+}
+
+}  // namespace
+
+uint64_t SensorMessagePayload::compactRaw() const {
+    uint8_t bytes[sizeof(raw)] = {};
+    bytes[0] = sensorID;
+    bytes[1] = flags;
+    memcpy(&bytes[2], &delta, sizeof(delta));
+
+    uint64_t bits;
+    memcpy(&bits, bytes, sizeof(bits));
+    return bits;
+}
+
+SensorMessagePayload SensorMessagePayload::fromFrame(uint64_t bits, uint8_t length) {
+    SensorMessagePayload payload{};
+    if (length >= kFullLength) {
+        payload.raw = bits;
+        return payload;
+    }
+
+    uint8_t bytes[sizeof(bits)];
+    memcpy(bytes, &bits, sizeof(bits));
+    payload.sensorID = bytes[0];
+    payload.flags = bytes[1];
+    memcpy(&payload.delta, &bytes[2], sizeof(payload.delta));
+    return payload;
+}
+
+float SensorMessagePayload::envelopeSpan() const {
+    return halfToFloat(static_cast<uint16_t>(delta));
+}
+
+void SensorMessagePayload::setEnvelopeSpan(float span) {
+    delta = static_cast<int16_t>(floatToHalfCeil(span));
+}
+
 SensorDatastream::SensorDatastream()
     : _driver(nullptr),
       _sender(MCUID::MCU_ANY),
       _sensorPtr(),
       _enabled(false),
+      _converting(false),
       _updateRateMs(0),
       _id(0),
-      _lastSendTime(0) {}
+      _lastReadTime(0),
+      _lastSendTime(0),
+      _lastFullSendTime(0),
+      _sampling(SensorSamplingConfig::none()),
+      _lastSampleTime(0),
+      _ring{},
+      _ringHead(0),
+      _ringCount(0),
+      _blockCount(0),
+      _blockSum(0.0f),
+      _blockMin(0.0f),
+      _blockMax(0.0f),
+      _iirState(0.0f),
+      _policy(SensorTransmissionPolicy::periodic()),
+      _hasSent(false),
+      _lastSentValue(0.0f) {}
 
-SensorDatastream::SensorDatastream(CommsDriver* driver, MCUID sender, uint32_t updateRateMs,
-                                   uint8_t id, std::shared_ptr<Sensor> sensor)
+SensorDatastream::SensorDatastream(MessageOutbox* driver, MCUID sender, uint32_t updateRateMs,
+                                   uint8_t id, std::shared_ptr<Sensor> sensor,
+                                   SensorTransmissionPolicy policy)
+    : SensorDatastream(driver, sender, updateRateMs, id,
+                       std::make_shared<SyncSensorAdapter>(std::move(sensor)), policy) {}
+
+SensorDatastream::SensorDatastream(MessageOutbox* driver, MCUID sender, uint32_t updateRateMs,
+                                   uint8_t id, std::shared_ptr<AsyncSensor> sensor,
+                                   SensorTransmissionPolicy policy)
     : _driver(driver),
       _sender(sender),
       _sensorPtr(std::move(sensor)),
       _enabled(true),
+      _converting(false),
       _updateRateMs(updateRateMs),
       _id(id),
-      _lastSendTime(0) {}
+      _lastReadTime(0),
+      _lastSendTime(0),
+      _lastFullSendTime(0),
+      _sampling(SensorSamplingConfig::none()),
+      _lastSampleTime(0),
+      _ring{},
+      _ringHead(0),
+      _ringCount(0),
+      _blockCount(0),
+      _blockSum(0.0f),
+      _blockMin(0.0f),
+      _blockMax(0.0f),
+      _iirState(0.0f),
+      _policy(policy),
+      _hasSent(false),
+      _lastSentValue(0.0f) {}
 
 void SensorDatastream::initialize() {
     // initialize hardware sensor
     _sensorPtr->initialize();
     // reset timer
     // random offset!
-    _lastSendTime = millis();
+    _lastReadTime = Clock::millis();
+    _lastSendTime = _lastReadTime;
+    _lastFullSendTime = _lastReadTime;
+    _lastSampleTime = Clock::micros();
+    // the first conversion runs during the first update period
+    startConversion();
 }
 
 void SensorDatastream::tick() {
-    if (!_enabled) return;
+    RawCommsMessage msg;
+    if (!poll(&msg)) return;
 
-    uint32_t now = millis();
-    if (now - _lastSendTime < _updateRateMs) return;
+    if (_driver == nullptr) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send sensor data! Driver is null!");
+        return;
+    }
+    _driver->sendMessage(msg);
+}
+
+bool SensorDatastream::poll(RawCommsMessage* message) {
+    if (!_enabled) return false;
+
+    sample();
+
+    uint32_t now = Clock::millis();
+    if (now - _lastReadTime < _updateRateMs) return false;
+    _lastReadTime = now;
+
+    if (_sampling.samplePeriodUs == 0) {
+        // one conversion per update period, pipelined: collect the one started last period and
+        // start the next, so a slow sensor costs one period of latency instead of loop time
+        collectConversion();
+        startConversion();
+    }
+
+    // nothing has ever completed, there is nothing to send
+    if (_ringCount == 0) return false;
+
+    // reduce the samples and decide what, if anything, goes on the bus
+    Reading reading = reduce();
+    float val = reading.value;
+    uint32_t sinceSend = now - _lastSendTime;
+
+    bool changed = !_hasSent || exceedsDeadband(val);
+    bool canSendChange = !_hasSent || sinceSend >= _policy.minIntervalMs;
+    bool keepAliveDue = _policy.maxIntervalMs != 0 && sinceSend >= _policy.maxIntervalMs;
+    // deltas keep the stream busy, so it also needs a full value every so often, for a receiver
+    // that lost a delta or started late
+    bool resyncDue = _policy.deltaEncoding && _policy.maxIntervalMs != 0 &&
+                     now - _lastFullSendTime >= _policy.maxIntervalMs;
 
-    // read sensor and package payload
-    float val = _sensorPtr->read();
     SensorMessagePayload payload{};
-    payload.value = val;
     payload.sensorID = _id;
+    uint8_t length = SensorMessagePayload::kFullLength;
+
+    if (changed && canSendChange) {
+        float step = std::ldexp(1.0f, _policy.deltaExponent);
+        long quantized = _hasSent ? std::lround((val - _lastSentValue) / step) : 0;
+
+        if (reading.isEnvelope) {
+            // envelopes need the delta slot for the span, so they are always sent in full
+            payload.flags = SMF_ENVELOPE;
+            payload.value = val;
+            payload.setEnvelopeSpan(reading.max - reading.min);
+            _lastSentValue = val;
+        } else if (_policy.deltaEncoding && _hasSent && !resyncDue && quantized >= INT16_MIN &&
+                   quantized <= INT16_MAX) {
+            payload.flags = SMF_DELTA;
+            payload.setDeltaExponent(_policy.deltaExponent);
+            payload.delta = static_cast<int16_t>(quantized);
+            length = SensorMessagePayload::kDeltaLength;
+            // track what the receiver will reconstruct, so quantization error doesn't accumulate
+            _lastSentValue += static_cast<float>(quantized) * step;
+        } else {
+            payload.value = val;
+            _lastSentValue = val;
+        }
+        _hasSent = true;
+    } else if (keepAliveDue || resyncDue) {
+        if (_policy.deltaEncoding) {
+            // keep-alives double as resync points, so a lost delta doesn't drift forever
+            payload.value = val;
+            _lastSentValue = val;
+            if (reading.isEnvelope) {
+                payload.flags = SMF_ENVELOPE;
+                payload.setEnvelopeSpan(reading.max - reading.min);
+            }
+        } else {
+            payload.flags = SMF_KEEPALIVE;
+            length = SensorMessagePayload::kKeepAliveLength;
+        }
+    } else {
+        return false;
+    }
+
+    if (length < SensorMessagePayload::kFullLength) {
+        // on CAN FD every reading takes a whole record anyway, so the full layout costs nothing
+        // and lets a receiver that missed the full frames start from this one
+        bool fd = _driver != nullptr && _driver->supportsFD();
+        if (fd) {
+            payload.value = _lastSentValue;
+            length = SensorMessagePayload::kFullLength;
+        }
+    }
 
-    RawCommsMessage msg{};
     Option<uint32_t> midOpt =
         MessageInfo::getMessageID(_sender, MessageContentType::MT_SENSOR_DATA);
 
@@ -54,21 +254,171 @@ void SensorDatastream::tick() {
             "Unable to send sensor data! Message ID has no mapping for %d (MCUID)", _sender);
     }
 
-    msg.id = midOpt.value();
-    msg.length = sizeof(payload);
-    msg.payload = payload.raw;
+    *message = RawCommsMessage{};
+    message->id = midOpt.value();
+    message->length = length;
+    message->payload =
+        length < SensorMessagePayload::kFullLength ? payload.compactRaw() : payload.raw;
 
     _lastSendTime = now;
-
-    if (_driver == nullptr) {
-        COMMS_DEBUG_PRINT_ERRORLN("Unable to send sensor data! Driver is null!");
-        return;
-    }
-    _driver->sendMessage(msg);
+    if (length == SensorMessagePayload::kFullLength) _lastFullSendTime = now;
+    return true;
 }
 
 void SensorDatastream::setStatus(bool enabled) {
     _enabled = enabled;
 }
 
+void SensorDatastream::setPolicy(SensorTransmissionPolicy policy) {
+    _policy = policy;
+    _hasSent = false;
+}
+
+int32_t SensorDatastream::overdueMs() const {
+    return static_cast<int32_t>(Clock::millis() - _lastReadTime - _updateRateMs);
+}
+
+void SensorDatastream::setSampling(SensorSamplingConfig sampling) {
+    if (sampling.firTapCount > SensorSamplingConfig::kRingSize) {
+        sampling.firTapCount = SensorSamplingConfig::kRingSize;
+    }
+    _sampling = sampling;
+    _lastSampleTime = Clock::micros();
+    _ringHead = 0;
+    _ringCount = 0;
+    _blockCount = 0;
+    _blockSum = 0.0f;
+}
+
+void SensorDatastream::sample() {
+    if (_sampling.samplePeriodUs == 0) return;
+
+    collectConversion();
+
+    uint32_t now = Clock::micros();
+    if (now - _lastSampleTime < _sampling.samplePeriodUs) return;
+    _lastSampleTime = now;
+
+    startConversion();
+    // sensors that finish immediately, like adapted blocking sensors, are collected right away
+    collectConversion();
+}
+
+void SensorDatastream::startConversion() {
+    if (_converting) return;
+    COMMS_PROFILE_ZONE(PZ_SENSOR_READ);
+    _converting = _sensorPtr->startConversion();
+}
+
+void SensorDatastream::collectConversion() {
+    if (!_converting) return;
+    COMMS_PROFILE_ZONE(PZ_SENSOR_READ);
+
+    switch (_sensorPtr->poll()) {
+        case SCS_READY:
+            pushSample(_sensorPtr->collect());
+            _converting = false;
+            break;
+        case SCS_FAILED:
+            _sensorPtr->collect();
+            _converting = false;
+            COMMS_DEBUG_PRINT_ERRORLN("Sensor %d conversion failed!", _id);
+            break;
+        case SCS_IDLE:
+            // the sensor forgot about the conversion, start over
+            _converting = false;
+            break;
+        case SCS_BUSY:
+        default:
+            break;
+    }
+}
+
+void SensorDatastream::pushSample(float value) {
+    _ring[_ringHead] = value;
+    _ringHead = (_ringHead + 1) % SensorSamplingConfig::kRingSize;
+    if (_ringCount < SensorSamplingConfig::kRingSize) _ringCount++;
+
+    if (_blockCount == 0) {
+        _blockMin = value;
+        _blockMax = value;
+    } else {
+        _blockMin = std::fmin(_blockMin, value);
+        _blockMax = std::fmax(_blockMax, value);
+    }
+    _blockSum += value;
+    _blockCount++;
+
+    // start the IIR from the first sample instead of ramping up from zero
+    if (_ringCount == 1) {
+        _iirState = value;
+    } else {
+        _iirState += _sampling.iirAlpha * (value - _iirState);
+    }
+}
+
+SensorDatastream::Reading SensorDatastream::reduce() {
+    constexpr uint8_t kRingSize = SensorSamplingConfig::kRingSize;
+    uint8_t newest = (_ringHead + kRingSize - 1) % kRingSize;
+
+    // no conversion finished this period, hold the latest completed sample
+    if (_blockCount == 0) {
+        _blockMin = _ring[newest];
+        _blockMax = _ring[newest];
+        _blockSum = _ring[newest];
+        _blockCount = 1;
+    }
+
+    Reading reading{};
+    reading.value = _ring[newest];
+
+    switch (_sampling.filter) {
+        case SFT_MEAN:
+            reading.value = _blockSum / static_cast<float>(_blockCount);
+            break;
+        case SFT_MIN_MAX:
+            reading.value = _blockMax;
+            reading.isEnvelope = true;
+            break;
+        case SFT_FIR: {
+            // normalize by the taps in use, so the gain is right while the ring fills up
+            uint8_t taps = _sampling.firTapCount < _ringCount ? _sampling.firTapCount : _ringCount;
+            float acc = 0.0f;
+            float weight = 0.0f;
+            for (uint8_t i = 0; i < taps; i++) {
+                acc += _sampling.firTaps[i] * _ring[(newest + kRingSize - i) % kRingSize];
+                weight += _sampling.firTaps[i];
+            }
+            if (weight != 0.0f) reading.value = acc / weight;
+            break;
+        }
+        case SFT_IIR:
+            reading.value = _iirState;
+            break;
+        case SFT_LATEST:
+        default:
+            break;
+    }
+
+    reading.min = reading.isEnvelope ? _blockMin : reading.value;
+    reading.max = reading.isEnvelope ? _blockMax : reading.value;
+
+    _blockCount = 0;
+    _blockSum = 0.0f;
+    return reading;
+}
+
+bool SensorDatastream::exceedsDeadband(float value) const {
+    float diff = std::fabs(value - _lastSentValue);
+    switch (_policy.deadbandMode) {
+        case SDM_ABSOLUTE:
+            return diff > _policy.deadband;
+        case SDM_RELATIVE:
+            return diff > _policy.deadband * std::fabs(_lastSentValue);
+        case SDM_NONE:
+        default:
+            return true;
+    }
+}
+
 }  // namespace comms
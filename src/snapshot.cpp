@@ -0,0 +1,110 @@
+#include "impl/snapshot.hpp"
+
+#include <cmath>
+
+#include "impl/debug.hpp"
+
+namespace comms {
+
+SensorSnapshotTable::SensorSnapshotTable() : _sequence(0), _count(0) {
+    for (size_t i = 0; i < kCapacity; i++) {
+        _senders[i].store(0, std::memory_order_relaxed);
+        _sensorIDs[i].store(0, std::memory_order_relaxed);
+        _values[i].store(0, std::memory_order_relaxed);
+        _sampleTimesUs[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void SensorSnapshotTable::publish(const SensorStatus* statuses, size_t count) {
+    if (count > kCapacity) {
+        COMMS_DEBUG_PRINT_ERRORLN("Only the first %d sensors are published to snapshots!",
+                                  static_cast<int>(kCapacity));
+        count = kCapacity;
+    }
+
+    uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < count; i++) {
+        _senders[i].store(statuses[i].sender, std::memory_order_relaxed);
+        _sensorIDs[i].store(statuses[i].sensorID, std::memory_order_relaxed);
+        _values[i].store(statuses[i].value, std::memory_order_relaxed);
+        _sampleTimesUs[i].store(statuses[i].sampleTimeUs, std::memory_order_relaxed);
+    }
+    _count.store(static_cast<uint32_t>(count), std::memory_order_relaxed);
+
+    _sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool SensorSnapshotTable::readNode(MCUID sender, SensorSnapshot* out) const {
+    for (uint8_t attempt = 0; attempt < kMaxRetries; attempt++) {
+        uint32_t before = _sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        size_t filled = 0;
+        size_t count = _count.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count && filled < out->capacity; i++) {
+            if (_senders[i].load(std::memory_order_relaxed) != sender) continue;
+
+            if (out->sensorIDs != nullptr) {
+                out->sensorIDs[filled] = _sensorIDs[i].load(std::memory_order_relaxed);
+            }
+            out->values[filled] = _values[i].load(std::memory_order_relaxed);
+            out->sampleTimesUs[filled] = _sampleTimesUs[i].load(std::memory_order_relaxed);
+            filled++;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) != before) continue;
+
+        out->count = filled;
+        out->version = before;
+        return true;
+    }
+    return false;
+}
+
+bool SensorSnapshotTable::readGroup(const SensorKey* sensors, size_t count,
+                                    SensorSnapshot* out) const {
+    if (count > out->capacity) count = out->capacity;
+
+    for (uint8_t attempt = 0; attempt < kMaxRetries; attempt++) {
+        uint32_t before = _sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        size_t published = _count.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count; i++) {
+            if (out->sensorIDs != nullptr) out->sensorIDs[i] = sensors[i].sensorID;
+
+            size_t index = find(sensors[i], published);
+            if (index == kCapacity) {
+                out->values[i] = NAN;
+                out->sampleTimesUs[i] = 0;
+                continue;
+            }
+            out->values[i] = _values[index].load(std::memory_order_relaxed);
+            out->sampleTimesUs[i] = _sampleTimesUs[index].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) != before) continue;
+
+        out->count = count;
+        out->version = before;
+        return true;
+    }
+    return false;
+}
+
+size_t SensorSnapshotTable::find(SensorKey key, size_t count) const {
+    for (size_t i = 0; i < count; i++) {
+        if (_senders[i].load(std::memory_order_relaxed) == key.sender &&
+            _sensorIDs[i].load(std::memory_order_relaxed) == key.sensorID) {
+            return i;
+        }
+    }
+    return kCapacity;
+}
+
+}  // namespace comms
@@ -0,0 +1,382 @@
+#include "impl/socketcan_driver.hpp"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "impl/debug.hpp"
+
+namespace comms {
+
+namespace {
+
+/// @brief Room for an SCM_TIMESTAMPING message, and anything else the kernel attaches
+constexpr size_t kControlSize = 128;
+
+/// @brief Converts a library ID to a SocketCAN ID
+canid_t toCANID(uint32_t id) {
+    if (isExtendedID(id)) return (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    return id;
+}
+
+/// @brief Converts a SocketCAN ID back to a library ID
+uint32_t fromCANID(canid_t id) {
+    if (id & CAN_EFF_FLAG) return (id & CAN_EFF_MASK) | kExtendedIDFlag;
+    return id & CAN_SFF_MASK;
+}
+
+}  // namespace
+
+SocketCANDriver::SocketCANDriver(std::string interfaceName, MCUID me, SocketCANConfig config)
+    : _interfaceName(std::move(interfaceName)),
+      _me(me),
+      _config(config),
+      _socket(-1),
+      _epollFd(-1),
+      _isCANSocket(true),
+      _rxHead(0),
+      _rxCount(0),
+      _txCount(0),
+      _lastRxTimestampNs(0),
+      _txDrops(0) {
+    allocateBatches();
+}
+
+SocketCANDriver::SocketCANDriver(int socketFd, SocketCANConfig config)
+    : _me(MCU_ANY),
+      _config(config),
+      _socket(socketFd),
+      _epollFd(-1),
+      _isCANSocket(false),
+      _rxHead(0),
+      _rxCount(0),
+      _txCount(0),
+      _lastRxTimestampNs(0),
+      _txDrops(0) {
+    int domain = 0;
+    socklen_t length = sizeof(domain);
+    if (getsockopt(_socket, SOL_SOCKET, SO_DOMAIN, &domain, &length) == 0) {
+        _isCANSocket = domain == AF_CAN;
+    }
+    allocateBatches();
+}
+
+SocketCANDriver::~SocketCANDriver() {
+    uninstall();
+}
+
+void SocketCANDriver::install() {
+    if (_socket < 0) {
+        _socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+        if (_socket < 0) {
+            COMMS_DEBUG_PRINT_ERRORLN("Unable to open a CAN socket! errno %d", errno);
+            return;
+        }
+
+        ifreq ifr{};
+        strncpy(ifr.ifr_name, _interfaceName.c_str(), IFNAMSIZ - 1);
+        if (ioctl(_socket, SIOCGIFINDEX, &ifr) < 0) {
+            COMMS_DEBUG_PRINT_ERRORLN("No CAN interface named %s!", _interfaceName.c_str());
+            close(_socket);
+            _socket = -1;
+            return;
+        }
+
+        sockaddr_can addr{};
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = ifr.ifr_ifindex;
+        if (bind(_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            COMMS_DEBUG_PRINT_ERRORLN("Unable to bind to %s! errno %d", _interfaceName.c_str(),
+                                      errno);
+            close(_socket);
+            _socket = -1;
+            return;
+        }
+    }
+
+    if (_isCANSocket) {
+        if (_config.fd) {
+            int enable = 1;
+            if (setsockopt(_socket, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0) {
+                COMMS_DEBUG_PRINT_ERRORLN("The interface doesn't support CAN FD!");
+                _config.fd = false;
+            }
+        }
+        if (_config.filterFromMessageTable) installFilters();
+        if (_config.timestamps) {
+            // hardware timestamps when the adapter has them, software ones otherwise
+            int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                        SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+            if (setsockopt(_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+                COMMS_DEBUG_PRINT_ERRORLN("Unable to enable RX timestamps! errno %d", errno);
+            }
+        }
+    }
+
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = _socket;
+    if (_epollFd < 0 || epoll_ctl(_epollFd, EPOLL_CTL_ADD, _socket, &event) < 0) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to watch the CAN socket with epoll! errno %d", errno);
+    }
+}
+
+void SocketCANDriver::uninstall() {
+    if (_socket >= 0) {
+        flush();
+        close(_socket);
+        _socket = -1;
+    }
+    if (_epollFd >= 0) {
+        close(_epollFd);
+        _epollFd = -1;
+    }
+}
+
+void SocketCANDriver::sendMessage(const RawCommsMessage& message) {
+    queue(message.id, message.payloadBytes, message.length > 8 ? 8 : message.length, false,
+          false);
+}
+
+bool SocketCANDriver::receiveMessage(RawCommsMessage* res) {
+    const canfd_frame* frame = next();
+    if (frame == nullptr) return false;
+
+    res->id = fromCANID(frame->can_id);
+    res->length = frame->len > 8 ? 8 : frame->len;
+    res->payload = 0;
+    memcpy(res->payloadBytes, frame->data, res->length);
+    return true;
+}
+
+size_t SocketCANDriver::sendMessages(const RawCommsMessage* messages, size_t count) {
+    uint32_t dropsBefore = _txDrops;
+    for (size_t i = 0; i < count; i++) {
+        const RawCommsMessage& message = messages[i];
+        queue(message.id, message.payloadBytes, message.length > 8 ? 8 : message.length, false,
+              false);
+    }
+    flush();
+
+    // the queue is sent in order, so the frames still waiting in it are the last of this batch
+    size_t queued = count - (_txDrops - dropsBefore);
+    return queued > _txCount ? queued - _txCount : 0;
+}
+
+size_t SocketCANDriver::receiveMessages(RawCommsMessage* messages, size_t capacity) {
+    size_t count = 0;
+    while (count < capacity) {
+        // only go back to the socket once per call, an empty batch means nothing is waiting
+        if (_rxHead == _rxCount && count != 0) break;
+        if (!receiveMessage(&messages[count])) break;
+        count++;
+    }
+    return count;
+}
+
+bool SocketCANDriver::sendFDMessage(const RawCommsFDMessage& message) {
+    if (message.length > maxPayloadLength()) return false;
+
+    queue(message.id, message.payloadBytes, message.length, _config.fd, message.bitRateSwitch);
+    return true;
+}
+
+bool SocketCANDriver::receiveFDMessage(RawCommsFDMessage* message) {
+    const canfd_frame* frame = next();
+    if (frame == nullptr) return false;
+
+    message->id = fromCANID(frame->can_id);
+    message->length = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+    message->bitRateSwitch = (frame->flags & CANFD_BRS) != 0;
+    memcpy(message->payloadBytes, frame->data, message->length);
+    return true;
+}
+
+size_t SocketCANDriver::flush() {
+    if (_txCount == 0 || _socket < 0) return 0;
+
+    int sent = sendmmsg(_socket, _txHeaders.data(), _txCount, MSG_DONTWAIT);
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+            COMMS_DEBUG_PRINT_ERRORLN("sendmmsg failed! errno %d", errno);
+        }
+        return 0;
+    }
+
+    // keep whatever the kernel couldn't take yet for the next flush
+    size_t remaining = _txCount - sent;
+    for (size_t i = 0; i < remaining; i++) {
+        _txFrames[i] = _txFrames[sent + i];
+        _txIov[i].iov_len = _txIov[sent + i].iov_len;
+    }
+    _txCount = remaining;
+    return sent;
+}
+
+bool SocketCANDriver::waitForFrames(int timeoutMs) {
+    if (_rxHead < _rxCount) return true;
+
+    // a request is often what the caller is waiting on an answer to
+    flush();
+    epoll_event event;
+    return epoll_wait(_epollFd, &event, 1, timeoutMs) > 0;
+}
+
+bool SocketCANDriver::fill() {
+    if (_socket < 0) return false;
+
+    for (size_t i = 0; i < _rxHeaders.size(); i++) {
+        _rxHeaders[i].msg_hdr.msg_controllen = kControlSize;
+        _rxHeaders[i].msg_hdr.msg_flags = 0;
+    }
+
+    int received = recvmmsg(_socket, _rxHeaders.data(), _rxHeaders.size(), MSG_DONTWAIT, nullptr);
+    if (received <= 0) {
+        if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            COMMS_DEBUG_PRINT_ERRORLN("recvmmsg failed! errno %d", errno);
+        }
+        return false;
+    }
+
+    for (int i = 0; i < received; i++) {
+        _rxTimestampsNs[i] = 0;
+
+        msghdr& header = _rxHeaders[i].msg_hdr;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPING) continue;
+
+            // [0] is the software timestamp, [2] the raw hardware one
+            timespec stamps[3];
+            memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            const timespec& best = (stamps[2].tv_sec != 0 || stamps[2].tv_nsec != 0) ? stamps[2]
+                                                                                  : stamps[0];
+            _rxTimestampsNs[i] = static_cast<uint64_t>(best.tv_sec) * 1000000000ull +
+                                 static_cast<uint64_t>(best.tv_nsec);
+        }
+
+        // a classic frame fills CAN_MTU bytes, clear what an earlier FD frame left behind
+        if (_rxHeaders[i].msg_len < CANFD_MTU) _rxFrames[i].flags = 0;
+    }
+
+    _rxHead = 0;
+    _rxCount = received;
+    return true;
+}
+
+void SocketCANDriver::queue(uint32_t id, const uint8_t* data, uint8_t length, bool fd,
+                            bool bitRateSwitch) {
+    if (_txCount == _txFrames.size()) flush();
+    if (_txCount == _txFrames.size()) {
+        _txDrops++;
+        return;
+    }
+
+    canfd_frame& frame = _txFrames[_txCount];
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = toCANID(id);
+    frame.len = length;
+    memcpy(frame.data, data, length);
+    if (fd) {
+        frame.flags = bitRateSwitch ? CANFD_BRS : 0;
+#ifdef CANFD_FDF
+        frame.flags |= CANFD_FDF;
+#endif
+    }
+    _txIov[_txCount].iov_len = fd ? CANFD_MTU : CAN_MTU;
+    _txCount++;
+
+    if (_txCount == _txFrames.size()) flush();
+}
+
+const canfd_frame* SocketCANDriver::next() {
+    if (_rxHead == _rxCount) {
+        // polling for frames is the natural point to push out what was queued since the last poll
+        flush();
+        if (!fill()) return nullptr;
+    }
+
+    while (_rxHead < _rxCount) {
+        size_t index = _rxHead++;
+        const canfd_frame& frame = _rxFrames[index];
+        if (frame.can_id & (CAN_ERR_FLAG | CAN_RTR_FLAG)) continue;
+
+        _lastRxTimestampNs = _rxTimestampsNs[index];
+        return &frame;
+    }
+    return nullptr;
+}
+
+void SocketCANDriver::allocateBatches() {
+    size_t batch = _config.batchSize == 0 ? 1 : _config.batchSize;
+
+    _rxFrames.assign(batch, canfd_frame{});
+    _rxTimestampsNs.assign(batch, 0);
+    _rxIov.assign(batch, iovec{});
+    _rxHeaders.assign(batch, mmsghdr{});
+    _rxControl.assign(batch * kControlSize, 0);
+    for (size_t i = 0; i < batch; i++) {
+        _rxIov[i].iov_base = &_rxFrames[i];
+        _rxIov[i].iov_len = sizeof(canfd_frame);
+        _rxHeaders[i].msg_hdr.msg_iov = &_rxIov[i];
+        _rxHeaders[i].msg_hdr.msg_iovlen = 1;
+        _rxHeaders[i].msg_hdr.msg_control = &_rxControl[i * kControlSize];
+        _rxHeaders[i].msg_hdr.msg_controllen = kControlSize;
+    }
+
+    _txFrames.assign(batch, canfd_frame{});
+    _txIov.assign(batch, iovec{});
+    _txHeaders.assign(batch, mmsghdr{});
+    for (size_t i = 0; i < batch; i++) {
+        _txIov[i].iov_base = &_txFrames[i];
+        _txIov[i].iov_len = CAN_MTU;
+        _txHeaders[i].msg_hdr.msg_iov = &_txIov[i];
+        _txHeaders[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+void SocketCANDriver::installFilters() {
+    std::vector<can_filter> filters;
+#ifdef COMMS_EXTENDED_IDS
+    // the target is a field of every ID, so one filter per target this MCU answers to is enough
+    for (uint16_t target = 0; target <= 0xFF; target++) {
+        MessageInfo info{MCU_ANY, static_cast<MCUID>(target), MT_ERROR};
+        if (!info.shouldListen(_me)) continue;
+
+        can_filter filter;
+        filter.can_id = toCANID(MessageInfo::encodeExtendedID(info, 0));
+        filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | kExtTargetMask;
+        filters.push_back(filter);
+    }
+#else
+    for (const auto& kv : __infoLUT) {
+        const MessageInfo& info = kv.second;
+        if (info.sender == _me || !info.shouldListen(_me)) continue;
+
+        can_filter filter;
+        filter.can_id = toCANID(kv.first);
+        // match the exact ID, frame format and data frames only
+        filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | (kv.first > CAN_SFF_MASK ? CAN_EFF_MASK
+                                                                                 : CAN_SFF_MASK);
+        filters.push_back(filter);
+    }
+#endif
+
+    if (setsockopt(_socket, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(),
+                   filters.size() * sizeof(can_filter)) < 0) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to install CAN filters! errno %d", errno);
+    }
+}
+
+}  // namespace comms
+
+#endif  // defined(__linux__) && !defined(ARDUINO)
@@ -0,0 +1,221 @@
+#include "impl/traffic_log.hpp"
+
+#include <cstring>
+
+#include "impl/clock.hpp"
+#include "impl/debug.hpp"
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace comms {
+
+constexpr char TrafficLogHeader::kMagic[8];
+
+bool MemoryTrafficLogSink::write(const void* data, size_t size) {
+    if (_capacity - _size < size) return false;
+
+    memcpy(_buffer + _size, data, size);
+    _size += size;
+    return true;
+}
+
+#ifndef ARDUINO
+
+FileTrafficLogSink::FileTrafficLogSink(const char* path) : _file(fopen(path, "wb")) {
+    if (_file == nullptr) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to open traffic log %s!", path);
+    }
+}
+
+FileTrafficLogSink::~FileTrafficLogSink() {
+    if (_file != nullptr) fclose(_file);
+}
+
+bool FileTrafficLogSink::write(const void* data, size_t size) {
+    if (_file == nullptr) return false;
+    return fwrite(data, 1, size, _file) == size;
+}
+
+void FileTrafficLogSink::flush() {
+    if (_file != nullptr) fflush(_file);
+}
+
+#endif  // ARDUINO
+
+RecordingDriver::RecordingDriver(CommsDriver* inner, TrafficLogSink* sink)
+    : _inner(inner), _sink(sink), _lastMicros(0), _elapsedUs(0), _droppedRecords(0) {}
+
+void RecordingDriver::install() {
+    _inner->install();
+
+    _lastMicros = Clock::micros();
+    _elapsedUs = 0;
+
+    TrafficLogHeader header{};
+    memcpy(header.magic, TrafficLogHeader::kMagic, sizeof(header.magic));
+    header.version = TrafficLogHeader::kVersion;
+    header.recordSize = sizeof(TrafficLogRecord);
+    header.startTimeUs = _lastMicros;
+
+    if (!_sink->write(&header, sizeof(header))) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to write the traffic log header!");
+    }
+}
+
+void RecordingDriver::uninstall() {
+    _sink->flush();
+    _inner->uninstall();
+}
+
+void RecordingDriver::sendMessage(const RawCommsMessage& message) {
+    _inner->sendMessage(message);
+    record(message, TD_TX);
+}
+
+bool RecordingDriver::receiveMessage(RawCommsMessage* res) {
+    if (!_inner->receiveMessage(res)) return false;
+
+    record(*res, TD_RX);
+    return true;
+}
+
+size_t RecordingDriver::sendMessages(const RawCommsMessage* messages, size_t count) {
+    size_t sent = _inner->sendMessages(messages, count);
+    for (size_t i = 0; i < sent; i++) {
+        record(messages[i], TD_TX);
+    }
+    return sent;
+}
+
+size_t RecordingDriver::receiveMessages(RawCommsMessage* messages, size_t capacity) {
+    size_t received = _inner->receiveMessages(messages, capacity);
+    for (size_t i = 0; i < received; i++) {
+        record(messages[i], TD_RX);
+    }
+    return received;
+}
+
+void RecordingDriver::record(const RawCommsMessage& message, TrafficDirection direction) {
+    TrafficLogRecord record{};
+    record.timestampUs = elapsedUs();
+    record.id = message.id;
+    record.length = message.length;
+    record.direction = direction;
+    record.payload = message.payload;
+
+    if (!_sink->write(&record, sizeof(record))) _droppedRecords++;
+}
+
+uint64_t RecordingDriver::elapsedUs() {
+    // Clock::micros() wraps every ~71 minutes, so accumulate the deltas into 64 bits
+    uint32_t now = Clock::micros();
+    _elapsedUs += now - _lastMicros;
+    _lastMicros = now;
+    return _elapsedUs;
+}
+
+TrafficLogView::TrafficLogView(const uint8_t* data, size_t size) : _records(nullptr), _count(0) {
+    if (data == nullptr || size < sizeof(TrafficLogHeader)) return;
+
+    const TrafficLogHeader* header = reinterpret_cast<const TrafficLogHeader*>(data);
+    if (memcmp(header->magic, TrafficLogHeader::kMagic, sizeof(header->magic)) != 0 ||
+        header->version != TrafficLogHeader::kVersion ||
+        header->recordSize != sizeof(TrafficLogRecord)) {
+        COMMS_DEBUG_PRINT_ERRORLN("Not a traffic log this library can read!");
+        return;
+    }
+
+    _records = reinterpret_cast<const TrafficLogRecord*>(data + sizeof(TrafficLogHeader));
+    _count = (size - sizeof(TrafficLogHeader)) / sizeof(TrafficLogRecord);
+}
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+
+MappedTrafficLog::MappedTrafficLog(const char* path) : _data(nullptr), _size(0) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to open traffic log %s!", path);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            _data = data;
+            _size = static_cast<size_t>(st.st_size);
+        }
+    }
+    close(fd);
+}
+
+MappedTrafficLog::~MappedTrafficLog() {
+    if (_data != nullptr) munmap(_data, _size);
+}
+
+TrafficLogView MappedTrafficLog::view() const {
+    return TrafficLogView(static_cast<const uint8_t*>(_data), _size);
+}
+
+#endif
+
+ReplayDriver::ReplayDriver(TrafficLogView log, ReplayMode mode, float speed,
+                           TrafficDirection direction)
+    : _log(log),
+      _mode(mode),
+      _speed(mode == RPM_REAL_TIME ? 1.0f : speed),
+      _direction(direction),
+      _cursor(0),
+      _firstTimestampUs(0),
+      _lastMicros(0),
+      _elapsedUs(0),
+      _replayed(0),
+      _discarded(0) {}
+
+void ReplayDriver::install() {
+    _cursor = 0;
+    _replayed = 0;
+    _discarded = 0;
+    _firstTimestampUs = _log.size() > 0 ? _log[0].timestampUs : 0;
+    _lastMicros = Clock::micros();
+    _elapsedUs = 0;
+}
+
+void ReplayDriver::sendMessage(const RawCommsMessage& /*message*/) {
+    _discarded++;
+}
+
+bool ReplayDriver::receiveMessage(RawCommsMessage* res) {
+    // skip the frames going the other way
+    while (_cursor < _log.size() && _log[_cursor].direction != _direction) {
+        _cursor++;
+    }
+    if (finished()) return false;
+
+    const TrafficLogRecord& record = _log[_cursor];
+    if (_mode != RPM_MAX_SPEED && record.timestampUs - _firstTimestampUs > dueLogTimeUs()) {
+        return false;
+    }
+
+    res->id = record.id;
+    res->length = record.length;
+    res->payload = record.payload;
+
+    _cursor++;
+    _replayed++;
+    return true;
+}
+
+uint64_t ReplayDriver::dueLogTimeUs() {
+    uint32_t now = Clock::micros();
+    _elapsedUs += now - _lastMicros;
+    _lastMicros = now;
+    return static_cast<uint64_t>(static_cast<double>(_elapsedUs) * _speed);
+}
+
+}  // namespace comms
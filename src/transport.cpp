@@ -0,0 +1,363 @@
+#include "impl/transport.hpp"
+
+#include <string.h>
+
+#include "impl/clock.hpp"
+#include "impl/debug.hpp"
+#include "impl/profile.hpp"
+
+namespace comms {
+
+namespace {
+
+constexpr uint8_t kSingleFrameData = 6;
+constexpr uint8_t kFirstFrameData = 5;
+constexpr uint8_t kConsecutiveFrameData = 6;
+
+bool isBroadcast(MCUID target) {
+    return target == MCU_ANY || target == MCU_LOW_LEVEL_ANY;
+}
+
+}  // namespace
+
+SegmentedTransport::SegmentedTransport(CommsDriver* driver, MCUID me, TransportConfig config)
+    : _driver(driver), _me(me), _config(config), _completedCount(0) {
+    for (TxSlot& slot : _tx) {
+        slot.status = TS_IDLE;
+        slot.target = MCU_ANY;
+    }
+    for (RxSlot& slot : _rx) {
+        slot.active = false;
+        slot.complete = false;
+    }
+}
+
+bool SegmentedTransport::send(MCUID target, const uint8_t* data, uint16_t length) {
+    if (length > kMaxTransferSize) {
+        COMMS_DEBUG_PRINT_ERRORLN("Transfer of %d bytes is too long!", length);
+        return false;
+    }
+
+    if (length <= kSingleFrameData) {
+        uint8_t frame[8] = {};
+        frame[1] = (TFT_SINGLE << 4) | length;
+        memcpy(frame + 2, data, length);
+        sendFrame(target, frame, 2 + length);
+        return true;
+    }
+
+    if (isBroadcast(target)) {
+        COMMS_DEBUG_PRINT_ERRORLN("Multi-frame transfers can't be broadcast!");
+        return false;
+    }
+
+    // one transfer per target at a time, like ISO-TP
+    TxSlot* free = nullptr;
+    for (TxSlot& slot : _tx) {
+        if (slot.status == TS_IN_PROGRESS) {
+            if (slot.target == target) return false;
+            continue;
+        }
+        if (free == nullptr || slot.target == target) free = &slot;
+    }
+    if (free == nullptr) return false;
+
+    TxSlot& slot = *free;
+    slot.status = TS_IN_PROGRESS;
+    slot.target = target;
+    slot.length = length;
+    slot.offset = kFirstFrameData;
+    slot.sequence = 1;
+    slot.waitingForFlowControl = true;
+    slot.lastFlowControlTime = Clock::millis();
+    memcpy(slot.data.data(), data, length);
+
+    uint8_t frame[8] = {};
+    frame[1] = (TFT_FIRST << 4) | ((length >> 8) & 0x0F);
+    frame[2] = length & 0xFF;
+    memcpy(frame + 3, data, kFirstFrameData);
+    sendFrame(target, frame, 8);
+    return true;
+}
+
+TransportStatus SegmentedTransport::sendStatus(MCUID target) const {
+    for (const TxSlot& slot : _tx) {
+        if (slot.status != TS_IDLE && slot.target == target) return slot.status;
+    }
+    return TS_IDLE;
+}
+
+Option<uint16_t> SegmentedTransport::receive(MCUID* sender, uint8_t* buffer, uint16_t capacity) {
+    RxSlot* oldest = nullptr;
+    for (RxSlot& slot : _rx) {
+        if (!slot.complete) continue;
+        if (oldest == nullptr || slot.completedOrder - oldest->completedOrder > 0x80000000u) {
+            oldest = &slot;
+        }
+    }
+    if (oldest == nullptr) return Option<uint16_t>::none();
+
+    uint16_t length = oldest->length;
+    memcpy(buffer, oldest->data.data(), length < capacity ? length : capacity);
+    if (sender != nullptr) *sender = oldest->sender;
+    oldest->complete = false;
+    return Option<uint16_t>::some(length);
+}
+
+bool SegmentedTransport::handleMessage(const RawCommsMessage& message) {
+    Option<MessageInfo> infoOpt = MessageInfo::getInfo(message.id);
+    if (infoOpt.isNone() || infoOpt.value().type != MT_TRANSPORT) return false;
+
+    MCUID sender = infoOpt.value().sender;
+    if (sender == _me || message.length < 2) return true;
+
+    // extended addressing, the first byte is who the frame is for
+    MessageInfo addressed{sender, static_cast<MCUID>(message.payloadBytes[0]), MT_TRANSPORT};
+    if (!addressed.shouldListen(_me)) return true;
+
+    switch (message.payloadBytes[1] >> 4) {
+        case TFT_SINGLE:
+            handleSingleFrame(sender, message);
+            break;
+        case TFT_FIRST:
+            handleFirstFrame(sender, message);
+            break;
+        case TFT_CONSECUTIVE:
+            handleConsecutiveFrame(sender, message);
+            break;
+        case TFT_FLOW_CONTROL:
+            handleFlowControl(sender, message);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+void SegmentedTransport::tick() {
+    COMMS_PROFILE_ZONE(PZ_TRANSPORT);
+    uint32_t now = Clock::millis();
+    uint8_t budget = _config.maxFramesPerTick;
+
+    for (TxSlot& slot : _tx) {
+        if (slot.status != TS_IN_PROGRESS) continue;
+
+        if (slot.waitingForFlowControl) {
+            if (now - slot.lastFlowControlTime > _config.timeoutMs) {
+                COMMS_DEBUG_PRINT_ERRORLN("Transfer to %d timed out waiting for flow control!",
+                                          slot.target);
+                slot.status = TS_FAILED;
+            }
+            continue;
+        }
+        pump(slot, &budget);
+    }
+
+    for (RxSlot& slot : _rx) {
+        if (slot.active && now - slot.lastFrameTime > _config.timeoutMs) {
+            COMMS_DEBUG_PRINT_ERRORLN("Transfer from %d timed out!", slot.sender);
+            slot.active = false;
+        }
+    }
+}
+
+void SegmentedTransport::sendFrame(MCUID target, const uint8_t* bytes, uint8_t length) {
+    Option<uint32_t> idOpt = MessageInfo::getMessageID(_me, MT_TRANSPORT);
+    if (idOpt.isNone()) {
+        COMMS_DEBUG_PRINT_ERRORLN("Unable to send a transport frame! No ID for %d (MCUID)", _me);
+        return;
+    }
+
+    RawCommsMessage msg{};
+    msg.id = idOpt.value();
+    msg.length = length;
+    memcpy(msg.payloadBytes, bytes, length);
+    msg.payloadBytes[0] = target;
+    _driver->sendMessage(msg);
+}
+
+void SegmentedTransport::sendFlowControl(MCUID target, TransportFlowStatus status) {
+    uint8_t frame[4] = {};
+    frame[1] = (TFT_FLOW_CONTROL << 4) | status;
+    frame[2] = _config.blockSize;
+    frame[3] = encodeSeparationTime(_config.separationTimeUs);
+    sendFrame(target, frame, 4);
+}
+
+void SegmentedTransport::pump(TxSlot& slot, uint8_t* budget) {
+    uint32_t nowUs = Clock::micros();
+
+    while (*budget > 0 && slot.offset < slot.length) {
+        if (slot.separationTimeUs != 0) {
+            // with a separation time, at most one frame per tick can be due
+            if (nowUs - slot.lastFrameTimeUs < slot.separationTimeUs) return;
+        }
+
+        uint16_t remaining = slot.length - slot.offset;
+        uint8_t chunk = remaining < kConsecutiveFrameData ? remaining : kConsecutiveFrameData;
+
+        uint8_t frame[8] = {};
+        frame[1] = (TFT_CONSECUTIVE << 4) | (slot.sequence & 0x0F);
+        memcpy(frame + 2, slot.data.data() + slot.offset, chunk);
+        sendFrame(slot.target, frame, 2 + chunk);
+
+        slot.offset += chunk;
+        slot.sequence = (slot.sequence + 1) & 0x0F;
+        slot.lastFrameTimeUs = nowUs;
+        (*budget)--;
+
+        if (slot.blockLimited && --slot.blockRemaining == 0 && slot.offset < slot.length) {
+            slot.waitingForFlowControl = true;
+            slot.lastFlowControlTime = Clock::millis();
+            return;
+        }
+        if (slot.separationTimeUs != 0) break;
+    }
+
+    if (slot.offset >= slot.length) slot.status = TS_COMPLETE;
+}
+
+void SegmentedTransport::handleSingleFrame(MCUID sender, const RawCommsMessage& message) {
+    uint8_t length = message.payloadBytes[1] & 0x0F;
+    if (length > kSingleFrameData || length + 2 > message.length) return;
+
+    RxSlot* slot = allocateRxSlot(sender);
+    if (slot == nullptr) {
+        COMMS_DEBUG_PRINT_ERRORLN("No free transport slot, dropping a frame from %d!", sender);
+        return;
+    }
+
+    memcpy(slot->data.data(), message.payloadBytes + 2, length);
+    slot->length = length;
+    slot->complete = true;
+    slot->completedOrder = _completedCount++;
+}
+
+void SegmentedTransport::handleFirstFrame(MCUID sender, const RawCommsMessage& message) {
+    if (message.length < 8) return;
+
+    // a transfer that fits in the first frame should have been a single frame, and one longer than
+    // a slot can't be held, refuse both rather than count past the end of the slot
+    uint16_t length = ((message.payloadBytes[1] & 0x0F) << 8) | message.payloadBytes[2];
+    if (length <= kFirstFrameData || length > kMaxTransferSize) {
+        COMMS_DEBUG_PRINT_ERRORLN("Transfer from %d declared a bad length %d, refusing!", sender,
+                                  length);
+        sendFlowControl(sender, TFS_OVERFLOW);
+        return;
+    }
+
+    // a new first frame from the same sender aborts the transfer in progress
+    RxSlot* slot = findActiveRxSlot(sender);
+    if (slot == nullptr) slot = allocateRxSlot(sender);
+    if (slot == nullptr) {
+        sendFlowControl(sender, TFS_OVERFLOW);
+        return;
+    }
+
+    slot->active = true;
+    slot->length = length;
+    slot->received = kFirstFrameData;
+    slot->sequence = 1;
+    slot->blockRemaining = _config.blockSize;
+    slot->lastFrameTime = Clock::millis();
+    memcpy(slot->data.data(), message.payloadBytes + 3, kFirstFrameData);
+
+    sendFlowControl(sender, TFS_CLEAR_TO_SEND);
+}
+
+void SegmentedTransport::handleConsecutiveFrame(MCUID sender, const RawCommsMessage& message) {
+    RxSlot* slot = findActiveRxSlot(sender);
+    if (slot == nullptr) return;
+
+    if ((message.payloadBytes[1] & 0x0F) != slot->sequence) {
+        COMMS_DEBUG_PRINT_ERRORLN("Transfer from %d lost a frame, aborting!", sender);
+        slot->active = false;
+        return;
+    }
+
+    uint16_t remaining = slot->length - slot->received;
+    uint8_t chunk = remaining < kConsecutiveFrameData ? remaining : kConsecutiveFrameData;
+    if (chunk + 2 > message.length) return;
+
+    memcpy(slot->data.data() + slot->received, message.payloadBytes + 2, chunk);
+    slot->received += chunk;
+    slot->sequence = (slot->sequence + 1) & 0x0F;
+    slot->lastFrameTime = Clock::millis();
+
+    if (slot->received >= slot->length) {
+        slot->active = false;
+        slot->complete = true;
+        slot->completedOrder = _completedCount++;
+        return;
+    }
+
+    if (_config.blockSize != 0 && --slot->blockRemaining == 0) {
+        slot->blockRemaining = _config.blockSize;
+        sendFlowControl(sender, TFS_CLEAR_TO_SEND);
+    }
+}
+
+void SegmentedTransport::handleFlowControl(MCUID sender, const RawCommsMessage& message) {
+    if (message.length < 4) return;
+
+    for (TxSlot& slot : _tx) {
+        if (slot.status != TS_IN_PROGRESS || slot.target != sender) continue;
+        if (!slot.waitingForFlowControl) return;
+
+        slot.lastFlowControlTime = Clock::millis();
+        switch (message.payloadBytes[1] & 0x0F) {
+            case TFS_CLEAR_TO_SEND:
+                slot.waitingForFlowControl = false;
+                slot.blockLimited = message.payloadBytes[2] != 0;
+                slot.blockRemaining = message.payloadBytes[2];
+                slot.separationTimeUs = decodeSeparationTime(message.payloadBytes[3]);
+                // the first frame after flow control may go out right away
+                slot.lastFrameTimeUs = Clock::micros() - slot.separationTimeUs;
+                break;
+            case TFS_WAIT:
+                break;
+            case TFS_OVERFLOW:
+            default:
+                COMMS_DEBUG_PRINT_ERRORLN("Transfer to %d was refused!", sender);
+                slot.status = TS_FAILED;
+                break;
+        }
+        return;
+    }
+}
+
+SegmentedTransport::RxSlot* SegmentedTransport::allocateRxSlot(MCUID sender) {
+    for (RxSlot& slot : _rx) {
+        if (slot.active || slot.complete) continue;
+        slot.sender = sender;
+        return &slot;
+    }
+    return nullptr;
+}
+
+SegmentedTransport::RxSlot* SegmentedTransport::findActiveRxSlot(MCUID sender) {
+    for (RxSlot& slot : _rx) {
+        if (slot.active && slot.sender == sender) return &slot;
+    }
+    return nullptr;
+}
+
+uint8_t SegmentedTransport::encodeSeparationTime(uint32_t us) {
+    if (us == 0) return 0;
+    if (us < 1000) {
+        // 0xF1-0xF9 are 100-900 us, round up so the sender never goes faster than asked
+        uint32_t hundreds = (us + 99) / 100;
+        return hundreds >= 10 ? 1 : static_cast<uint8_t>(0xF0 + hundreds);
+    }
+    uint32_t ms = (us + 999) / 1000;
+    return ms > 127 ? 127 : static_cast<uint8_t>(ms);
+}
+
+uint32_t SegmentedTransport::decodeSeparationTime(uint8_t stMin) {
+    if (stMin <= 0x7F) return stMin * 1000u;
+    if (stMin >= 0xF1 && stMin <= 0xF9) return (stMin - 0xF0) * 100u;
+    // reserved values mean the longest separation time
+    return 127000u;
+}
+
+}  // namespace comms